@@ -0,0 +1,641 @@
+/*
+ * vt100_bench.cpp: Throughput, allocation and latency benchmarks
+ *
+ * Usage: vt100_bench [filter] [min seconds per benchmark]
+ *
+ * Built as a single translation unit (including tui.cpp) so the
+ *   library's allocator hooks can be counted everywhere.  Results go to
+ *   stderr, since the tui benchmarks send stdout to /dev/null.
+ */
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Counted from the mux and replay benchmarks' threads as well */
+static std::atomic<uint64_t> g_allocs;
+
+static void *bench_malloc(size_t size) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size);
+}
+
+static void *bench_calloc(size_t n, size_t size) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  return calloc(n, size);
+}
+
+static void *bench_realloc(void *ptr, size_t size) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  return realloc(ptr, size);
+}
+
+#define VT100_MALLOC(size) bench_malloc(size)
+#define VT100_CALLOC(n, size) bench_calloc(n, size)
+#define VT100_REALLOC(ptr, size) bench_realloc(ptr, size)
+#define VT100_FREE(ptr) free(ptr)
+
+#include "../demos/tui.cpp"
+#include "../vt100cast.h"
+#include "../vt100mux.h"
+#include "../vt100segment.h"
+#include "../vt100utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#if _WIN32
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* C++ allocations (tui's strings and callbacks) count too */
+void *operator new(size_t size) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+/* GCC doesn't see that the replaced operator new above uses malloc */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+#pragma GCC diagnostic pop
+
+/**
+ * CORPORA
+ */
+
+/* Deterministic, so results are comparable between runs */
+static uint32_t g_seed = 1;
+static uint32_t next_rand() {
+  g_seed = g_seed * 1103515245 + 12345;
+  return g_seed >> 8;
+}
+
+static const char *words[] = {"lorem",   "ipsum",      "dolor",  "sit",
+                              "amet",    "consectetur", "elit",  "sed",
+                              "do",      "eiusmod",    "tempor", "ut",
+                              "labore",  "et",         "dolore", "magna"};
+
+static std::string plain_line() {
+  std::string line;
+  while (line.size() < 72) {
+    line += words[next_rand() % (sizeof(words) / sizeof(*words))];
+    line += ' ';
+  }
+  line.back() = '\n';
+  return line;
+}
+
+static std::string corpus_plain(size_t size) {
+  std::string out;
+  while (out.size() < size)
+    out += plain_line();
+  return out;
+}
+
+/* Accented Latin, Greek, Cyrillic, CJK, Hangul and emoji, as UTF-8 */
+static const char *multilingual[] = {
+    "na\xc3\xafve", "cafe\xcc\x81", "\xce\xba\xcf\x8c\xcf\x83\xce\xbc\xce\xb5",
+    "\xd0\xbc\xd0\xb8\xd1\x80", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x80\x82",
+    "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4", "can't", "3.14",
+    "\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x91\xa7",
+    "\xf0\x9f\x87\xaf\xf0\x9f\x87\xb5"};
+
+static std::string corpus_multilingual(size_t size) {
+  std::string out;
+  while (out.size() < size) {
+    out += multilingual[next_rand() % (sizeof(multilingual) /
+                                       sizeof(*multilingual))];
+    out += next_rand() % 8 ? ' ' : '\n';
+  }
+  return out;
+}
+
+/* A color change every ten words or so, as in ls or git output */
+static std::string corpus_sparse(size_t size) {
+  std::string out;
+  while (out.size() < size) {
+    for (int i = 0; i < 8; i++) {
+      if (next_rand() % 10 == 0)
+        out += "\x1b[" + std::to_string(31 + next_rand() % 7) + "m";
+      out += words[next_rand() % (sizeof(words) / sizeof(*words))];
+      if (next_rand() % 10 == 0)
+        out += "\x1b[0m";
+      out += ' ';
+    }
+    out += '\n';
+  }
+  return out;
+}
+
+/* Every character in its own 256-color */
+static std::string corpus_dense(size_t size) {
+  std::string out, line;
+  while (out.size() < size) {
+    line = plain_line();
+    for (char c : line) {
+      out += "\x1b[38;5;" + std::to_string(next_rand() % 256) + "m";
+      out += c;
+    }
+  }
+  return out;
+}
+
+/* Foreground and background gradients, as in truecolor_stresstest */
+static std::string corpus_truecolor(size_t size) {
+  std::string out;
+  char buf[64];
+  for (int row = 0; out.size() < size; row++) {
+    for (int col = 0; col < 80; col++) {
+      snprintf(buf, sizeof(buf), "\x1b[38;2;%i;%i;%i;48;2;%i;%i;%im%c",
+               col * 3, row % 256, 255 - col * 3, row % 256, col * 3, 128,
+               'a' + col % 26);
+      out += buf;
+    }
+    out += "\x1b[0m\n";
+  }
+  return out;
+}
+
+/* GCC-style diagnostics, including their erase-line sequences */
+static std::string corpus_diagnostics(size_t size) {
+  std::string out;
+  char buf[512];
+  for (int i = 0; out.size() < size; i++) {
+    snprintf(buf, sizeof(buf),
+             "\x1b[01m\x1b[Ksrc/module%i.cpp:%i:%i:\x1b[m\x1b[K "
+             "\x1b[01;31m\x1b[Kerror: \x1b[m\x1b[K'\x1b[01m\x1b[Kfoo_%i\x1b[m"
+             "\x1b[K' was not declared in this scope\n"
+             "  %4i |   int x = \x1b[01;31m\x1b[Kfoo_%i\x1b[m\x1b[K(y);\n"
+             "       |           \x1b[01;31m\x1b[K^~~~~\x1b[m\x1b[K\n",
+             i % 40, i % 900 + 1, i % 60 + 1, i, i % 900 + 1, i);
+    out += buf;
+  }
+  return out;
+}
+
+/**
+ * HARNESS
+ */
+struct bench_stats {
+  uint64_t iterations;
+  double seconds;
+  double p50, p90, p99; /* Nanoseconds per iteration */
+  double allocs;        /* Per iteration */
+};
+
+static const char *g_filter = "";
+static double g_min_time = 0.25;
+
+template <typename F> static bench_stats measure(F &&f) {
+  std::vector<double> samples;
+  bench_stats stats = {};
+  uint64_t allocs;
+
+  f(); /* Warm up caches and lazily built tables */
+
+  allocs = g_allocs;
+  while ((stats.seconds < g_min_time || samples.size() < 10) &&
+         samples.size() < 1000000) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    samples.push_back(
+        std::chrono::duration<double, std::nano>(end - start).count());
+    stats.seconds += samples.back() / 1e9;
+  }
+  stats.iterations = samples.size();
+  stats.allocs = (double)(g_allocs - allocs) / stats.iterations;
+
+  std::sort(samples.begin(), samples.end());
+  stats.p50 = samples[samples.size() * 50 / 100];
+  stats.p90 = samples[samples.size() * 90 / 100];
+  stats.p99 = samples[samples.size() * 99 / 100];
+  return stats;
+}
+
+static std::string human(double value, const char *unit) {
+  const char *prefixes[] = {"", "k", "M", "G"};
+  int i = 0;
+  char buf[32];
+  while (value >= 1000 && i < 3) {
+    value /= 1000;
+    i++;
+  }
+  snprintf(buf, sizeof(buf), "%.1f %s%s", value, prefixes[i], unit);
+  return buf;
+}
+
+static std::string duration(double ns) {
+  char buf[32];
+  if (ns >= 1e6)
+    snprintf(buf, sizeof(buf), "%.2f ms", ns / 1e6);
+  else if (ns >= 1e3)
+    snprintf(buf, sizeof(buf), "%.2f us", ns / 1e3);
+  else
+    snprintf(buf, sizeof(buf), "%.0f ns", ns);
+  return buf;
+}
+
+/*
+ * run: Measures f, which processes bytes
+ *   bytes per call, and prints one row
+ */
+template <typename F>
+static void run(const std::string &name, size_t bytes, F &&f) {
+  if (name.find(g_filter) == std::string::npos)
+    return;
+
+  bench_stats stats = measure(f);
+  fprintf(stderr, "%-28s %10s %10s %10s %12s %10.1f %10llu\n", name.c_str(),
+          duration(stats.p50).c_str(), duration(stats.p90).c_str(),
+          duration(stats.p99).c_str(),
+          human(bytes * stats.iterations / stats.seconds, "B/s").c_str(),
+          stats.allocs, (unsigned long long)stats.iterations);
+}
+
+/**
+ * BENCHMARKS
+ */
+static void bench_corpus(const char *corpus, const std::string &str) {
+  std::string prefix = corpus;
+  struct vt100_node_t *head = vt100_decode(str.c_str());
+  std::vector<const char *> sgrs;
+  size_t sgr_bytes = 0, sgr_out_bytes = 0, out_bytes = 0;
+  struct vt100_node_t *prev = NULL;
+  char *out;
+
+  for (const char *p = str.c_str(), *end = p + str.size(); p < end; p++) {
+    if (*p != '\x1b')
+      continue;
+    const char *seq_end = vt100_seq_end(p, end);
+    if (vt100_classify(p, seq_end) == seq_sgr) {
+      sgrs.push_back(p);
+      sgr_bytes += seq_end - p;
+    }
+  }
+
+  for (struct vt100_node_t *tmp = head; tmp != NULL; tmp = tmp->next) {
+    out = vt100_sgr(tmp, prev);
+    sgr_out_bytes += strlen(out);
+    free(out);
+    prev = tmp;
+  }
+
+  out = vt100_encode(head);
+  out_bytes = strlen(out);
+  free(out);
+
+  run(prefix + "/decode", str.size(), [&] {
+    vt100_free(vt100_decode(str.c_str()));
+  });
+
+  run(prefix + "/parse", sgr_bytes, [&] {
+    struct vt100_node_t node = {};
+    for (const char *p : sgrs)
+      vt100_parse(&node, p);
+  });
+
+  run(prefix + "/sgr", sgr_out_bytes, [&] {
+    struct vt100_node_t *prev = NULL;
+    for (struct vt100_node_t *tmp = head; tmp != NULL; tmp = tmp->next) {
+      free(vt100_sgr(tmp, prev));
+      prev = tmp;
+    }
+  });
+
+  run(prefix + "/encode", out_bytes, [&] { free(vt100_encode(head)); });
+
+#if _WIN32
+#else
+  /* One box per line of the first screenful, drawn to /dev/null */
+  {
+    std::vector<std::string> lines;
+    size_t start = 0, end, draw_bytes = 0;
+    while (lines.size() < 24 &&
+           (end = str.find('\n', start)) != std::string::npos) {
+      lines.push_back(str.substr(start, end - start));
+      draw_bytes += end - start;
+      start = end + 1;
+    }
+
+    int saved = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+    fflush(stdout);
+    dup2(null, STDOUT_FILENO);
+    {
+      tui u(0);
+      for (size_t i = 0; i < lines.size(); i++) {
+        std::string line = lines[i];
+        u.add({1, (int)i, 80, 1}, [line](tui_box) { return line; }, {}, {});
+      }
+      run(prefix + "/tui_draw", draw_bytes, [&] { u.redraw(); });
+
+      /* A wheel tick back and forth */
+      int n = 2;
+      u.draw();
+      uint64_t frames = u.frame_stats().frame;
+      run(prefix + "/tui_scroll", 0, [&] {
+        u.scroll(n);
+        n = -n;
+      });
+      if (u.frame_stats().frame > frames)
+        fprintf(stderr, "%-28s %10zu bytes per frame\n", "",
+                u.frame_stats().bytes);
+      fflush(stdout);
+    }
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(null);
+  }
+#endif
+
+  vt100_free(head);
+}
+
+/* Walking text by grapheme clusters, words and line breaks, and
+ *   wrapping it */
+static void bench_segment(const char *corpus, const std::string &str) {
+  std::string prefix = std::string("segment/") + corpus;
+  const char *start = str.data(), *end = start + str.size();
+  size_t counts[4] = {0, 0, 0, 0};
+  int mandatory, width;
+
+  run(prefix + "/graphemes", str.size(), [&] {
+    size_t n = 0;
+    for (const char *p = start; p < end; p = vt100_grapheme_next(p, end))
+      n++;
+    counts[0] = n;
+  });
+  run(prefix + "/words", str.size(), [&] {
+    size_t n = 0;
+    for (const char *p = start; p < end; p = vt100_word_next(p, end))
+      n++;
+    counts[1] = n;
+  });
+  run(prefix + "/lines", str.size(), [&] {
+    size_t n = 0;
+    for (const char *p = start; p < end;
+         p = vt100_line_next(p, end, &mandatory))
+      n++;
+    counts[2] = n;
+  });
+  run(prefix + "/wrap_60", str.size(), [&] {
+    size_t n = 0;
+    for (const char *p = start; p < end; p = vt100_wrap(p, end, 60, &width))
+      n++;
+    counts[3] = n;
+  });
+  if (counts[0] || counts[1] || counts[2] || counts[3])
+    fprintf(stderr, "%-28s %zu clusters, %zu words, %zu breaks, %zu rows\n",
+            "", counts[0], counts[1], counts[2], counts[3]);
+}
+
+#if _WIN32
+#else
+/* Scrolling a list of a million rows a line at a time, drawn to /dev/null */
+static void bench_list() {
+  int saved = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+  fflush(stdout);
+  dup2(null, STDOUT_FILENO);
+  {
+    tui u(0);
+    long n = 1;
+    tui_list *l = u.add_list(
+        {1, 1, u.cols(), u.rows() - 1}, 1000000,
+        [](size_t i, std::string &out) {
+          out += "\x1b[38;5;" + std::to_string(16 + i % 216) + "m" +
+                 std::to_string(i) + "\x1b[0m row of the list";
+        },
+        {});
+    u.draw();
+    /* Back and forth, so it never reaches the end */
+    run("tui/list_scroll", 0, [&] {
+      u.scroll_list(l, n);
+      n = -n;
+    });
+    if (u.frame_stats().frame > 1)
+      fprintf(stderr, "%-28s %10zu bytes per frame\n", "",
+              u.frame_stats().bytes);
+    fflush(stdout);
+  }
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  close(null);
+}
+
+/* A 10k-word paragraph, relaid out after its first word changes width */
+static void bench_flow() {
+  int saved = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+  fflush(stdout);
+  dup2(null, STDOUT_FILENO);
+  {
+    tui u(0);
+    tui_flow *f = u.add_flow({1, 1, u.cols(), u.rows()}, 1, 0);
+    bool wide = false;
+    tui_box first = u.add(
+        f, [&](tui_box) { return std::string(wide ? "longer" : "word"); },
+        {}, {});
+    for (int i = 1; i < 10000; i++) {
+      std::string word = words[next_rand() % (sizeof(words) / sizeof(*words))];
+      u.add(f, [word](tui_box) { return word; }, {}, {});
+    }
+    u.layout(f);
+    run("tui/flow_relayout_10k", 0, [&] {
+      wide = !wide;
+      u.invalidate(first);
+      u.layout(f);
+    });
+    fflush(stdout);
+  }
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  close(null);
+}
+
+/* Switching between two full screens, which are repainted as retained */
+static void bench_screens(const std::string &str) {
+  int saved = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+  fflush(stdout);
+  dup2(null, STDOUT_FILENO);
+  {
+    tui u(0);
+    for (int s = 0; s < 2; s++) {
+      u.set_screen(s);
+      size_t start = s * str.size() / 2, end;
+      for (int i = 1; i < u.rows(); i++, start = end + 1) {
+        end = str.find('\n', start);
+        std::string line = str.substr(start, end - start);
+        u.add({1, i, u.cols(), 1}, [line](tui_box) { return line; }, {}, {});
+      }
+      u.draw();
+    }
+    int s = 0, switches = 0;
+    run("tui/screen_switch", 0, [&] {
+      u.set_screen(s ^= 1);
+      switches++;
+    });
+    if (switches && u.frame_stats().rebuilt == 0)
+      fprintf(stderr, "%-28s %10zu bytes per frame, no boxes drawn\n", "",
+              u.frame_stats().bytes);
+    fflush(stdout);
+  }
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  close(null);
+}
+
+/* A recorded session of the mouse sweeping over a grid of boxes, which
+ *   grow while hovered and count clicks, replayed onto a headless terminal */
+struct replay_app {
+  ui_t_headless *term = new ui_t_headless(80, 24);
+  tui u{0, term};
+  struct vt100_cast_t cast = {80, 24, {}};
+  std::vector<tui_box> boxes;
+  std::vector<int> widths, clicks;
+  std::vector<uint32_t> animations;
+
+  replay_app() {
+    int w = u.cols() / 8, h = u.rows() / 6;
+    char buf[32];
+
+    for (int y = 0; y < 6; y++) {
+      for (int x = 0; x < 8; x++) {
+        int i = boxes.size();
+        widths.push_back(4);
+        clicks.push_back(0);
+        animations.push_back(0);
+        boxes.push_back(u.add(
+            {1 + x * w, 1 + y * h, w - 1, 1},
+            [this, i](tui_box) {
+              return "\x1b[38;5;" + std::to_string(16 + i * 5 % 216) + "m" +
+                     std::string(widths[i], '#') + "\x1b[0m" +
+                     std::to_string(clicks[i]);
+            },
+            [this, i](tui_box b, int, int, int) {
+              clicks[i]++;
+              u.invalidate(b);
+              u.refresh();
+            },
+            [this, i, w](tui_box, int, int, int) {
+              grow(i, widths[i] < w - 4 ? w - 4 : 4);
+            }));
+      }
+    }
+    u.draw();
+
+    /* 2000 events 5ms apart, clicking every tenth */
+    for (int k = 0; k < 2000; k++) {
+      int x = 1 + k * 3 % u.cols(), y = 1 + (k / 40 * h) % (6 * h);
+      snprintf(buf, sizeof(buf), "\x1b[<%i;%i;%i%c", k % 10 ? 35 : 0, x, y,
+               k % 10 ? 'M' : 'm');
+      cast.events.push_back({k * 0.005, 'i', buf});
+    }
+  }
+
+  /* Tweens box i's width towards target */
+  void grow(int i, int target) {
+    u.cancel(animations[i]);
+    animations[i] =
+        u.animate(120, [this, i, from = widths[i], target](double t) {
+          widths[i] = tui_lerp(from, target, t);
+          u.invalidate(boxes[i]);
+        });
+  }
+};
+
+/* Each thread replays onto a tui of its own */
+static void bench_replay(int threads) {
+  std::vector<std::unique_ptr<replay_app>> apps;
+  std::vector<uint64_t> frames(threads);
+
+  for (int i = 0; i < threads; i++)
+    apps.push_back(std::make_unique<replay_app>());
+  run("tui/replay_2k_events/threads=" + std::to_string(threads), 0, [&] {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+      workers.emplace_back([&, i] {
+        frames[i] = apps[i]->u.replay(apps[i]->cast, NULL);
+      });
+    }
+    for (auto &worker : workers)
+      worker.join();
+  });
+  if (frames[0])
+    fprintf(stderr, "%-28s %10llu frames per replay\n", "",
+            (unsigned long long)frames[0]);
+}
+#endif
+
+/* Many streams written at once, decoded by a pool of threads */
+static void bench_mux(const std::string &str, int threads) {
+  struct vt100_mux_t *mux = vt100_mux_new(threads);
+  std::vector<struct vt100_stream_t *> streams;
+  const size_t chunk = 4096;
+
+  for (int i = 0; i < 256; i++)
+    streams.push_back(vt100_mux_open(mux, 80, 24, 1000));
+
+  run("mux/threads=" + std::to_string(threads), streams.size() * str.size(),
+      [&] {
+        for (size_t pos = 0; pos < str.size(); pos += chunk) {
+          for (auto stream : streams)
+            vt100_mux_write(mux, stream, str.data() + pos,
+                            std::min(chunk, str.size() - pos));
+        }
+        vt100_mux_flush(mux);
+      });
+
+  vt100_mux_free(mux);
+}
+
+int main(int argc, char **argv) {
+  const size_t size = 64 * 1024;
+  /* hardware_concurrency may not know, and return 0 */
+  const int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+
+  if (argc > 1)
+    g_filter = argv[1];
+  if (argc > 2)
+    g_min_time = atof(argv[2]);
+
+  fprintf(stderr, "%-28s %10s %10s %10s %12s %10s %10s\n", "Benchmark", "p50",
+          "p90", "p99", "Throughput", "Allocs", "Iterations");
+
+  bench_corpus("plain", corpus_plain(size));
+  bench_corpus("sparse", corpus_sparse(size));
+  bench_corpus("dense256", corpus_dense(size));
+  bench_corpus("truecolor", corpus_truecolor(size));
+  bench_corpus("diagnostics", corpus_diagnostics(size));
+
+  bench_segment("plain", corpus_plain(size));
+  bench_segment("utf8", corpus_multilingual(size));
+
+#if _WIN32
+#else
+  bench_list();
+  bench_flow();
+  bench_screens(corpus_dense(size));
+  for (int threads = 1; threads < cores; threads *= 2)
+    bench_replay(threads);
+  bench_replay(cores);
+#endif
+
+  std::string sparse = corpus_sparse(16 * 1024);
+  for (int threads = 1; threads < cores; threads *= 2)
+    bench_mux(sparse, threads);
+  bench_mux(sparse, cores);
+
+  return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * dashboard.cpp: Many job logs tailed at once
+ *
+ * Each simulated job writes its log to a stream of a vt100_mux_t, which
+ *   decodes the streams on a pool of threads; the UI only redraws boxes
+ *   whose stream has a new snapshot.
+ */
+#include "../vt100mux.h"
+#include "tui.h"
+#include <chrono>
+#include <string>
+#include <thread>
+
+#define JOBS_X 3
+#define JOBS_Y 4
+
+tui *g_u = nullptr;
+struct vt100_mux_t *g_mux = nullptr;
+tui_box g_boxes[JOBS_X * JOBS_Y]; /* Each stream's data points to its box */
+std::atomic<int> g_running = 1;
+
+void stop() {
+  g_running = 0;
+  delete g_u;
+  exit(0);
+}
+
+/* Writes build-log-like lines to random streams, at random rates */
+void jobs(std::vector<struct vt100_stream_t *> streams) {
+  uint32_t seed = 1;
+  std::vector<int> progress(streams.size());
+  char line[160];
+  int i, len;
+
+  while (g_running) {
+    seed = seed * 1103515245 + 12345;
+    i = (seed >> 8) % streams.size();
+    if (progress[i] == 100) {
+      len = snprintf(line, sizeof(line),
+                     "\x1b[1;32mjob %i passed\x1b[0m\r\n", i + 1);
+      progress[i] = 0;
+    } else {
+      progress[i]++;
+      len = snprintf(line, sizeof(line),
+                     "\x1b[32m[%3i%%]\x1b[0m Building CXX object "
+                     "\x1b[1msrc/unit%i.o\x1b[0m%s\r\n",
+                     progress[i], (int)(seed >> 4) % 500,
+                     (seed >> 12) % 9 ? "" : " \x1b[33mwarning\x1b[0m");
+    }
+    vt100_mux_write(g_mux, streams[i], line, len);
+    std::this_thread::sleep_for(std::chrono::microseconds(500));
+  }
+}
+
+int main(void) {
+  std::vector<struct vt100_stream_t *> streams;
+  int w, h;
+
+  g_u = new tui(0);
+  g_mux = vt100_mux_new(0);
+
+  w = g_u->cols() / JOBS_X;
+  h = (g_u->rows() - 1) / JOBS_Y;
+  for (int y = 0; y < JOBS_Y; y++) {
+    for (int x = 0; x < JOBS_X; x++) {
+      auto stream = vt100_mux_open(g_mux, w - 1, h - 1, 100);
+      int id = streams.size() + 1;
+      streams.push_back(stream);
+
+      stream->data = &g_boxes[id - 1];
+      g_boxes[id - 1] = g_u->add(
+          {1 + x * w, 1 + y * h, w - 1, h},
+          [stream, id](tui_box) {
+            auto snapshot = vt100_mux_snapshot(stream);
+            return "\x1b[0;7m job " + std::to_string(id) + " \x1b[0m " +
+                   std::to_string(snapshot ? snapshot->bytes : 0) +
+                   " bytes\n" + (snapshot ? snapshot->text : "");
+          },
+          {}, {});
+    }
+  }
+
+  /* Workers only wake the UI once per frame, however many streams change */
+  g_mux->notify = [](void *) { g_u->wake(); };
+  g_u->on_wake([] {
+    vt100_mux_changed(g_mux, [](struct vt100_stream_t *stream) {
+      g_u->invalidate(*(tui_box *)stream->data);
+    });
+    g_u->draw();
+  });
+  g_u->on_key("q", stop);
+  g_u->draw();
+
+  std::thread(jobs, streams).detach();
+  g_u->mainloop();
+
+  return 0;
+}
@@ -1,69 +1,75 @@
 /*
  * hover.c: A simple truncation/hover animation
+ *
+ * The width is tweened by the tui's animation scheduler, so the UI keeps
+ *   handling input while the text grows and shrinks.
  */
 
-#include "../vt100utils.h"
+#include "../vt100static.h"
 #include "tui.h"
 #include <sstream>
-#if _WIN32
-#else
-#include <unistd.h>
-#endif
 
 #define MIN(a, b) (a < b ? a : b)
 
 tui *g_u = nullptr;
-struct vt100_node_t *head;
+tui_box g_box;
 int w = 12;
+int g_target = 12;
+uint32_t g_animation = 0;
 
-std::string draw(tui_box *b) {
-  ;
+/* Decoded at compile time */
+constexpr auto &text = vt100_static<
+    "\x1b[36mClick to see "
+    "\x1b[4;38;5;125mt\x1b[38;5;127mh\x1b[38;5;130mi\x1b[38;5;135ms "
+    "\x1b[38;5;140mt\x1b[38;5;145me\x1b[38;5;150mx\x1b[38;5;155mt\x1b[0;36m "
+    "un-truncate!">;
+
+std::string draw(tui_box b) {
   int len = 0;
   std::stringstream ss;
-  for (struct vt100_node_t *tmp = head->next; tmp != NULL; tmp = tmp->next) {
-    auto sgr = vt100_sgr(tmp, NULL);
-    ss << sgr << std::string_view(tmp->str).substr(0, MAX(0, w - len));
-    free(sgr);
+  for (size_t i = 0; i < text.count(); i++) {
+    ss << text.sgr(i) << text.str(i).substr(0, MAX(0, w - len));
+    len += text.str(i).size();
   }
-  ss << (w < 47 ? "..." : "") << "\n";
+  /* The ellipsis fades out as the text is revealed */
+  uint32_t rgb = tui_lerp_rgb(0xffffff, 0x303030, (w - 12.0) / (len - 12));
+  if (w < len)
+    ss << "\x1b[0;38;2;" << (rgb >> 16) << ";" << ((rgb >> 8) & 0xff) << ";"
+       << (rgb & 0xff) << "m...";
+  ss << "\n";
   return ss.str();
 }
 
-void click(tui_box *b, int x, int y, int) {
-  while (w < 50) {
-    w+=10;
-    g_u->redraw();
-    usleep(10000);
-  }
+/* Tweens the width to target, from wherever it is now */
+void resize(int target, int ms) {
+  if (target == g_target)
+    return;
+  g_target = target;
+  g_u->cancel(g_animation);
+  g_animation = g_u->animate(ms, [from = w, target](double t) {
+    w = tui_lerp(from, target, t);
+    g_u->invalidate(g_box);
+  });
 }
 
-void hover(tui_box *b, int x, int y, int down) {
+void click(tui_box b, int x, int y, int) { resize(50, 150); }
+
+void hover(tui_box b, int x, int y, int down) {
   if (down) {
     click(b, x, y, {});
   } else {
-    while (w > 12) {
-      w--;
-      g_u->redraw();
-      usleep(10000);
-    }
+    resize(12, 400);
   }
 }
 
 void stop() {
   delete g_u;
-  vt100_free(head);
   exit(0);
 }
 
 int main(void) {
-  head = vt100_decode(
-      "\x1b[36mClick to see "
-      "\x1b[4;38;5;125mt\x1b[38;5;127mh\x1b[38;5;130mi\x1b[38;5;135ms "
-      "\x1b[38;5;140mt\x1b[38;5;145me\x1b[38;5;150mx\x1b[38;5;155mt\x1b[0;36m "
-      "un-truncate!");
-
   g_u = new tui(0);
-  g_u->add(g_u->get_center(35, 1), draw, click, hover);
+  g_box = g_u->add(g_u->get_center(35, 1), draw, click, hover);
   g_u->on_key("q", stop);
   g_u->draw();
   g_u->mainloop();
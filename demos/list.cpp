@@ -0,0 +1,56 @@
+/*
+ * list.cpp: A million-row list, only ever formatting the visible rows
+ */
+#include "../vt100utils.h"
+#include "tui.h"
+#include <string>
+
+tui *g_u = nullptr;
+tui_list *g_list = nullptr;
+size_t g_selected = SIZE_MAX;
+
+void stop() {
+  delete g_u;
+  exit(0);
+}
+
+void down() { g_u->scroll_list(g_list, 1); }
+void up() { g_u->scroll_list(g_list, -1); }
+void page_down() { g_u->scroll_list(g_list, g_list->rect_.h); }
+void page_up() { g_u->scroll_list(g_list, -g_list->rect_.h); }
+
+int main(void) {
+  g_u = new tui(0);
+
+  g_u->add_text(1, 1,
+                "\x1b[36mScroll with the mouse wheel, j/k or space/b; click a "
+                "row to select it (press \"q\" to exit)\x1b[0m",
+                {}, {});
+
+  g_list = g_u->add_list(
+      {1, 2, g_u->cols(), g_u->rows() - 2}, 1000000,
+      [](size_t i, std::string &out) {
+        char buf[128];
+        snprintf(buf, sizeof(buf),
+                 "%s\x1b[38;5;%im%7zu\x1b[0m%s  row %zu of the list%s",
+                 i == g_selected ? "\x1b[7m" : "", (int)(16 + i % 216), i,
+                 i == g_selected ? "\x1b[7m" : "", i,
+                 i % 10 == 0 ? "  \x1b[1;33m(every tenth)" : "");
+        out += buf;
+      },
+      [](tui_list *l, size_t i) {
+        g_selected = i;
+        g_u->update_list(l, l->count());
+      });
+
+  g_u->on_key("j", down);
+  g_u->on_key("k", up);
+  g_u->on_key(" ", page_down);
+  g_u->on_key("b", page_up);
+  g_u->on_key("q", stop);
+  g_u->draw();
+
+  g_u->mainloop();
+
+  return 0;
+}
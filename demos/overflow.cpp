@@ -9,12 +9,14 @@
 
 tui *g_u = nullptr;
 struct vt100_node_t *g_head = nullptr;
+struct vt100_styles_t *g_styles = nullptr;
+struct vt100_sgr_cache_t *g_cache = nullptr;
 int w = 50;
 
 void draw(void) {
   int x = 0;
   int off = 0;
-  char *sgr;
+  char sgr[128];
 
   printf("\x1b[0;0H\x1b[2J\x1b[36m(Press \"q\" to exit)\n\x1b[32mColumn width: "
          "%i\x1b[0m\n\n",
@@ -33,7 +35,8 @@ void draw(void) {
 
     printf("│\x1b[0m ");
     while (x < w) {
-      sgr = vt100_sgr(tmp, NULL);
+      /* Every line restarts from a reset, so the same few transitions repeat */
+      sgr[vt100_sgr_cached(g_cache, -1, tmp->style, sgr)] = '\0';
       printf("%s%.*s", sgr, MIN(w - x - 1, tmp->len - off - 1), tmp->str + off);
       if (tmp->len - off - 1 > w - x - 1) {
         off += w - x - 1;
@@ -45,11 +48,9 @@ void draw(void) {
 
         if (tmp == NULL) {
           x++;
-          free(sgr);
           break;
         }
       }
-      free(sgr);
     }
 
     for (; x < w; x++) {
@@ -82,10 +83,16 @@ void grow() {
 void stop() {
   delete g_u;
   vt100_free(g_head);
+  vt100_sgr_cache_free(g_cache);
+  vt100_styles_free(g_styles);
   exit(0);
 }
 
 int main(void) {
+  g_styles = vt100_styles_new();
+  g_cache = vt100_sgr_cache_new(g_styles, 64);
+  global_styles = g_styles;
+
   g_head = vt100_decode(
       "\x1b[31mLorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
       "eiusmod tempor incididunt ut labore et dolore magna aliqua. \x1b[32mUt "
@@ -0,0 +1,99 @@
+/*
+ * pages.cpp: Several screens, switched between with the number keys
+ *
+ * Each screen keeps what it last showed, so switching back to one
+ *   repaints it without drawing any of its boxes again (the statistics in
+ *   the top right corner show how many were drawn).
+ */
+#include "tui.h"
+#include <string>
+
+#define PAGES 3
+
+tui *g_u = nullptr;
+int g_clicks[64];
+
+void stop() {
+  delete g_u;
+  exit(0);
+}
+
+/* The tabs along the top, with the given page highlighted */
+void add_tabs(int page) {
+  const char *names[PAGES] = {"Grid", "Paragraph", "List"};
+  std::string tabs;
+
+  for (int i = 0; i < PAGES; i++) {
+    tabs += i == page ? "\x1b[0;7m" : "\x1b[0;36m";
+    tabs += " " + std::to_string(i + 1) + " " + names[i] + " \x1b[0m ";
+  }
+  g_u->add_text(1, 1, tabs + "\x1b[2m(press \"q\" to exit)\x1b[0m", {}, {});
+}
+
+void grid() {
+  int w = (g_u->cols() - 2) / 8;
+
+  for (int i = 0; i < 64; i++) {
+    g_u->add(
+        {2 + (i % 8) * w, 3 + (i / 8) * 2, w - 1, 1},
+        [i](tui_box) {
+          return "\x1b[38;5;" + std::to_string(16 + (i * 7 + g_clicks[i]) % 216) +
+                 "m[" + std::to_string(g_clicks[i]) + " clicks]\x1b[0m";
+        },
+        [i](tui_box b, int, int, int) {
+          g_clicks[i]++;
+          g_u->invalidate(b);
+          g_u->draw_one(b, 1);
+        },
+        {});
+  }
+}
+
+void paragraph() {
+  const char *words[] = {"Each", "screen", "has", "its", "own", "boxes,",
+                         "and", "only", "the", "current", "one's", "see",
+                         "the", "mouse."};
+  tui_flow *flow = g_u->add_flow({2, 3, g_u->cols() - 4, g_u->rows() - 4},
+                                 1, 0);
+
+  for (int i = 0; i < 300; i++) {
+    std::string word = words[i % (sizeof(words) / sizeof(*words))];
+    g_u->add(
+        flow,
+        [word, i](tui_box) {
+          return "\x1b[38;5;" + std::to_string(100 + i % 50) + "m" + word;
+        },
+        {}, {});
+  }
+}
+
+void list() {
+  g_u->add_list({1, 3, g_u->cols(), g_u->rows() - 3}, 100000,
+                [](size_t i, std::string &out) {
+                  out += "\x1b[33m" + std::to_string(i) +
+                         "\x1b[0m  a row of the third screen";
+                },
+                {});
+}
+
+int main(void) {
+  void (*pages[PAGES])() = {grid, paragraph, list};
+
+  g_u = new tui(0);
+  g_u->show_stats(true);
+  /* Ending on the first, which is drawn when switched to */
+  for (int i = PAGES - 1; i >= 0; i--) {
+    g_u->set_screen(i);
+    add_tabs(i);
+    pages[i]();
+  }
+
+  g_u->on_key("1", [] { g_u->set_screen(0); });
+  g_u->on_key("2", [] { g_u->set_screen(1); });
+  g_u->on_key("3", [] { g_u->set_screen(2); });
+  g_u->on_key("q", stop);
+
+  g_u->mainloop();
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * stream.cpp: A command's output, shown as it arrives
+ *
+ * The command is read and decoded on a thread of its own, which hands
+ *   batches of nodes to the UI through a vt100_ring_t, so the UI stays
+ *   responsive however fast the command writes.
+ *
+ * Usage: stream [command]
+ */
+#include "../vt100ring.h"
+#include "tui.h"
+#include <deque>
+#include <string>
+#include <thread>
+
+tui *g_u = nullptr;
+struct vt100_ring_t *g_ring = nullptr;
+std::deque<std::string> g_lines(1);
+size_t g_bytes = 0;
+bool g_done = false;
+
+void stop() {
+  delete g_u;
+  exit(0);
+}
+
+/* Reads whole lines, so no escape sequence is split between batches */
+void produce(const char *command) {
+  FILE *file = popen(command, "r");
+  std::string buf;
+  char chunk[4096];
+  size_t n, end;
+
+  while (file && (n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    buf.append(chunk, n);
+    if ((end = buf.rfind('\n')) == std::string::npos)
+      continue;
+    std::string lines = buf.substr(0, end + 1);
+    buf.erase(0, end + 1);
+    vt100_ring_push_wait(g_ring, {vt100_decode(lines.c_str()), lines.size(),
+                                  nullptr});
+  }
+  if (!buf.empty())
+    vt100_ring_push_wait(g_ring,
+                         {vt100_decode(buf.c_str()), buf.size(), nullptr});
+  if (file)
+    pclose(file);
+  /* An empty batch marks the end */
+  vt100_ring_push_wait(g_ring, {nullptr, 0, nullptr});
+  vt100_ring_close(g_ring);
+}
+
+/* Splits the batch into lines, giving each run its full graphics state */
+void consume(struct vt100_batch_t &batch, tui_box box) {
+  size_t rows = g_u->rows() - 3;
+  char *sgr;
+
+  if (!batch.head) {
+    g_done = true;
+    return;
+  }
+
+  for (auto tmp = batch.head; tmp != NULL; tmp = tmp->next) {
+    for (const char *p = tmp->str, *nl; *p; p = nl + 1) {
+      nl = strchr(p, '\n');
+      if (!nl)
+        nl = p + strlen(p) - 1;
+      if (g_lines.back().empty() || p == tmp->str) {
+        sgr = vt100_sgr(tmp, NULL);
+        g_lines.back() += sgr;
+        free(sgr);
+      }
+      g_lines.back().append(p, *nl == '\n' ? nl - p : nl - p + 1);
+      if (*nl == '\n')
+        g_lines.emplace_back();
+    }
+  }
+
+  while (g_lines.size() > rows)
+    g_lines.pop_front();
+  g_bytes += batch.bytes;
+  vt100_free(batch.head);
+  g_u->invalidate(box);
+}
+
+int main(int argc, char **argv) {
+  const char *command =
+      argc > 1 ? argv[1]
+               : "for i in $(seq 1 20000); do printf '\\033[3%im%05i\\033[0m "
+                 "\\033[1mline\\033[0m\\n' $((i % 7 + 1)) $i; done";
+
+  g_u = new tui(0);
+  g_ring = vt100_ring_new(64);
+
+  tui_box status = g_u->add(
+      {1, 1, g_u->cols(), 1},
+      [](tui_box) {
+        return "\x1b[0;7m " + std::to_string(g_bytes) + " bytes, " +
+               (g_done ? "done" : "running") +
+               " (press \"q\" to exit) \x1b[0m";
+      },
+      {}, {});
+  tui_box text = g_u->add(
+      {1, 2, g_u->cols(), g_u->rows() - 3},
+      [](tui_box) {
+        std::string out;
+        for (auto &line : g_lines)
+          out += line + "\x1b[0m\n";
+        return out;
+      },
+      {}, {});
+
+  g_u->feed(g_ring, [status, text](struct vt100_batch_t &batch) {
+    consume(batch, text);
+    g_u->invalidate(status);
+  });
+  g_u->on_key("q", stop);
+  g_u->draw();
+
+  std::thread(produce, command).detach();
+  g_u->mainloop();
+
+  return 0;
+}
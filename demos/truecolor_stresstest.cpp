@@ -3,6 +3,9 @@
  *
  * Should produce a clean green-magenta gradient, with black in the top
  *   left and white in the bottom right
+ *
+ * Pass 256, 16, 8, or mono to downsample the gradient for terminals
+ *   without truecolor support
  */
 
 #include <stdio.h>
@@ -13,12 +16,19 @@
 #define VT100UTILS_SKIP_FORMATTING
 #include "../vt100utils.h"
 
-int main(){
+int main(int argc, char **argv){
   int x, y, len = 0;
   char *buf;
   struct winsize ws;
   struct vt100_node_t *head;
 
+  if (argc > 1) {
+    if (strcmp(argv[1], "256") == 0) global_depth = depth_256;
+    else if (strcmp(argv[1], "16") == 0) global_depth = depth_16;
+    else if (strcmp(argv[1], "8") == 0) global_depth = depth_8;
+    else if (strcmp(argv[1], "mono") == 0) global_depth = depth_mono;
+  }
+
   ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
   buf = (char*)malloc(ws.ws_row * ws.ws_col * 20);
 
@@ -1,5 +1,11 @@
 #include "tui.h"
+#include "../vt100cast.h"
+#include "../vt100ring.h"
+#include "../vt100screen.h"
+#include "../vt100utils.h"
 #include "tokenizer.h"
+#include <algorithm>
+#include <errno.h>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
@@ -7,45 +13,28 @@
 #include <stdlib.h>
 #include <string.h>
 
-/*
- * Adds a new box to the UI.
- *
- * This function is very simple in
- *   nature, but the variety of
- *   properties associated with
- *   an individual box makes it
- *   intimidating to look at.
- * TODO: Find some way to
- *   strip this down.
- */
-std::shared_ptr<tui_box> tui_box::create(const tui_rect &rect, int screen,
-                                         draw_func draw, loop_func onclick,
-                                         loop_func onhover) {
-
-  auto b = std::shared_ptr<tui_box>(new tui_box);
-  b->rect_ = rect;
-  b->screen_ = screen;
-  // b->watch = watch;
-  // b->last = initial;
-  b->draw = draw;
-  b->onclick = onclick;
-  b->onhover = onhover;
-  // b->data2 = data2;
-  b->cache = draw(b.get());
-  return b;
+/* Suggests a native terminal, once the screen is restored */
+static void tui_multiplexer_note() {
+  auto term = getenv("TERM");
+  if (term &&
+      (strncmp(term, "screen", 6) == 0 || strncmp(term, "tmux", 4) == 0)) {
+    printf("Note: Terminal multiplexer detected.\n  For best performance (i.e. "
+           "reduced flickering), running natively inside\n  a GPU-accelerated "
+           "terminal such as alacritty or kitty is recommended.\n");
+  }
 }
 
 #if _WIN32
 #include <Windows.h>
 
-class ui_t_impl {
+class ui_t_term : public ui_t_impl {
   HANDLE hStdin_ = nullptr;
   DWORD fdwSaveOldMode_ = {};
   uint16_t cols_ = 0;
   uint16_t rows_ = 0;
 
 public:
-  ui_t_impl() {
+  ui_t_term() {
     // Get the standard input handle.
     hStdin_ = GetStdHandle(STD_INPUT_HANDLE);
     if (hStdin_ == INVALID_HANDLE_VALUE) {
@@ -73,20 +62,21 @@ public:
     rows_ = info.dwSize.Y;
   }
 
-  ~ui_t_impl() {
+  ~ui_t_term() {
     // Restore input mode on exit.
     SetConsoleMode(hStdin_, fdwSaveOldMode_);
+    tui_multiplexer_note();
   }
-  bool Contains(int x, int y) const {
+  bool Contains(int x, int y) const override {
     return false;
     return x > 0 && x < this->Cols() && y > 0 && y < this->Rows();
   }
-  uint16_t Cols() const { return cols_; }
-  uint16_t Rows() const { return rows_; }
+  uint16_t Cols() const override { return cols_; }
+  uint16_t Rows() const override { return rows_; }
 
   std::string str_;
 
-  std::optional<std::string_view> Read() {
+  std::optional<std::string_view> Read() override {
     str_.clear();
     INPUT_RECORD irInBuf[128];
     DWORD cNumRead = 0;
@@ -138,50 +128,207 @@ public:
 
     return str_;
   }
+
+  /* Returns the number of writes needed */
+  int Write(std::string_view str) override {
+    fwrite(str.data(), 1, str.size(), stdout);
+    fflush(stdout);
+    return 1;
+  }
+
+  /* Console handles can't be waited on with a pipe, so poll for batches */
+  void Wake() override {}
+  int Wait(int timeout) override {
+    DWORD ms = timeout < 0 ? 16 : timeout;
+    return WaitForSingleObject(hStdin_, ms) == WAIT_OBJECT_0
+               ? tui_wait_input | tui_wait_wake
+               : tui_wait_wake;
+  }
 };
 #else
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 
-class ui_t_impl {
+class ui_t_term : public ui_t_impl {
   struct termios tio;
   struct winsize ws;
+  int wake_[2] = {-1, -1}; /* Self-pipe, written to by other threads */
 
 public:
-  ui_t_impl() {
+  ui_t_term() {
     struct termios raw;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &(this->ws));
+    /* Not a terminal (e.g. when benchmarking): assume 80x24 */
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &(this->ws)) != 0 ||
+        this->ws.ws_col == 0) {
+      this->ws.ws_col = 80;
+      this->ws.ws_row = 24;
+    }
     tcgetattr(STDIN_FILENO, &(this->tio));
     raw = this->tio;
     raw.c_lflag &= ~(ECHO | ICANON);
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    if (pipe(this->wake_) == 0) {
+      fcntl(this->wake_[0], F_SETFL, O_NONBLOCK);
+      fcntl(this->wake_[1], F_SETFL, O_NONBLOCK);
+    }
     printf(
         "\x1b[?1049h\x1b[0m\x1b[2J\x1b[?1003h\x1b[?1015h\x1b[?1006h\x1b[?25l");
   }
 
-  ~ui_t_impl() {
+  ~ui_t_term() {
     printf(
         "\x1b[0m\x1b[2J\x1b[?1049l\x1b[?1003l\x1b[?1015l\x1b[?1006l\x1b[?25h");
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &(this->tio));
+    if (this->wake_[0] >= 0) {
+      close(this->wake_[0]);
+      close(this->wake_[1]);
+    }
+    tui_multiplexer_note();
   }
 
-  bool Contains(int x, int y) const {
+  bool Contains(int x, int y) const override {
     return x > 0 && x < this->ws.ws_col && y > 0 && y < this->ws.ws_row;
   }
 
-  uint16_t Cols() const { return ws.ws_col; }
+  uint16_t Cols() const override { return ws.ws_col; }
 
-  uint16_t Rows() const { return ws.ws_row; }
+  uint16_t Rows() const override { return ws.ws_row; }
 
   char buf[64];
-  std::optional<std::string_view> Read() {
-    auto n = read(STDIN_FILENO, buf, sizeof(buf));
+  /* Returns nothing once the input ends, which ends mainloop */
+  std::optional<std::string_view> Read() override {
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) < 0 && errno == EINTR)
+      ;
+    if (n <= 0)
+      return std::nullopt;
     return std::string_view(buf, buf + n);
   }
+
+  /* Returns the number of write() calls needed */
+  int Write(std::string_view str) override {
+    int calls = 0;
+    fflush(stdout);
+    while (!str.empty()) {
+      auto n = write(STDOUT_FILENO, str.data(), str.size());
+      calls++;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      str.remove_prefix(n);
+    }
+    return calls;
+  }
+
+  /* Wakes Wait from another thread */
+  void Wake() override {
+    if (this->wake_[0] < 0)
+      return;
+    /* Nonblocking: if the pipe is full, a wake-up is already pending */
+    while (write(this->wake_[1], "", 1) < 0 && errno == EINTR)
+      ;
+  }
+
+  /*
+   * Waits up to timeout ms (forever if
+   *   negative) for input or a Wake.
+   */
+  int Wait(int timeout) override {
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0},
+                            {this->wake_[0], POLLIN, 0}};
+    int ready = 0;
+    char buf[64];
+
+    if (poll(fds, 2, timeout) < 0)
+      return 0;
+    if (fds[0].revents)
+      ready |= tui_wait_input;
+    if (fds[1].revents) {
+      while (read(this->wake_[0], buf, sizeof(buf)) > 0)
+        ;
+      ready |= tui_wait_wake;
+    }
+    return ready;
+  }
 };
 #endif
 
+ui_t_headless::ui_t_headless(int cols, int rows)
+    : cols_(cols), rows_(rows), screen_(vt100_screen_new(cols, rows, 0)) {}
+
+ui_t_headless::~ui_t_headless() { vt100_screen_free(this->screen_); }
+
+std::optional<std::string_view> ui_t_headless::Read() {
+  std::unique_lock<std::mutex> guard(this->lock_);
+
+  this->ready_.wait(guard,
+                    [&] { return !this->input_.empty() || this->closed_; });
+  if (this->input_.empty())
+    return std::nullopt;
+  this->read_ = std::move(this->input_.front());
+  this->input_.pop_front();
+  return this->read_;
+}
+
+int ui_t_headless::Write(std::string_view str) {
+  vt100_screen_feed(this->screen_, str.data(), str.size());
+  this->bytes_ += str.size();
+  this->writes_++;
+  return 1;
+}
+
+void ui_t_headless::Wake() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->woken_ = true;
+  this->ready_.notify_all();
+}
+
+int ui_t_headless::Wait(int timeout) {
+  std::unique_lock<std::mutex> guard(this->lock_);
+  /* Once the input is closed and read, its end waits for animations */
+  auto ready = [&] {
+    return !this->input_.empty() || this->woken_ ||
+           (this->closed_ && timeout < 0);
+  };
+  int found = 0;
+
+  if (timeout < 0)
+    this->ready_.wait(guard, ready);
+  else
+    this->ready_.wait_for(guard, std::chrono::milliseconds(timeout), ready);
+  if (!this->input_.empty() || (this->closed_ && timeout < 0))
+    found |= tui_wait_input;
+  if (this->woken_) {
+    found |= tui_wait_wake;
+    this->woken_ = false;
+  }
+  return found;
+}
+
+void ui_t_headless::push(std::string_view str) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->input_.emplace_back(str);
+  this->ready_.notify_all();
+}
+
+void ui_t_headless::close() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->closed_ = true;
+  this->ready_.notify_all();
+}
+
+std::string ui_t_headless::text() {
+  char *out = vt100_screen_encode(this->screen_, 0, 0);
+  std::string text(out);
+  VT100_FREE(out);
+  return text;
+}
+
 /*
  * Initializes a new UI struct,
  *   puts the terminal into raw
@@ -189,7 +336,19 @@ public:
  *   necessary escape codes
  *   for mouse support.
  */
-tui::tui(int s) : impl_(new ui_t_impl), screen_(s) {}
+tui::tui(int s) : tui(s, new ui_t_term) {}
+
+/*
+ * Initializes a new UI struct
+ *   drawn to the given terminal,
+ *   which it then owns.
+ */
+tui::tui(int s, ui_t_impl *impl) : impl_(impl), screen_(s) {
+  this->overlay_ = getenv("TUI_STATS") != NULL;
+  this->current_ = this->find_screen(s);
+  if (auto path = getenv("TUI_RECORD"))
+    this->record(path);
+}
 
 /*
  * Frees the given UI struct,
@@ -198,12 +357,8 @@ tui::tui(int s) : impl_(new ui_t_impl), screen_(s) {}
  */
 tui::~tui() {
   delete impl_;
-  auto term = getenv("TERM");
-  if (strncmp(term, "screen", 6) == 0 || strncmp(term, "tmux", 4) == 0) {
-    printf("Note: Terminal multiplexer detected.\n  For best performance (i.e. "
-           "reduced flickering), running natively inside\n  a GPU-accelerated "
-           "terminal such as alacritty or kitty is recommended.\n");
-  }
+  if (this->record_)
+    fclose(this->record_);
 }
 
 uint16_t tui::cols() const { return impl_->Cols(); }
@@ -220,71 +375,808 @@ uint16_t tui::rows() const { return impl_->Rows(); }
  * TODO: Find some way to
  *   strip this down.
  */
-void tui::add(const tui_rect &rect, draw_func draw, loop_func onclick,
-              loop_func onhover) {
+tui_box tui::add(const tui_rect &rect, draw_func draw, loop_func onclick,
+                 loop_func onhover) {
+  tui_store &s = this->store_;
+  uint32_t i;
+
+  if (!s.free.empty()) {
+    i = s.free.back();
+    s.free.pop_back();
+  } else {
+    i = s.size();
+    s.rect.emplace_back();
+    s.screen.push_back(0);
+    s.flags.push_back(0);
+    s.generation.push_back(0);
+    s.cache_at.push_back(0);
+    s.cache_len.push_back(0);
+    s.draw.emplace_back();
+    s.onclick.push_back(0);
+    s.onhover.push_back(0);
+    s.flow.push_back(0);
+    s.flow_index.push_back(0);
+  }
+
+  s.rect[i] = rect;
+  s.screen[i] = this->current_->index_;
+  s.flags[i] = tui_box_live;
+  s.draw[i] = std::move(draw);
+  s.onclick[i] = this->add_listener(std::move(onclick));
+  s.onhover[i] = this->add_listener(std::move(onhover));
+  s.set_cache(i, s.draw[i](s.handle(i)));
+  this->current_->boxes_.push_back(i);
+  this->current_->index_stale_ = true;
+  this->current_->changed_ = true;
+  return s.handle(i);
+}
+
+/*
+ * Replaces a box's cache, in place
+ *   if it fits.
+ */
+void tui_store::set_cache(uint32_t i, std::string_view str) {
+  this->garbage += this->cache_len[i];
+  if (str.size() <= this->cache_len[i]) {
+    this->text.replace(this->cache_at[i], str.size(), str);
+    this->garbage -= str.size();
+  } else {
+    this->cache_at[i] = this->text.size();
+    this->text += str;
+  }
+  this->cache_len[i] = str.size();
 
-  auto box = tui_box::create(rect, screen_, draw, onclick, onhover);
-  this->boxes_.push_back(box);
+  if (this->garbage < 4096 || this->garbage < this->text.size() / 2)
+    return;
+  std::string compact;
+  compact.reserve(this->text.size() - this->garbage);
+  for (uint32_t j = 0; j < this->size(); j++) {
+    std::string_view cache = this->cache(j);
+    this->cache_at[j] = compact.size();
+    compact += cache;
+  }
+  this->text.swap(compact);
+  this->garbage = 0;
+}
+
+/*
+ * Removes a box, whose slot may
+ *   then be reused.
+ */
+void tui::remove(tui_box b) {
+  tui_store &s = this->store_;
+  uint32_t i = b.index;
+
+  if (!s.valid(b))
+    return;
+
+  tui_screen *screen = this->screens_[s.screen[i]].get();
+  screen->boxes_.erase(
+      std::find(screen->boxes_.begin(), screen->boxes_.end(), i));
+  screen->index_stale_ = true;
+  screen->changed_ = true;
+
+  if (uint32_t f = s.flow[i]) {
+    tui_flow *flow = this->flows_[f - 1].get();
+    size_t at = s.flow_index[i];
+    flow->boxes_.erase(flow->boxes_.begin() + at);
+    flow->line_h_.erase(flow->line_h_.begin() + at);
+    for (size_t j = at; j < flow->boxes_.size(); j++)
+      s.flow_index[flow->boxes_[j]] = j;
+    flow->stale_ = std::min(flow->stale_, at);
+  }
+
+  for (uint32_t *listener : {&s.onclick[i], &s.onhover[i]}) {
+    if (*listener) {
+      s.listeners[*listener - 1] = nullptr;
+      s.free_listeners.push_back(*listener - 1);
+    }
+    *listener = 0;
+  }
+  s.set_cache(i, {});
+  s.draw[i] = nullptr;
+  if (s.flags[i] & tui_box_dirty)
+    screen->dirty_boxes_--;
+  s.flags[i] = 0;
+  s.flow[i] = 0;
+  s.generation[i]++;
+  s.free.push_back(i);
+}
+
+/* Stores a listener if set, returning its index plus one (or 0) */
+uint32_t tui::add_listener(loop_func f) {
+  tui_store &s = this->store_;
+  uint32_t i;
+
+  if (!f)
+    return 0;
+  if (!s.free_listeners.empty()) {
+    i = s.free_listeners.back();
+    s.free_listeners.pop_back();
+    s.listeners[i] = std::move(f);
+  } else {
+    i = s.listeners.size();
+    s.listeners.push_back(std::move(f));
+  }
+  return i + 1;
+}
+
+void tui::call_listener(uint32_t listener, uint32_t i, int x, int y) {
+  if (!listener)
+    return;
+  loop_func f = this->store_.listeners[listener - 1];
+  f(this->store_.handle(i), x, y, this->mouse_);
 }
 
 void tui::add_text(int x, int y, std::string_view str, loop_func click,
                    loop_func hover) {
   std::string buf(str);
-  draw_func callback = [buf](tui_box *b) { return buf; };
+  draw_func callback = [buf](tui_box) { return buf; };
   this->add({x, y, (int)str.size(), 1}, callback, click, hover);
 }
 
-int tui::cursor_y(tui_box *b, int n) {
-  return (b->rect_.y + (n + 1) + (canscroll_ ? scroll_ : 0));
+int tui::cursor_y(tui_box b, int n) { return this->cursor_y(b.index, n); }
+
+int tui::cursor_y(uint32_t i, int n) {
+  return (store_.rect[i].y + (n + 1) + (canscroll_ ? scroll_ : 0));
+}
+
+/*
+ * Adds a list of count rows, which
+ *   row formats (on demand, into a
+ *   reused buffer) by index.
+ */
+tui_list *tui::add_list(const tui_rect &rect, size_t count, row_func row,
+                        row_click_func onclick) {
+  auto l = std::make_unique<tui_list>();
+  l->rect_ = rect;
+  l->screen_ = this->screen_;
+  l->count_ = count;
+  l->row = row;
+  l->onclick = onclick;
+  l->rows_.resize(rect.h);
+  l->index_.assign(rect.h, SIZE_MAX);
+  this->current_->lists_.push_back(l.get());
+  this->current_->changed_ = true;
+  this->lists_.push_back(std::move(l));
+  return this->lists_.back().get();
+}
+
+/* Columns taken by str, skipping escape sequences */
+static int tui_width(std::string_view str) {
+  return vt100_width(str.data(), str.size());
+}
+
+/*
+ * Measures a box's content as draw_one
+ *   paints it: one row per non-empty
+ *   line, as wide as the widest.
+ */
+static void tui_measure(std::string_view str, int *w, int *h) {
+  size_t start = 0, end;
+
+  *w = *h = 0;
+  while (start < str.size()) {
+    end = str.find('\n', start);
+    if (end == std::string_view::npos)
+      end = str.size();
+    if (end > start) {
+      *w = std::max(*w, tui_width(str.substr(start, end - start)));
+      (*h)++;
+    }
+    start = end + 1;
+  }
+}
+
+/*
+ * Adds a flow, which lays out the
+ *   boxes added to it.
+ */
+tui_flow *tui::add_flow(const tui_rect &rect, int gap_x, int gap_y) {
+  auto f = std::make_unique<tui_flow>();
+  f->rect_ = rect;
+  f->screen_ = this->screen_;
+  f->gap_x_ = gap_x;
+  f->gap_y_ = gap_y;
+  this->current_->flows_.push_back(f.get());
+  this->flows_.push_back(std::move(f));
+  return this->flows_.back().get();
+}
+
+/*
+ * Adds a box to the end of a flow.
+ */
+tui_box tui::add(tui_flow *f, draw_func draw, loop_func onclick,
+                 loop_func onhover) {
+  tui_box b = this->add({f->rect_.x, f->rect_.y, 0, 0}, std::move(draw),
+                        std::move(onclick), std::move(onhover));
+  tui_store &s = this->store_;
+  uint32_t i = b.index;
+
+  for (size_t j = 0; j < this->flows_.size(); j++) {
+    if (this->flows_[j].get() == f)
+      s.flow[i] = j + 1;
+  }
+  s.flow_index[i] = f->boxes_.size();
+  tui_measure(s.cache(i), &s.rect[i].w, &s.rect[i].h);
+  f->boxes_.push_back(i);
+  f->line_h_.push_back(0);
+  f->stale_ = std::min(f->stale_, (size_t)s.flow_index[i]);
+  return b;
+}
+
+/*
+ * Calls a box's draw function,
+ *   returning whether that
+ *   changed its size in a flow.
+ */
+bool tui::build(uint32_t i) {
+  tui_store &s = this->store_;
+  tui_rect &r = s.rect[i];
+  int w, h;
+
+  s.set_cache(i, s.draw[i](s.handle(i)));
+  if (s.flags[i] & tui_box_dirty) {
+    s.flags[i] &= ~tui_box_dirty;
+    this->screens_[s.screen[i]]->dirty_boxes_--;
+  }
+  this->frame_rebuilt_++;
+  if (!s.flow[i])
+    return false;
+
+  tui_measure(s.cache(i), &w, &h);
+  if (w == r.w && h == r.h)
+    return false;
+  r.w = w;
+  r.h = h;
+  tui_flow *f = this->flows_[s.flow[i] - 1].get();
+  f->stale_ = std::min(f->stale_, (size_t)s.flow_index[i]);
+  return true;
+}
+
+/*
+ * Redraws the flow's invalidated
+ *   boxes, and moves the boxes
+ *   from the first one that
+ *   changed size onward.
+ */
+void tui::layout(tui_flow *f) {
+  const tui_rect &r = f->rect_;
+  tui_store &s = this->store_;
+  size_t i = f->stale_, n = f->boxes_.size();
+  int x = r.x, y = r.y, line_h = 0;
+  uint32_t b;
+
+  if (i >= n)
+    return;
+  /* Everything before the first change stays put, so pick up after it */
+  if (i > 0) {
+    b = f->boxes_[i - 1];
+    x = s.rect[b].x + s.rect[b].w + f->gap_x_;
+    y = s.rect[b].y;
+    line_h = f->line_h_[i - 1];
+  }
+
+  for (; i < n; i++) {
+    b = f->boxes_[i];
+    if (s.flags[b] & tui_box_dirty)
+      this->build(b);
+    tui_rect &box = s.rect[b];
+    if (x > r.x && x + box.w > r.x + r.w) {
+      x = r.x;
+      y += line_h + f->gap_y_;
+      line_h = 0;
+    }
+    box.x = x;
+    box.y = y;
+    line_h = std::max(line_h, box.h);
+    f->line_h_[i] = line_h;
+    x += box.w + f->gap_x_;
+  }
+  f->stale_ = n;
+  this->find_screen(f->screen_)->index_stale_ = true;
+}
+
+/*
+ * Whether a list covers whole lines of
+ *   the screen, so that it can be
+ *   scrolled with a scroll region.
+ */
+static bool tui_spans(const tui_list *l, int cols, int rows) {
+  return l->rect_.x <= 1 && l->rect_.x + l->rect_.w > cols &&
+         l->rect_.y > 0 && l->rect_.y + l->rect_.h <= rows;
+}
+
+/*
+ * Draws the visible rows of a list
+ *   from first to last (relative
+ *   to its top).
+ */
+void tui::draw_rows(tui_list *l, int first, int last) {
+  bool full = tui_spans(l, this->cols(), this->rows());
+  int h = l->rect_.h, y, width;
+  size_t index, slot;
+  char pos[32];
+
+  for (int i = first; i <= last; i++) {
+    index = l->top_ + i;
+    y = l->rect_.y + i;
+    if (!impl_->Contains(l->rect_.x, y))
+      continue;
+
+    snprintf(pos, sizeof(pos), "\x1b[%i;%iH\x1b[0m", y, l->rect_.x);
+    this->out_ += pos;
+    width = 0;
+    if (index < l->count_) {
+      slot = index % h;
+      if (l->index_[slot] != index || this->force_) {
+        l->rows_[slot].clear();
+        l->row(index, l->rows_[slot]);
+        l->index_[slot] = index;
+        this->frame_rebuilt_++;
+      }
+      this->out_ += l->rows_[slot];
+      this->out_ += "\x1b[0m";
+      width = tui_width(l->rows_[slot]);
+    }
+
+    /* Clear what was there before */
+    if (full)
+      this->out_ += "\x1b[K";
+    else if (width < l->rect_.w)
+      this->out_.append(l->rect_.w - width, ' ');
+  }
+  this->frame_boxes_++;
+}
+
+/*
+ * Returns the list under the given
+ *   point, if any.
+ */
+tui_list *tui::list_at(int x, int y) {
+  for (auto l : this->current_->lists_) {
+    if (x >= l->rect_.x && x < l->rect_.x + l->rect_.w && y >= l->rect_.y &&
+        y < l->rect_.y + l->rect_.h)
+      return l;
+  }
+  return nullptr;
+}
+
+/*
+ * Returns the screen with the
+ *   given id, creating it if
+ *   needed.
+ */
+tui_screen *tui::find_screen(int s) {
+  for (auto &screen : this->screens_) {
+    if (screen->id_ == s)
+      return screen.get();
+  }
+  auto screen = std::make_unique<tui_screen>();
+  screen->id_ = s;
+  screen->index_ = this->screens_.size();
+  this->screens_.push_back(std::move(screen));
+  return this->screens_.back().get();
+}
+
+/*
+ * Returns the current screen's
+ *   boxes covering row y.
+ */
+const std::vector<uint32_t> &tui::boxes_at(int y) {
+  static const std::vector<uint32_t> none;
+  tui_screen *screen = this->current_;
+  auto &rows = screen->rows_;
+
+  if (screen->index_stale_) {
+    int top = INT32_MAX, bottom = INT32_MIN;
+    for (uint32_t i : screen->boxes_) {
+      top = std::min(top, this->store_.rect[i].y);
+      bottom = std::max(bottom, this->store_.rect[i].y + this->store_.rect[i].h);
+    }
+    for (auto &row : rows)
+      row.clear();
+    rows.resize(top <= bottom ? bottom - top + 1 : 0);
+    screen->rows_top_ = top;
+    /* As tui_rect::contains, a box covers rows y to y + h */
+    for (uint32_t i : screen->boxes_) {
+      const tui_rect &r = this->store_.rect[i];
+      for (int row = r.y; row <= r.y + r.h; row++)
+        rows[row - top].push_back(i);
+    }
+    screen->index_stale_ = false;
+  }
+
+  if (y < screen->rows_top_ || y - screen->rows_top_ >= (int)rows.size())
+    return none;
+  return rows[y - screen->rows_top_];
+}
+
+/*
+ * Returns the current screen's
+ *   boxes under the given point.
+ */
+std::vector<tui_box> tui::hits_at(int x, int y) {
+  const tui_store &s = this->store_;
+  uint32_t screen = this->current_->index_;
+  std::vector<tui_box> hits;
+
+  for (uint32_t i : this->boxes_at(y)) {
+    if (s.live(i) && s.screen[i] == screen && s.rect[i].contains(x, y))
+      hits.push_back(s.handle(i));
+  }
+  return hits;
+}
+
+/*
+ * Switches to screen s, creating
+ *   it if new.
+ */
+void tui::set_screen(int s) {
+  tui_screen *next = this->find_screen(s);
+
+  if (next == this->current_)
+    return;
+  this->current_->scroll_ = this->scroll_;
+  this->current_ = next;
+  this->screen_ = s;
+  this->scroll_ = next->scroll_;
+
+  if (!next->front_valid_ || next->changed_ || next->dirty_boxes_) {
+    this->draw();
+    return;
+  }
+  /* Nothing on it changed, so write out what it showed before */
+  VT100_SCOPE(frame);
+  this->begin_frame();
+  this->out_ = next->front_;
+  this->frame_kind_ = frame_replay;
+  this->flush();
+}
+
+/*
+ * Scrolls a list by n rows (up if
+ *   negative).
+ */
+void tui::scroll_list(tui_list *l, long n) {
+  int h = l->rect_.h;
+  long max = l->count_ > (size_t)h ? l->count_ - h : 0;
+  long top = std::clamp((long)l->top_ + n, 0L, max);
+  char buf[64];
+
+  n = top - (long)l->top_;
+  l->top_ = top;
+  if (n == 0)
+    return;
+
+  /* A list on another screen is drawn when switching to it */
+  if (l->screen() != this->screen_) {
+    this->find_screen(l->screen())->changed_ = true;
+    return;
+  }
+
+  VT100_SCOPE(frame);
+  this->begin_frame();
+  if (labs(n) < h && tui_spans(l, this->cols(), this->rows())) {
+    /* Have the terminal move the rows still visible, and paint the rest */
+    snprintf(buf, sizeof(buf), "\x1b[%i;%ir\x1b[%li%c\x1b[r", l->rect_.y,
+             l->rect_.y + h - 1, labs(n), n > 0 ? 'S' : 'T');
+    this->out_ += buf;
+    if (n > 0)
+      this->draw_rows(l, h - n, h - 1);
+    else
+      this->draw_rows(l, 0, -n - 1);
+  } else {
+    this->draw_rows(l, 0, h - 1);
+  }
+  this->flush();
+}
+
+/*
+ * Sets the number of rows in a
+ *   list, and repaints its rows.
+ */
+void tui::update_list(tui_list *l, size_t count) {
+  int h = l->rect_.h;
+
+  l->count_ = count;
+  if (l->top_ + h > count)
+    l->top_ = count > (size_t)h ? count - h : 0;
+  std::fill(l->index_.begin(), l->index_.end(), SIZE_MAX);
+  if (l->screen() != this->screen_) {
+    this->find_screen(l->screen())->changed_ = true;
+    return;
+  }
+
+  this->begin_frame();
+  this->draw_rows(l, 0, h - 1);
+  this->flush();
 }
 
 /*
  * Draws a single box to the
  *   screen.
  */
-void tui::draw_one(tui_box *tmp, int flush) {
+void tui::draw_one(tui_box b, int flush) {
+  if (this->store_.valid(b))
+    this->draw_slot(b.index, flush);
+}
+
+/*
+ * Draws the box in slot i.
+ */
+void tui::draw_slot(uint32_t i, int flush) {
+  tui_store &s = this->store_;
 
-  if (tmp->screen() != this->screen_) {
+  if (s.screen[i] != this->current_->index_) {
     return;
   }
+  if (flush)
+    this->begin_frame();
 
-  std::string buf;
-  if (this->force_) {
-    buf = tmp->draw(tmp);
-    // if (tmp->watch != NULL)
-    //   tmp->last = *(tmp->watch);
-    tmp->cache = buf;
-  } else {
-    // buf is allocated proportionally to tmp->cache, so strcpy is safe
-    buf = tmp->cache;
+  /* A box that changed size moves the boxes after it, so draw them all */
+  if ((this->force_ || (s.flags[i] & tui_box_dirty)) && this->build(i) &&
+      flush) {
+    this->draw();
+    return;
   }
+  /* Copied, since strtok writes into its buffer */
+  std::string buf(s.cache(i));
+  this->frame_boxes_++;
 
   auto tok = strtok((char *)buf.data(), "\n");
-  int n = -1;
+  int n = -1, y;
+  char pos[32];
   while (tok) {
-    if (impl_->Contains(tmp->rect_.x, cursor_y(tmp, n))) {
-      printf("\x1b[%i;%iH%s", cursor_y(tmp, n), tmp->rect_.x, tok);
-      n++;
+    /* Lines off the screen (or outside the rows being painted) still take
+     *   up their row */
+    y = cursor_y(i, n);
+    if (impl_->Contains(s.rect[i].x, y) && y >= this->clip_top_ &&
+        y <= this->clip_bottom_) {
+      snprintf(pos, sizeof(pos), "\x1b[%i;%iH", y, s.rect[i].x);
+      this->out_ += pos;
+      this->out_ += tok;
     }
+    n++;
     tok = strtok(NULL, "\n");
   }
 
   if (flush)
-    fflush(stdout);
+    this->flush();
 }
 
 /*
  * Draws all boxes to the screen.
  */
 void tui::draw() {
-  printf("\x1b[0m\x1b[2J");
-  for (auto &tmp : this->boxes_) {
-    this->draw_one(tmp.get(), 0);
+  int force = this->force_;
+
+  VT100_SCOPE(frame);
+  this->begin_frame();
+
+  /* Sizes decide where flowed boxes go, so redraw those first (forcing
+   *   remeasures every one) */
+  for (auto f : this->current_->flows_) {
+    if (force) {
+      for (auto b : f->boxes_)
+        this->invalidate(this->store_.handle(b));
+      f->stale_ = 0;
+    }
+    this->layout(f);
   }
-  fflush(stdout);
+
+  this->out_ += "\x1b[0m\x1b[2J";
+  for (uint32_t i : this->current_->boxes_) {
+    this->force_ = force && !this->store_.flow[i];
+    this->draw_slot(i, 0);
+  }
+  this->force_ = force;
+  for (auto l : this->current_->lists_)
+    this->draw_rows(l, 0, l->rect_.h - 1);
+  this->frame_kind_ = frame_full;
+  this->current_->changed_ = false;
+  this->flush();
   this->force_ = 0;
 }
 
+/*
+ * Scrolls everything but lists by
+ *   n rows (down if positive).
+ */
+void tui::scroll(int n) {
+  int bottom = this->rows() - 1;
+  char buf[64];
+
+  if (!this->canscroll_ || n == 0)
+    return;
+  this->scroll_ += n;
+
+  /* Lists stay put, so the screen can't be moved as a whole */
+  if (!this->current_->lists_.empty() || abs(n) >= bottom) {
+    this->draw();
+    return;
+  }
+
+  /* Have the terminal move what is already drawn, and paint the rows
+   *   scrolled into view */
+  VT100_SCOPE(frame);
+  this->begin_frame();
+  snprintf(buf, sizeof(buf), "\x1b[0m\x1b[1;%ir\x1b[%i%c\x1b[r", bottom,
+           abs(n), n > 0 ? 'T' : 'S');
+  this->out_ += buf;
+  this->clip_top_ = n > 0 ? 1 : bottom + n + 1;
+  this->clip_bottom_ = n > 0 ? n : bottom;
+  for (uint32_t i : this->current_->boxes_)
+    this->draw_slot(i, 0);
+  this->clip_top_ = 1;
+  this->clip_bottom_ = INT32_MAX;
+  this->flush();
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start,
+                         std::chrono::steady_clock::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/*
+ * Draws only the boxes invalidated
+ *   since the last frame.
+ */
+void tui::refresh() {
+  tui_screen *screen = this->current_;
+  tui_store &s = this->store_;
+  std::vector<std::string_view> lines;
+  int ow, oh, nw, nh, w, h, y;
+  char pos[32];
+
+  if (!screen->dirty_boxes_)
+    return;
+  if (screen->changed_ || !screen->front_valid_) {
+    this->draw();
+    return;
+  }
+
+  VT100_SCOPE(frame);
+  this->begin_frame();
+  for (uint32_t i : screen->boxes_) {
+    if (!(s.flags[i] & tui_box_dirty))
+      continue;
+
+    /* What it covered before, and covers now */
+    tui_measure(s.cache(i), &ow, &oh);
+    if (this->build(i)) {
+      this->out_.clear();
+      this->draw();
+      return;
+    }
+    tui_measure(s.cache(i), &nw, &nh);
+    w = std::max(ow, nw);
+    h = std::max(oh, nh);
+
+    /* Clearing could erase another box, so draw everything again */
+    const tui_rect &r = s.rect[i];
+    for (y = r.y; y < r.y + h; y++) {
+      for (uint32_t j : this->boxes_at(y)) {
+        const tui_rect &o = s.rect[j];
+        if (j != i && o.x <= r.x + w - 1 && r.x <= o.x + o.w) {
+          this->out_.clear();
+          this->draw();
+          return;
+        }
+      }
+    }
+    for (auto l : screen->lists_) {
+      const tui_rect &o = l->rect_;
+      if (o.x < r.x + w && r.x < o.x + o.w && o.y < r.y + h &&
+          r.y < o.y + o.h) {
+        this->out_.clear();
+        this->draw();
+        return;
+      }
+    }
+
+    /* As draw_one, line by line, then blank what the old lines covered */
+    lines.clear();
+    std::string_view cache = s.cache(i);
+    for (size_t start = 0, end; start < cache.size(); start = end + 1) {
+      end = std::min(cache.find('\n', start), cache.size());
+      if (end > start)
+        lines.push_back(cache.substr(start, end - start));
+    }
+    for (size_t n = 0; n < lines.size(); n++) {
+      y = this->cursor_y(i, n - 1);
+      if (!impl_->Contains(r.x, y))
+        continue;
+      snprintf(pos, sizeof(pos), "\x1b[%i;%iH", y, r.x);
+      this->out_ += pos;
+      this->out_ += lines[n];
+    }
+
+    /* Padded afterwards, so graphics still carry from line to line */
+    for (int n = 0; n < oh; n++) {
+      int lw = n < (int)lines.size() ? tui_width(lines[n]) : 0;
+      y = this->cursor_y(i, n - 1);
+      if (lw >= ow || !impl_->Contains(r.x + lw, y))
+        continue;
+      snprintf(pos, sizeof(pos), "\x1b[%i;%iH\x1b[0m", y, r.x + lw);
+      this->out_ += pos;
+      this->out_.append(ow - lw, ' ');
+    }
+    this->frame_boxes_++;
+  }
+  this->flush();
+}
+
+/*
+ * Animates over ms milliseconds,
+ *   returning an id for cancel.
+ */
+uint32_t tui::animate(int ms, tween_func f, tui_ease ease) {
+  uint32_t id = this->next_animation_++;
+  this->animations_.push_back(
+      {id, this->now(), std::max(ms, 1), ease, f});
+  return id;
+}
+
+/*
+ * Stops an animation where it is.
+ */
+void tui::cancel(uint32_t id) {
+  for (auto &a : this->animations_) {
+    if (a.id == id)
+      a.ms = -1;
+  }
+}
+
+static double tui_eased(tui_ease ease, double t) {
+  switch (ease) {
+  case tui_linear:
+    return t;
+  case tui_ease_in:
+    return t * t * t;
+  case tui_ease_out:
+    return 1 - (1 - t) * (1 - t) * (1 - t);
+  case tui_ease_in_out:
+    return t < 0.5 ? 4 * t * t * t : 1 - 4 * (1 - t) * (1 - t) * (1 - t);
+  }
+  return t;
+}
+
+/*
+ * Steps every animation, if a
+ *   frame is due.
+ */
+int tui::tick() {
+  auto now = this->now();
+  auto frame = std::chrono::milliseconds(this->frame_ms_);
+
+  if (this->animations_.empty())
+    return -1;
+  if (now < this->next_frame_)
+    return std::chrono::ceil<std::chrono::milliseconds>(this->next_frame_ - now)
+        .count();
+  /* On time or late, the next frame is a whole frame away */
+  this->next_frame_ = now + frame;
+
+  /* By index, since f may start or cancel animations */
+  for (size_t k = 0; k < this->animations_.size(); k++) {
+    tui_animation &a = this->animations_[k];
+    if (a.ms < 0)
+      continue;
+    double t = std::min(1.0, elapsed_ms(a.start, now) / a.ms);
+    tween_func f = a.f;
+    double eased = tui_eased(a.ease, t);
+    if (t >= 1)
+      a.ms = -1;
+    f(eased);
+  }
+  std::erase_if(this->animations_,
+                [](const tui_animation &a) { return a.ms < 0; });
+
+  this->refresh();
+  return this->animations_.empty() ? -1 : this->frame_ms_;
+}
+
 /*
  * Forces a redraw of the screen,
  *   updating all boxes' caches.
@@ -305,6 +1197,167 @@ void tui::on_key(const char *c, func f) {
   });
 }
 
+/*
+ * Sets the listener called with
+ *   the URL when clicking on
+ *   hyperlinked (OSC 8) text.
+ */
+void tui::on_link(link_func f) { this->onlink_ = f; }
+
+/*
+ * Sets a listener called after
+ *   every frame with its
+ *   statistics.
+ */
+void tui::on_frame(frame_func f) { this->onframe_ = f; }
+
+/*
+ * Shows or hides frame statistics
+ *   in the top right corner.
+ */
+void tui::show_stats(bool show) { this->overlay_ = show; }
+
+static void tui_wake(void *impl) { ((ui_t_impl *)impl)->Wake(); }
+
+/*
+ * Has mainloop take batches pushed
+ *   to the ring by another thread.
+ */
+void tui::feed(struct vt100_ring_t *ring, batch_func f) {
+  this->ring_ = ring;
+  this->onbatch_ = f;
+  if (ring) {
+    ring->wake_data = this->impl_;
+    ring->wake = tui_wake;
+  }
+}
+
+/*
+ * Wakes mainloop, which then calls
+ *   the listener set with on_wake.
+ */
+void tui::wake() { this->impl_->Wake(); }
+
+/*
+ * Sets the listener called after
+ *   wake is called.
+ */
+void tui::on_wake(std::function<void()> f) { this->onwake_ = f; }
+
+/*
+ * Takes the batches waiting in
+ *   the ring, and paints what
+ *   they changed.
+ */
+void tui::drain() {
+  struct vt100_batch_t batch;
+
+  /* At most a ringful, since the producer refills it as we go */
+  for (uint32_t i = 0; i <= this->ring_->mask; i++) {
+    if (!vt100_ring_pop(this->ring_, &batch))
+      break;
+    this->onbatch_(batch);
+    this->frame_batches_++;
+  }
+  if (!this->frame_batches_)
+    return;
+  /* Usually the batches only invalidated boxes, so only those are painted */
+  if (this->current_->changed_)
+    this->draw();
+  else
+    this->refresh();
+}
+
+/*
+ * Keeps what was just written as part
+ *   of what the current screen shows.
+ */
+void tui::retain() {
+  tui_screen *screen = this->current_;
+
+  switch (this->frame_kind_) {
+  case frame_full:
+    screen->front_ = this->out_;
+    screen->front_valid_ = true;
+    this->front_limit_ = std::max<size_t>(65536, 4 * this->out_.size());
+    break;
+  case frame_partial:
+    /* Replaying a long history costs more than drawing again */
+    if (screen->front_valid_ &&
+        screen->front_.size() + this->out_.size() <= this->front_limit_) {
+      screen->front_ += this->out_;
+    } else {
+      std::string().swap(screen->front_);
+      screen->front_valid_ = false;
+    }
+    break;
+  case frame_replay:
+    break;
+  }
+  this->frame_kind_ = frame_partial;
+}
+
+void tui::begin_frame() {
+  this->frame_start_ = std::chrono::steady_clock::now();
+  this->frame_boxes_ = 0;
+  this->frame_rebuilt_ = 0;
+}
+
+/*
+ * Writes out the buffered frame
+ *   and records its statistics.
+ */
+void tui::flush() {
+  auto built = std::chrono::steady_clock::now();
+  char buf[160];
+
+  /* Before the overlay, which is out of date by the time it is replayed */
+  this->retain();
+  if (this->overlay_) {
+    /* The previous frame's numbers, since this one isn't written yet */
+    int len = snprintf(buf, sizeof(buf),
+                       " #%llu build %.2fms write %.2fms %zuB/%i writes "
+                       "%i/%i boxes input %.1fms ",
+                       (unsigned long long)this->stats_.frame,
+                       this->stats_.build_ms, this->stats_.write_ms,
+                       this->stats_.bytes, this->stats_.syscalls,
+                       this->stats_.rebuilt, this->stats_.boxes,
+                       this->stats_.latency_ms);
+    std::string overlay(buf, std::min(len, (int)sizeof(buf) - 1));
+    snprintf(buf, sizeof(buf), "\x1b[1;%iH\x1b[0;7m",
+             std::max(1, this->cols() - (int)overlay.size() + 1));
+    this->out_ += buf + overlay + "\x1b[0m";
+  }
+
+  if (this->replay_screen_) {
+    vt100_screen_feed(this->replay_screen_, this->out_.data(),
+                      this->out_.size());
+    this->stats_.syscalls = 0;
+  } else {
+    this->stats_.syscalls = impl_->Write(this->out_);
+  }
+  if (this->record_)
+    this->record_event('o', this->out_);
+  auto done = std::chrono::steady_clock::now();
+
+  this->stats_.frame++;
+  this->stats_.bytes = this->out_.size();
+  this->stats_.build_ms = elapsed_ms(this->frame_start_, built);
+  this->stats_.write_ms = elapsed_ms(built, done);
+  this->stats_.boxes = this->frame_boxes_;
+  this->stats_.rebuilt = this->frame_rebuilt_;
+  this->stats_.batches = this->frame_batches_;
+  this->frame_batches_ = 0;
+  this->stats_.latency_ms =
+      this->input_pending_ ? elapsed_ms(this->input_at_, done) : 0;
+  this->input_pending_ = false;
+  VT100_COUNT(frame_bytes, this->out_.size());
+  this->out_.clear();
+
+  if (this->onframe_)
+    this->onframe_(this->stats_);
+}
+
 /*
  * Handles mouse and keyboard
  *   events, given a read()
@@ -328,12 +1381,28 @@ void tui::update(std::string_view c) {
         tok.next();
         int x = atoi(tok.current().data());
         tok.next();
-        int y = strtol(tok.current().data(), NULL, 10) -
-                (this->canscroll_ ? this->scroll_ : 0);
-        for (auto &tmp : this->boxes_) {
-          if (tmp->screen() == this->screen_ && tmp->rect_.contains(x, y)) {
-            if (tmp->onclick) {
-              tmp->onclick(tmp.get(), x, y, this->mouse_);
+        int row = strtol(tok.current().data(), NULL, 10);
+        int y = row - (this->canscroll_ ? this->scroll_ : 0);
+        if (auto l = this->list_at(x, row)) {
+          size_t index = l->top_ + (row - l->rect_.y);
+          if (l->onclick && index < l->count_)
+            l->onclick(l, index);
+        }
+        tui_store &s = this->store_;
+        /* Found before calling any, since listeners may add, remove or
+         *   move boxes (e.g. moving the next box in a flow under x) */
+        /* Listeners may also remove boxes, so a slot may hold another */
+        std::vector<tui_box> hits = this->hits_at(x, y);
+        for (tui_box b : hits) {
+          uint32_t i = b.index;
+          if (s.valid(b)) {
+            this->call_listener(s.onclick[i], i, x, y);
+            const char *url;
+            size_t len;
+            if (this->onlink_ && s.valid(b) &&
+                vt100_link_at(s.cache(i).data(), s.cache(i).size(),
+                              y - s.rect[i].y, x - s.rect[i].x, &url, &len)) {
+              this->onlink_(b, std::string(url, len));
             }
           }
         }
@@ -347,22 +1416,26 @@ void tui::update(std::string_view c) {
       tok.next();
       int y = strtol(tok.current().data(), NULL, 10) -
               (this->canscroll_ ? this->scroll_ : 0);
-      for (auto &tmp : this->boxes_) {
-        if (tmp->screen() == this->screen_ && tmp->rect_.contains(x, y)) {
-          if (tmp->onhover) {
-            tmp->onhover(tmp.get(), x, y, this->mouse_);
-          }
-        }
+      tui_store &s = this->store_;
+      std::vector<tui_box> hits = this->hits_at(x, y);
+      for (tui_box b : hits) {
+        if (s.valid(b))
+          this->call_listener(s.onhover[b.index], b.index, x, y);
       }
     } break;
 
-    case '6':
-      if (this->canscroll_) {
-        this->scroll_ += (4 * (tok.current()[1] == '4')) - 2;
-        printf("\x1b[0m\x1b[2J");
-        this->draw();
+    case '6': {
+      bool up = tok.current()[1] == '4';
+      tok.next();
+      int x = atoi(tok.current().data());
+      tok.next();
+      int row = atoi(tok.current().data());
+      if (auto l = this->list_at(x, row)) {
+        this->scroll_list(l, up ? -3 : 3);
+        break;
       }
-      break;
+      this->scroll(up ? 2 : -2);
+    } break;
     }
   }
 
@@ -373,8 +1446,102 @@ void tui::update(std::string_view c) {
   }
 }
 
+std::chrono::steady_clock::time_point tui::now() const {
+  return this->replaying_ ? this->replay_now_
+                          : std::chrono::steady_clock::now();
+}
+
+/*
+ * Records the session to path as
+ *   an asciicast.
+ */
+bool tui::record(const char *path) {
+  FILE *f = fopen(path, "wb");
+
+  if (!f)
+    return false;
+  if (this->record_)
+    fclose(this->record_);
+  this->record_ = f;
+  this->record_start_ = std::chrono::steady_clock::now();
+  vt100_cast_header(f, this->cols(), this->rows());
+  return true;
+}
+
+void tui::record_event(char type, std::string_view str) {
+  double t =
+      elapsed_ms(this->record_start_, std::chrono::steady_clock::now()) / 1000;
+  vt100_cast_event(this->record_, t, type, str.data(), str.size());
+}
+
+void tui::replay_until(std::chrono::steady_clock::time_point t) {
+  while (!this->animations_.empty() && this->next_frame_ <= t) {
+    this->replay_now_ = std::max(this->replay_now_, this->next_frame_);
+    this->tick();
+  }
+  this->replay_now_ = std::max(this->replay_now_, t);
+}
+
+/*
+ * Replays a recorded session's
+ *   input as fast as possible.
+ */
+uint64_t tui::replay(const struct vt100_cast_t &cast,
+                     struct vt100_screen_t *screen) {
+  auto start = std::chrono::steady_clock::now();
+  uint64_t frames = this->stats_.frame;
+
+  this->replaying_ = true;
+  this->replay_now_ = start;
+  this->replay_screen_ = screen;
+  for (auto &event : cast.events) {
+    if (event.type != 'i')
+      continue;
+    this->replay_until(
+        start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(event.time)));
+    this->update(event.data);
+  }
+
+  /* Let animations the last input started finish */
+  while (!this->animations_.empty())
+    this->replay_until(this->next_frame_);
+
+  this->replaying_ = false;
+  this->replay_screen_ = nullptr;
+  this->next_frame_ = {}; /* Which was on the recording's clock */
+  return this->stats_.frame - frames;
+}
+
 void tui::mainloop() {
-  while (auto buf = impl_->Read()) {
-    this->update(*buf);
+  int ready, timeout;
+
+  for (;;) {
+    /* Until the next animation frame, if any */
+    timeout = this->tick();
+    ready = tui_wait_input;
+    /* Sleep only once the ring is empty, and the producer knows to wake us */
+    if (this->ring_)
+      ready = impl_->Wait(vt100_ring_idle(this->ring_) ? timeout : 0);
+    else if (this->onwake_ || timeout >= 0)
+      ready = impl_->Wait(timeout);
+
+    if (ready & tui_wait_input) {
+      auto buf = impl_->Read();
+      if (!buf)
+        break;
+      if (this->record_)
+        this->record_event('i', *buf);
+      if (!this->input_pending_) {
+        this->input_at_ = std::chrono::steady_clock::now();
+        this->input_pending_ = true;
+      }
+      this->update(*buf);
+    }
+
+    if (ready & tui_wait_wake && this->onwake_)
+      this->onwake_();
+    if (this->ring_)
+      this->drain();
   }
 }
@@ -3,8 +3,15 @@
  */
 #pragma once
 #include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -12,9 +19,50 @@
 /*
  * TYPES
  */
+
+struct vt100_batch_t;
+struct vt100_ring_t;
+struct vt100_cast_t;
+struct vt100_screen_t;
+
+/* Statistics about one frame, see tui::frame_stats */
+struct tui_frame_stats {
+  uint64_t frame;    /* Frames drawn so far, including this one */
+  double build_ms;   /* Formatting boxes into the frame */
+  double write_ms;   /* Writing the frame to the terminal */
+  double latency_ms; /* From reading input to painting, or 0 if no input */
+  size_t bytes;      /* Bytes written */
+  int syscalls;      /* write() calls needed */
+  int boxes;         /* Boxes drawn */
+  int rebuilt;       /* Boxes whose draw function was called */
+  int batches;       /* Batches from the feed coalesced into this frame */
+};
+
 typedef void (*func)();
-using draw_func = std::function<std::string(struct tui_box *)>;
-using loop_func = std::function<void(struct tui_box *, int, int, int)>;
+using draw_func = std::function<std::string(struct tui_box)>;
+using loop_func = std::function<void(struct tui_box, int, int, int)>;
+using link_func = std::function<void(struct tui_box, std::string_view)>;
+using frame_func = std::function<void(const tui_frame_stats &)>;
+using batch_func = std::function<void(struct vt100_batch_t &)>;
+using row_func = std::function<void(size_t, std::string &)>;
+using row_click_func = std::function<void(struct tui_list *, size_t)>;
+using tween_func = std::function<void(double)>;
+
+enum tui_ease { tui_linear, tui_ease_in, tui_ease_out, tui_ease_in_out };
+
+/* Interpolation, for tween functions */
+inline int tui_lerp(int a, int b, double t) {
+  return a + (int)((b - a) * t + (b > a ? 0.5 : -0.5));
+}
+
+/* Between two 0xRRGGBB colors, channel by channel */
+inline uint32_t tui_lerp_rgb(uint32_t a, uint32_t b, double t) {
+  uint32_t out = 0;
+  for (int shift = 0; shift < 24; shift += 8)
+    out |= (uint32_t)tui_lerp((a >> shift) & 0xff, (b >> shift) & 0xff, t)
+           << shift;
+  return out;
+}
 
 struct tui_rect {
   int x, y;
@@ -26,24 +74,149 @@ struct tui_rect {
   }
 };
 
+/*
+ * A handle to a box (see tui::add).
+ *
+ * Handles are plain values, and one
+ *   to a removed box is recognized
+ *   as stale even after its slot
+ *   has been reused.
+ */
 struct tui_box {
+  uint32_t index = UINT32_MAX;
+  uint32_t generation = 0;
+
+  bool operator==(const tui_box &) const = default;
+};
+
+enum { tui_box_live = 1, tui_box_dirty = 2 };
+
+/*
+ * Every box of a tui, stored by field:
+ *   what drawing and hit testing
+ *   read for each box lies in
+ *   contiguous arrays, and click
+ *   and hover listeners only take
+ *   up space when set.
+ *
+ * A box takes 81 bytes across the
+ *   arrays, 32 of them for its
+ *   draw function (which every box
+ *   has), plus its cache and any
+ *   captures too big to be stored
+ *   in the function itself.
+ */
+struct tui_store {
+  /* Read for every box, every frame and mouse event */
+  std::vector<tui_rect> rect;
+  std::vector<uint32_t> screen; /* In tui::screens_ */
+  std::vector<uint8_t> flags;
+  std::vector<uint32_t> generation;
+
+  /* Read only for boxes being drawn, clicked, or laid out */
+  std::vector<uint32_t> cache_at, cache_len; /* In text */
+  std::vector<draw_func> draw;
+  std::vector<uint32_t> onclick, onhover; /* In listeners, plus one */
+  std::vector<uint32_t> flow;             /* In tui::flows_, plus one */
+  std::vector<uint32_t> flow_index;
+
+  std::vector<loop_func> listeners;
+  std::vector<uint32_t> free, free_listeners; /* Slots to reuse */
+
+  /* What every box last drew, back to back, so short caches need no
+   *   allocation of their own */
+  std::string text;
+  size_t garbage = 0; /* Bytes of text no box uses */
+
+  uint32_t size() const { return rect.size(); }
+  bool live(uint32_t i) const { return flags[i] & tui_box_live; }
+  bool valid(tui_box b) const {
+    return b.index < size() && live(b.index) &&
+           generation[b.index] == b.generation;
+  }
+  tui_box handle(uint32_t i) const { return {i, generation[i]}; }
+  std::string_view cache(uint32_t i) const {
+    return std::string_view(text).substr(cache_at[i], cache_len[i]);
+  }
+
+  /*
+   * Replaces a box's cache, in place
+   *   if it fits, compacting text
+   *   once it is mostly garbage.
+   */
+  void set_cache(uint32_t i, std::string_view str);
+};
+
+/*
+ * A container placing its boxes in
+ *   reading order, starting a new
+ *   line when the next one doesn't
+ *   fit (see tui::add_flow).
+ */
+struct tui_flow {
   tui_rect rect_;
   int screen_;
-  std::string cache;
-  draw_func draw;
-  loop_func onhover;
-  tui_box() {}
+  int gap_x_, gap_y_; /* Columns between boxes, rows between lines */
+  std::vector<uint32_t> boxes_; /* Slots in the tui's store */
 
-public:
-  loop_func onclick;
-  tui_box(const tui_box &) = delete;
-  tui_box &operator=(const tui_box &) = delete;
-  ~tui_box() {}
-  static std::shared_ptr<tui_box> create(const tui_rect &rect, int screen,
-                                         draw_func draw, loop_func onclick,
-                                         loop_func onhover);
+  /* Height of the line so far, after each box, so layout can resume
+   *   anywhere */
+  std::vector<int> line_h_;
+  size_t stale_ = 0; /* First box that may need to move */
+
+  int screen() const { return screen_; }
+};
+
+/*
+ * A scrolling list of rows, of which
+ *   only the visible ones are ever
+ *   formatted or kept (see tui::add_list).
+ */
+struct tui_list {
+  tui_rect rect_;
+  int screen_;
+  size_t count_ = 0; /* Rows in the list */
+  size_t top_ = 0;   /* First visible row */
+  row_func row;
+  row_click_func onclick;
+
+  /* One buffer per visible line, reused as rows scroll past: row i is kept
+   *   in rows_[i % h] if index_ of that slot is i */
+  std::vector<std::string> rows_;
+  std::vector<size_t> index_;
 
   int screen() const { return screen_; }
+  size_t top() const { return top_; }
+  size_t count() const { return count_; }
+};
+
+/*
+ * The boxes, lists and flows of one
+ *   screen (see tui::set_screen),
+ *   and what it showed last.
+ */
+struct tui_screen {
+  int id_;
+  uint32_t index_; /* In tui::screens_ */
+  int scroll_ = 0;
+  std::vector<uint32_t> boxes_; /* Slots, in drawing order */
+  std::vector<tui_list *> lists_;
+  std::vector<tui_flow *> flows_;
+
+  /* Boxes by the rows they cover, rebuilt once boxes are added, removed
+   *   or moved */
+  std::vector<std::vector<uint32_t>> rows_;
+  int rows_top_ = 0;
+  bool index_stale_ = true;
+
+  /* Everything written since the last full frame, which repaints the
+   *   screen when written again, unless it has changed since */
+  std::string front_;
+  bool front_valid_ = false;
+  bool changed_ = true;     /* Boxes or lists added, removed or changed */
+  uint32_t dirty_boxes_ = 0; /* Invalidated, but not yet drawn */
+
+  int id() const { return id_; }
 };
 
 struct tui_event {
@@ -51,15 +224,164 @@ struct tui_event {
   func f;
 };
 
+/* A running animation, see tui::animate */
+struct tui_animation {
+  uint32_t id;
+  std::chrono::steady_clock::time_point start;
+  int ms; /* Duration, or -1 once cancelled */
+  tui_ease ease;
+  tween_func f;
+};
+
+/* What ui_t_impl::Wait found */
+enum { tui_wait_input = 1, tui_wait_wake = 2 };
+
+/*
+ * The terminal a tui draws to and reads
+ *   input from: the real one for tui(int),
+ *   or any other (e.g. ui_t_headless)
+ *   given to tui(int, ui_t_impl *).
+ */
+class ui_t_impl {
+public:
+  virtual ~ui_t_impl() = default;
+
+  virtual uint16_t Cols() const = 0;
+  virtual uint16_t Rows() const = 0;
+
+  /* Whether a cell can be drawn to */
+  virtual bool Contains(int x, int y) const {
+    return x > 0 && x < this->Cols() && y > 0 && y < this->Rows();
+  }
+
+  /* Waits for input, returning nothing once there is no more */
+  virtual std::optional<std::string_view> Read() = 0;
+
+  /* Returns the number of write() calls needed */
+  virtual int Write(std::string_view str) = 0;
+
+  /* Wakes Wait from another thread */
+  virtual void Wake() = 0;
+
+  /*
+   * Waits up to timeout ms (forever if
+   *   negative) for input or a Wake.
+   */
+  virtual int Wait(int timeout) = 0;
+};
+
+/*
+ * A terminal in memory, for tests,
+ *   benchmarks and rendering without
+ *   a tty: input is scripted with
+ *   push, and output is fed to a
+ *   screen model.
+ *
+ * Each is independent, so tuis on
+ *   headless terminals can run on
+ *   many threads at once.
+ */
+class ui_t_headless : public ui_t_impl {
+  uint16_t cols_, rows_;
+  struct vt100_screen_t *screen_;
+  size_t bytes_ = 0, writes_ = 0;
+
+  /* Guards the input, which other threads may push */
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::deque<std::string> input_;
+  std::string read_; /* What Read last returned */
+  bool closed_ = false, woken_ = false;
+
+public:
+  ui_t_headless(int cols, int rows);
+  ~ui_t_headless();
+
+  uint16_t Cols() const override { return cols_; }
+  uint16_t Rows() const override { return rows_; }
+  std::optional<std::string_view> Read() override;
+  int Write(std::string_view str) override;
+  void Wake() override;
+  int Wait(int timeout) override;
+
+  /*
+   * Queues input, read by mainloop
+   *   as if typed all at once.
+   *   May be called from any thread.
+   */
+  void push(std::string_view str);
+
+  /*
+   * Ends the input: mainloop returns
+   *   once it has read everything
+   *   pushed, and any animations
+   *   have finished.
+   */
+  void close();
+
+  /*
+   * The screen, as the output so far
+   *   left it.  Only read it on the
+   *   thread running the tui.
+   */
+  struct vt100_screen_t *screen() { return screen_; }
+  std::string text();
+
+  size_t bytes() const { return bytes_; }
+  size_t writes() const { return writes_; }
+};
+
+/*
+ * tui is not thread safe: boxes and their
+ *   caches are only touched on the thread
+ *   running mainloop.  Other threads hand it
+ *   work through a vt100_ring_t (see feed).
+ */
 class tui {
   class ui_t_impl *impl_ = nullptr;
-  std::vector<std::shared_ptr<tui_box>> boxes_;
+  tui_store store_;
+  std::vector<std::unique_ptr<tui_list>> lists_;
+  std::vector<std::unique_ptr<tui_flow>> flows_;
+  std::vector<std::unique_ptr<tui_screen>> screens_;
+  tui_screen *current_ = nullptr;
   std::vector<tui_event> events_;
+  link_func onlink_;
   bool mouse_ = false;
   int screen_;
   int scroll_ = 0;
   bool canscroll_ = true;
   int force_ = 0;
+  int clip_top_ = 1, clip_bottom_ = INT32_MAX; /* Rows draw_one may paint */
+
+  /* Output is buffered and written once per frame */
+  std::string out_;
+  enum { frame_partial, frame_full, frame_replay } frame_kind_ = frame_partial;
+  size_t front_limit_ = 65536; /* Past this, a screen's front_ is dropped */
+  tui_frame_stats stats_ = {};
+  int frame_boxes_ = 0, frame_rebuilt_ = 0;
+  frame_func onframe_;
+  bool overlay_ = false;
+  std::chrono::steady_clock::time_point frame_start_, input_at_;
+  bool input_pending_ = false;
+
+  /* Batches from another thread */
+  struct vt100_ring_t *ring_ = nullptr;
+  batch_func onbatch_;
+  int frame_batches_ = 0;
+  std::function<void()> onwake_;
+
+  /* Animations, which all step in one frame every frame_ms_ */
+  std::vector<tui_animation> animations_;
+  uint32_t next_animation_ = 1;
+  int frame_ms_ = 16;
+  std::chrono::steady_clock::time_point next_frame_;
+
+  /* Recording (see record), and replaying on a clock of its own */
+  FILE *record_ = nullptr;
+  std::chrono::steady_clock::time_point record_start_;
+  struct vt100_screen_t *replay_screen_ = nullptr;
+  bool replaying_ = false;
+  std::chrono::steady_clock::time_point replay_now_;
 
 public:
   tui(const tui &) = delete;
@@ -74,6 +396,13 @@ public:
    */
   tui(int s);
 
+  /*
+   * Initializes a new UI struct
+   *   drawn to the given terminal,
+   *   which it then owns.
+   */
+  tui(int s, ui_t_impl *impl);
+
   /*
    * Frees the given UI struct,
    *   and takes the terminal
@@ -99,9 +428,57 @@ public:
    *   intimidating to look at.
    * TODO: Find some way to
    *   strip this down.
+   *
+   * Draw functions must not add or
+   *   remove boxes.
    */
-  void add(const tui_rect &rect, draw_func draw, loop_func onclick,
-           loop_func onhover);
+  tui_box add(const tui_rect &rect, draw_func draw, loop_func onclick,
+              loop_func onhover);
+
+  /*
+   * Removes a box, whose slot may
+   *   then be reused (and whose
+   *   handle is no longer valid).
+   */
+  void remove(tui_box b);
+
+  bool valid(tui_box b) const { return store_.valid(b); }
+  /* Empty for a stale handle */
+  tui_rect rect(tui_box b) const {
+    return store_.valid(b) ? store_.rect[b.index] : tui_rect{};
+  }
+
+  /*
+   * Adds a flow, which lays out the
+   *   boxes added to it left to
+   *   right within rect, gap_x
+   *   columns apart, wrapping onto
+   *   lines gap_y rows apart.
+   */
+  tui_flow *add_flow(const tui_rect &rect, int gap_x, int gap_y);
+
+  /*
+   * Adds a box to the end of a flow.
+   *
+   * Its size is measured from what
+   *   draw returns (in columns, and
+   *   lines), and measured again
+   *   only when it is redrawn.
+   */
+  tui_box add(tui_flow *f, draw_func draw, loop_func onclick,
+              loop_func onhover);
+
+  /*
+   * Redraws the flow's invalidated
+   *   boxes, and moves the boxes
+   *   from the first one that
+   *   changed size onward.
+   *
+   * draw does this for every flow,
+   *   so it is only needed to know
+   *   where boxes went beforehand.
+   */
+  void layout(tui_flow *f);
 
   /*
    * HELPERS
@@ -109,13 +486,66 @@ public:
   void add_text(int x, int y, std::string_view str, loop_func click,
                 loop_func hover);
 
-  int cursor_y(tui_box *b, int n);
+  int cursor_y(tui_box b, int n);
+
+  /*
+   * Adds a list of count rows, which
+   *   row formats (on demand, into a
+   *   reused buffer) by index.
+   *
+   * Memory and drawing cost depend
+   *   only on the rows visible, so
+   *   count may be in the millions.
+   *   The mouse wheel scrolls the
+   *   list under the pointer.
+   */
+  tui_list *add_list(const tui_rect &rect, size_t count, row_func row,
+                     row_click_func onclick);
+
+  /*
+   * Scrolls a list by n rows (up if
+   *   negative), painting only the
+   *   rows that come into view if
+   *   the list spans the screen.
+   */
+  void scroll_list(tui_list *l, long n);
+
+  /*
+   * Sets the number of rows in a
+   *   list, and repaints its rows.
+   */
+  void update_list(tui_list *l, size_t count);
+
+  /*
+   * Marks a box to be redrawn
+   *   (calling its draw function)
+   *   in the next frame.
+   */
+  void invalidate(tui_box b) {
+    if (!store_.valid(b))
+      return;
+    if (!(store_.flags[b.index] & tui_box_dirty)) {
+      store_.flags[b.index] |= tui_box_dirty;
+      screens_[store_.screen[b.index]]->dirty_boxes_++;
+    }
+    if (uint32_t f = store_.flow[b.index]) {
+      tui_flow *flow = flows_[f - 1].get();
+      flow->stale_ = std::min(flow->stale_, (size_t)store_.flow_index[b.index]);
+    }
+  }
 
   /*
    * Draws a single box to the
    *   screen.
    */
-  void draw_one(tui_box *tmp, int flush);
+  void draw_one(tui_box b, int flush);
+
+  /*
+   * Draws the visible rows of a list
+   *   from first to last (relative
+   *   to its top).
+   */
+  void draw_rows(tui_list *l, int first, int last);
 
   /*
    * Draws all boxes to the screen.
@@ -128,15 +558,273 @@ public:
    */
   void redraw();
 
+  /*
+   * Scrolls everything but lists by
+   *   n rows (down if positive), as
+   *   the mouse wheel does.
+   *
+   * The terminal is asked to move
+   *   what is on screen with a
+   *   scroll region, so only the
+   *   rows scrolled into view are
+   *   sent.
+   */
+  void scroll(int n);
+
+  /*
+   * Switches to screen s, creating
+   *   it if new.  Boxes, lists and
+   *   flows are added to the current
+   *   screen, and only its boxes are
+   *   drawn or see events.
+   *
+   * Each screen keeps what it last
+   *   showed, so switching back to
+   *   one repaints it without
+   *   drawing any box, unless boxes
+   *   on it were invalidated, added
+   *   or removed in the meantime.
+   */
+  void set_screen(int s);
+  int screen() const { return screen_; }
+
   /*
    * Adds a new key event listener
    *   to the UI.
    */
   void on_key(const char *c, func f);
 
+  /*
+   * Sets the listener called with
+   *   the URL when clicking on
+   *   hyperlinked (OSC 8) text.
+   */
+  void on_link(link_func f);
+
+  /*
+   * Returns statistics about the
+   *   most recent frame.
+   */
+  const tui_frame_stats &frame_stats() const { return stats_; }
+
+  /*
+   * Sets a listener called after
+   *   every frame with its
+   *   statistics.
+   */
+  void on_frame(frame_func f);
+
+  /*
+   * Shows or hides frame statistics
+   *   in the top right corner (also
+   *   enabled by setting TUI_STATS
+   *   in the environment).
+   */
+  void show_stats(bool show);
+
+  /*
+   * Has mainloop take batches pushed
+   *   to the ring by another thread,
+   *   calling f with each (on this
+   *   thread) and then drawing once,
+   *   so a burst of output costs a
+   *   single frame.  f owns the
+   *   batch's nodes, and should
+   *   invalidate the boxes showing
+   *   them.
+   *
+   * Input is always handled first,
+   *   and at most a ringful of
+   *   batches is taken per frame,
+   *   so heavy output can't hold
+   *   off input.
+   *
+   * Call this before the producer
+   *   starts pushing, and stop it
+   *   before the tui is destroyed.
+   */
+  void feed(struct vt100_ring_t *ring, batch_func f);
+
+  /*
+   * Wakes mainloop, which then calls
+   *   the listener set with on_wake.
+   *
+   * Unlike everything else, this may
+   *   be called from any thread.
+   */
+  void wake();
+
+  /*
+   * Sets the listener called (on
+   *   the mainloop thread) after
+   *   wake is called.
+   */
+  void on_wake(std::function<void()> f);
+
+  /*
+   * Draws only the boxes invalidated
+   *   since the last frame, clearing
+   *   what they no longer cover.
+   *
+   * Falls back to draw when one
+   *   overlaps another box, or moves
+   *   the boxes after it in a flow.
+   */
+  void refresh();
+
+  /*
+   * Animates over ms milliseconds,
+   *   returning an id for cancel.
+   *
+   * Once per frame, mainloop calls
+   *   f with the eased progress,
+   *   from 0 to 1 (which it is
+   *   always called with last).  f
+   *   updates what boxes show and
+   *   invalidates them; then one
+   *   refresh draws the changes of
+   *   every running animation.
+   *
+   * Nothing waits for animations,
+   *   so input is handled while
+   *   they run.
+   */
+  uint32_t animate(int ms, tween_func f, tui_ease ease = tui_ease_out);
+
+  /*
+   * Stops an animation where it is
+   *   (f is not called again).
+   */
+  void cancel(uint32_t id);
+
+  /*
+   * Sets the time between animation
+   *   frames (16ms by default).
+   */
+  void set_frame_ms(int ms) { frame_ms_ = ms; }
+
+  /*
+   * Records the session to path as
+   *   an asciicast (see vt100cast.h):
+   *   every frame written, and the
+   *   input mainloop reads, with
+   *   timestamps.  Returns false if
+   *   path can't be written.
+   *
+   * Also enabled by setting
+   *   TUI_RECORD to a path.
+   */
+  bool record(const char *path);
+
+  /*
+   * Replays a recorded session's
+   *   input as fast as possible,
+   *   stepping animations on the
+   *   recording's clock rather
+   *   than the real one, so every
+   *   replay draws the same frames.
+   *   Returns the frames drawn.
+   *
+   * Set up the boxes as when it
+   *   was recorded first.  Frames
+   *   go to screen instead of the
+   *   terminal, unless it is NULL.
+   */
+  uint64_t replay(const struct vt100_cast_t &cast,
+                  struct vt100_screen_t *screen);
+
   void mainloop();
 
 private:
+  /* The time, which is the recording's while replaying */
+  std::chrono::steady_clock::time_point now() const;
+
+  /*
+   * Steps animations, while
+   *   replaying, up to the given
+   *   time.
+   */
+  void replay_until(std::chrono::steady_clock::time_point t);
+
+  void record_event(char type, std::string_view str);
+
+  void begin_frame();
+
+  /*
+   * Calls a box's draw function,
+   *   returning whether that
+   *   changed its size in a flow.
+   */
+  bool build(uint32_t i);
+
+  /*
+   * Draws the box in slot i (see
+   *   draw_one).
+   */
+  void draw_slot(uint32_t i, int flush);
+
+  int cursor_y(uint32_t i, int n);
+
+  /*
+   * Returns the screen with the
+   *   given id, creating it if
+   *   needed.
+   */
+  tui_screen *find_screen(int s);
+
+  /*
+   * Returns the current screen's
+   *   boxes covering row y, which
+   *   may not cover column x.
+   */
+  const std::vector<uint32_t> &boxes_at(int y);
+
+  /*
+   * Returns the current screen's
+   *   boxes under the given point,
+   *   copied so that listeners may
+   *   move them.
+   */
+  std::vector<tui_box> hits_at(int x, int y);
+
+  /* Listeners are copied before being called, since they may add boxes */
+  uint32_t add_listener(loop_func f);
+  void call_listener(uint32_t listener, uint32_t i, int x, int y);
+
+  /*
+   * Takes the batches waiting in
+   *   the ring, and paints what
+   *   they changed.
+   */
+  void drain();
+
+  /*
+   * Returns the list under the given
+   *   point, if any.
+   */
+  tui_list *list_at(int x, int y);
+
+  /*
+   * Writes out the buffered frame
+   *   and records its statistics.
+   */
+  void flush();
+
+  /*
+   * Keeps what was just written as
+   *   part of what the current
+   *   screen shows.
+   */
+  void retain();
+
+  /*
+   * Steps every animation, if a
+   *   frame is due, returning the
+   *   ms until the next one (or -1
+   *   if none are running).
+   */
+  int tick();
+
   /*
    * Handles mouse and keyboard
    *   events, given a read()
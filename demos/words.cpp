@@ -1,61 +1,95 @@
 /*
  * words.c: Per-word events
  */
-#include "../vt100utils.h"
+#include "../vt100segment.h"
+#include "../vt100static.h"
 #include "tui.h"
-#include <sstream>
+#include <set>
+
+/* Runs of color hold whole sentences, in several scripts, decoded at
+ *   compile time */
+constexpr auto &words = vt100_static<
+    "\x1B[38;5;75mClick any word to mark it. Each run of color holds a "
+    "sentence, not a word, \x1B[38;5;114mso words like can't, 3.14 and "
+    "snake_case are found by segmenting the text. \x1B[38;5;180m"
+    "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe6\x96\x87\xe3\x81\xaf"
+    "\xe7\xa9\xba\xe7\x99\xbd\xe3\x81\x8c\xe3\x81\xaa\xe3\x81\x8f\xe3\x81\xa6"
+    "\xe3\x82\x82\xe6\x8a\x98\xe3\x82\x8a\xe8\xbf\x94\xe3\x81\x9b\xe3\x82\x8b"
+    "\xe3\x80\x82 \x1B[38;5;175m\xce\x9a\xce\xb1\xce\xbb\xce\xb7\xce\xbc\xce"
+    "\xad\xcf\x81\xce\xb1 \xce\xba\xcf\x8c\xcf\x83\xce\xbc\xce\xb5, \xd0\xbf"
+    "\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 \xd0\xbc\xd0\xb8\xd1\x80, "
+    "na\xc3\xafve cafe\xcc\x81, \xed\x95\x9c\xea\xb5\xad\xec\x96\xb4 \xeb\x8b"
+    "\xa8\xec\x96\xb4. \x1B[38;5;222mA family "
+    "(\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x91"
+    "\xa7) and a flag (\xf0\x9f\x87\xaf\xf0\x9f\x87\xb5) are one character "
+    "each.">;
+
+/* Starts of the marked words, within words' text */
+static std::set<const char *> marked;
+
+/* Marked words are underlined and bracketed, which moves the text after
+ *   them */
+static std::string draw_unit(std::string_view sgr, std::string_view unit) {
+  const char *p = unit.data(), *end = p + unit.size(), *q;
+  std::string out(sgr);
+
+  for (; p < end; p = q) {
+    q = vt100_word_next(p, end);
+    if (marked.count(p))
+      out.append("\x1b[4m[").append(p, q).append("]\x1b[24m");
+    else
+      out.append(p, q);
+  }
+  return out;
+}
+
+/* The segment drawn at column x of a unit */
+static const char *word_at(std::string_view unit, int x) {
+  const char *p = unit.data(), *end = p + unit.size(), *q;
+
+  for (; p < end; p = q) {
+    q = vt100_word_next(p, end);
+    x -= vt100_width(p, q - p) + (marked.count(p) ? 2 : 0);
+    if (x < 0)
+      return p;
+  }
+  return NULL;
+}
 
 void stop() {}
 
 int main(void) {
-  /* String manually generated with Javascript */
-  auto head = vt100_decode(
-      "\x1B[38;5;100mClick\x1B[38;5;101many\x1B[38;5;102mword\x1B[38;5;"
-      "103mto\x1B[38;5;104mchange\x1B[38;5;105mits\x1B[38;5;106mcolor!\x1B[38;"
-      "5;107mThis\x1B[38;5;108mis\x1B[38;5;109ma\x1B[38;5;110mlong\x1B[38;5;"
-      "111mparagraph\x1B[38;5;112mof\x1B[38;5;113mtext,\x1B[38;5;114mand\x1B["
-      "38;5;115mevery\x1B[38;5;116mword\x1B[38;5;117mcan\x1B[38;5;118mbe\x1B["
-      "38;5;119mclicked.\x1B[38;5;120mWhile\x1B[38;5;121mbehavior\x1B[38;5;"
-      "122mlike\x1B[38;5;123mthis\x1B[38;5;124mis\x1B[38;5;125mpossible\x1B[38;"
-      "5;126mwith\x1B[38;5;127mstandalone\x1B[38;5;128mtui\x1B[38;5;129m("
-      "or\x1B[38;5;130mother\x1B[38;5;131mlibraries),\x1B[38;5;132mit\x1B[38;5;"
-      "133mwould\x1B[38;5;134mbe\x1B[38;5;135mincredibly\x1B[38;5;"
-      "136mchallenging\x1B[38;5;137mand\x1B[38;5;138mcumbersome.\x1B[38;5;"
-      "139mThis\x1B[38;5;140mdemo\x1B[38;5;141mis\x1B[38;5;142mwritten\x1B[38;"
-      "5;143min\x1B[38;5;144mless\x1B[38;5;145mthan\x1B[38;5;146m100\x1B[38;5;"
-      "147mlines\x1B[38;5;148mof\x1B[38;5;149mcode.");
-
   tui g_u(0);
+  int mandatory;
+
+  /* Wrapped by the flow, wherever marks have moved the words */
+  tui_flow *flow = g_u.add_flow(g_u.get_center(60, 16), 0, 0);
+
+  /* One box per place a line may break, viewing the static text */
+  for (size_t i = 0; i < words.count(); i++) {
+    std::string_view str = words.str(i), sgr = words.sgr(i);
+    const char *end = str.data() + str.size(), *q;
+
+    for (const char *p = str.data(); p < end; p = q) {
+      q = vt100_line_next(p, end, &mandatory);
+      std::string_view unit(p, q - p);
+
+      draw_func draw = [sgr, unit](tui_box) { return draw_unit(sgr, unit); };
+
+      loop_func click = [unit, _u = &g_u](tui_box b, int x, int, int) {
+        const char *word = word_at(unit, x - _u->rect(b).x);
+        if (!word ||
+            !vt100_is_word(word,
+                           vt100_word_next(word, unit.data() + unit.size())))
+          return;
+        if (!marked.erase(word))
+          marked.insert(word);
+        _u->invalidate(b);
+        _u->draw();
+      };
 
-  auto x = (g_u.cols() - 50) / 2;
-  auto y = (g_u.rows() - 10) / 2;
-
-  auto tmp = head->next;
-  while (tmp) {
-    draw_func draw = [node = tmp](tui_box *b) {
-      // struct vt100_node_t *node = tmp;
-      char *sgr = vt100_sgr(node, NULL);
-      std::stringstream ss;
-      ss << sgr << node->str;
-      free(sgr);
-      return ss.str();
-    };
-
-    loop_func click = [node = tmp, _u = &g_u](tui_box *b, int x, int y, int) {
-      // struct vt100_node_t *node = (struct vt100_node_t *)b->data1;
-      node->fg.value += 10;
-      if (node->fg.value > 255)
-        node->fg.value = 10;
-      _u->redraw();
-    };
-
-    g_u.add({x, y, tmp->len, 1}, draw, click, {});
-    x += tmp->len;
-    if (x > (g_u.cols() + 50) / 2) {
-      x = (g_u.cols() - 50) / 2;
-      y += 2;
+      g_u.add(flow, draw, click, {});
     }
-    tmp = tmp->next;
   }
 
   g_u.on_key("q", stop);
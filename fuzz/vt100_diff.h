@@ -0,0 +1,159 @@
+/*
+ * vt100_diff.h: Differential checks against the reference decoder/encoder
+ *
+ * Decoders are compared by the visible text and graphics state of every
+ *   byte rather than by node boundaries, and encoders by what their output
+ *   decodes to, so an optimized implementation may split nodes or choose
+ *   different (but equivalent) sequences.  Each check returns an empty
+ *   string on success, or a description of the first difference.
+ */
+
+#ifndef __VT100_DIFF_H
+#define __VT100_DIFF_H
+
+#include "../vt100utils.h"
+#include <string>
+#include <vector>
+
+/* One visible byte and the state it is drawn with */
+struct vt100_diff_cell_t {
+  char ch;
+  struct vt100_attr_t attr;
+  std::string url;
+};
+
+typedef struct vt100_node_t *(*vt100_decode_func)(const char *);
+typedef char *(*vt100_encode_func)(struct vt100_node_t *);
+
+/*
+ * vt100_diff_reset: Restores the decoder's
+ *   graphics state, so that results do not
+ *   depend on earlier calls
+ */
+inline void vt100_diff_reset() {
+  global_fg = default_fg;
+  global_bg = default_bg;
+  global_ul = default_ul;
+  global_mode = 0;
+  global_ul_style = 0;
+  global_link = 0;
+}
+
+inline std::vector<struct vt100_diff_cell_t>
+vt100_diff_normalize(struct vt100_node_t *head) {
+  std::vector<struct vt100_diff_cell_t> cells;
+  const char *url;
+
+  for (struct vt100_node_t *tmp = head; tmp != NULL; tmp = tmp->next) {
+    if (tmp->seq != seq_none)
+      continue;
+    url = vt100_link_url(head, tmp);
+    for (int i = 0; i < tmp->len - 1; i++)
+      cells.push_back({tmp->str[i], vt100_pack_attr(tmp), url ? url : ""});
+  }
+  return cells;
+}
+
+inline std::string
+vt100_diff_compare(const std::vector<struct vt100_diff_cell_t> &expected,
+                   const std::vector<struct vt100_diff_cell_t> &actual) {
+  size_t n = MAX(expected.size(), actual.size());
+
+  for (size_t i = 0; i < n; i++) {
+    if (i >= expected.size() || i >= actual.size())
+      return "length differs: expected " + std::to_string(expected.size()) +
+             " visible bytes, got " + std::to_string(actual.size());
+    if (expected[i].ch != actual[i].ch)
+      return "text differs at byte " + std::to_string(i);
+    if (!vt100_attr_eq(expected[i].attr, actual[i].attr))
+      return "attributes differ at byte " + std::to_string(i);
+    if (expected[i].url != actual[i].url)
+      return "hyperlink differs at byte " + std::to_string(i);
+  }
+  return "";
+}
+
+/*
+ * vt100_diff_decoder: Compares a decoder with
+ *   vt100_decode on str
+ */
+inline std::string vt100_diff_decoder(const char *str,
+                                      vt100_decode_func decode) {
+  struct vt100_node_t *expected, *actual;
+  std::string result;
+
+  vt100_diff_reset();
+  expected = vt100_decode(str);
+  vt100_diff_reset();
+  actual = decode(str);
+
+  result = vt100_diff_compare(vt100_diff_normalize(expected),
+                              vt100_diff_normalize(actual));
+  vt100_free(expected);
+  vt100_free(actual);
+  return result;
+}
+
+/*
+ * vt100_diff_encoder: Checks that what an
+ *   encoder produces for the nodes decodes
+ *   back to the same state
+ */
+inline std::string vt100_diff_encoder(struct vt100_node_t *head,
+                                      vt100_encode_func encode) {
+  struct vt100_node_t *decoded;
+  std::string result;
+  char *out = encode(head);
+
+  vt100_diff_reset();
+  decoded = vt100_decode(out);
+  result = vt100_diff_compare(vt100_diff_normalize(head),
+                              vt100_diff_normalize(decoded));
+  vt100_free(decoded);
+  VT100_FREE(out);
+  return result;
+}
+
+/*
+ * vt100_diff_roundtrip: Checks the reference
+ *   encoder against the reference decoder
+ */
+inline std::string vt100_diff_roundtrip(const char *str) {
+  struct vt100_node_t *head;
+  std::string result;
+
+  vt100_diff_reset();
+  head = vt100_decode(str);
+  result = vt100_diff_encoder(head, vt100_encode);
+  vt100_free(head);
+  return result;
+}
+
+/*
+ * vt100_diff_strip: Compares vt100_strip (and
+ *   its offset map) with the decoded text
+ */
+inline std::string vt100_diff_strip(const char *str) {
+  size_t len = strlen(str), n;
+  std::string text, out(len, '\0');
+  std::vector<size_t> map(len);
+  struct vt100_node_t *head;
+
+  vt100_diff_reset();
+  head = vt100_decode(str);
+  for (struct vt100_node_t *tmp = head; tmp != NULL; tmp = tmp->next)
+    text.append(tmp->str, tmp->len - 1);
+  vt100_free(head);
+
+  n = vt100_strip(str, len, out.data(), map.data());
+  out.resize(n);
+  if (out != text)
+    return "stripped text differs from decoded text";
+  for (size_t i = 0; i < n; i++) {
+    if (map[i] >= len || str[map[i]] != out[i])
+      return "strip offset map is wrong at byte " + std::to_string(i);
+  }
+  return "";
+}
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * vt100_fuzz.cpp: Fuzz target for the decoder, encoder and segmentation
+ *
+ * With -Dfuzz=true (clang), this is a libFuzzer target.  Otherwise it
+ *   is a standalone driver which runs every file (or every file in each
+ *   directory) given on the command line, or stdin, through the same
+ *   checks; that works for AFL as well as for replaying the corpus:
+ *
+ *   afl-fuzz -i fuzz/corpus -o findings -- ./vt100_fuzz
+ */
+#include "../vt100segment.h"
+#include "vt100_diff.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+static void check(const char *what, const std::string &result,
+                  const std::string &input) {
+  if (result.empty())
+    return;
+  fprintf(stderr, "%s: %s\ninput (%zu bytes): ", what, result.c_str(),
+          input.size());
+  for (unsigned char c : input)
+    fprintf(stderr, c >= 0x20 && c < 0x7f ? "%c" : "\\x%02x", c);
+  fprintf(stderr, "\n");
+  abort();
+}
+
+/* vt100_encode through an SGR transition cache */
+static char *encode_cached(struct vt100_node_t *head) {
+  struct vt100_styles_t *styles = vt100_styles_new();
+  char *out;
+
+  global_sgr_cache = vt100_sgr_cache_new(styles, 64);
+  out = vt100_encode(head);
+  vt100_sgr_cache_free(global_sgr_cache);
+  global_sgr_cache = NULL;
+  vt100_styles_free(styles);
+  return out;
+}
+
+/* vt100_decode with style interning enabled */
+static struct vt100_node_t *decode_styled(const char *str) {
+  struct vt100_node_t *head;
+
+  global_styles = vt100_styles_new();
+  head = vt100_decode(str);
+  for (struct vt100_node_t *tmp = head; tmp != NULL; tmp = tmp->next) {
+    if (tmp->style != vt100_style_none &&
+        !vt100_attr_eq(vt100_style_attr(global_styles, tmp->style),
+                       vt100_pack_attr(tmp)))
+      abort();
+  }
+  vt100_styles_free(global_styles);
+  global_styles = NULL;
+  return head;
+}
+
+/* Segmentation must move forward, within the run, on any bytes */
+static std::string segment(const std::string &input) {
+  const char *start = input.data(), *end = start + input.size(), *p, *q;
+  std::vector<const char *> clusters;
+  int mandatory, width;
+
+  for (p = start; p < end; p = q) {
+    clusters.push_back(p);
+    if ((q = vt100_grapheme_next(p, end)) <= p || q > end)
+      return "grapheme_next";
+  }
+  for (p = end; p > start;) {
+    if ((p = vt100_grapheme_prev(start, p)) != clusters.back())
+      return "grapheme_prev";
+    clusters.pop_back();
+  }
+  for (p = start; p < end; p = q)
+    if ((q = vt100_word_next(p, end)) <= p || q > end)
+      return "word_next";
+  for (p = start; p < end; p = q)
+    if ((q = vt100_line_next(p, end, &mandatory)) <= p || q > end)
+      return "line_next";
+  for (p = start; p < end; p = q)
+    if ((q = vt100_wrap(p, end, 8, &width)) <= p || q > end)
+      return "wrap";
+  return "";
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  /* The decoder reads C strings, so stop at the first NUL */
+  std::string input((const char *)data, strnlen((const char *)data, size));
+  const char *str = input.c_str();
+  struct vt100_node_t *head;
+
+  check("roundtrip", vt100_diff_roundtrip(str), input);
+  check("strip", vt100_diff_strip(str), input);
+  check("styled decoder", vt100_diff_decoder(str, decode_styled), input);
+  check("segmentation", segment(input), input);
+
+  vt100_diff_reset();
+  head = vt100_decode(str);
+  check("cached encoder", vt100_diff_encoder(head, encode_cached), input);
+  vt100_free(head);
+
+  return 0;
+}
+
+#ifndef VT100_LIBFUZZER
+static void run_file(const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  LLVMFuzzerTestOneInput((const uint8_t *)data.data(), data.size());
+}
+
+int main(int argc, char **argv) {
+  int files = 0;
+
+  if (argc < 2) {
+    std::string data((std::istreambuf_iterator<char>(std::cin)),
+                     std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput((const uint8_t *)data.data(), data.size());
+    return 0;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    if (std::filesystem::is_directory(argv[i])) {
+      for (auto &entry : std::filesystem::directory_iterator(argv[i])) {
+        run_file(entry.path());
+        files++;
+      }
+    } else {
+      run_file(argv[i]);
+      files++;
+    }
+  }
+  printf("%i inputs passed\n", files);
+  return 0;
+}
+#endif
@@ -0,0 +1,96 @@
+#include "../vt100cast.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+
+static std::string
+write_cast(const std::vector<struct vt100_cast_event_t> &events) {
+  FILE *f = tmpfile();
+  std::string str;
+  char buf[4096];
+  size_t n;
+
+  vt100_cast_header(f, 80, 24);
+  for (auto &event : events)
+    vt100_cast_event(f, event.time, event.type, event.data.data(),
+                     event.data.size());
+  rewind(f);
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    str.append(buf, n);
+  fclose(f);
+  return str;
+}
+
+TEST_CASE("casts read back what was written", "[vt100_cast]") {
+  std::vector<struct vt100_cast_event_t> events = {
+      {0.0, 'o', "\x1b[?1049h\x1b[2J\x1b[1;1H\x1b[31mred\x1b[0m\r\n"},
+      {0.25, 'i', "\x1b[<0;10;5M"},
+      {0.5, 'o', "quotes \" and \\ backslashes\ttabs\x7f\x01"},
+      {1.125, 'i', "q"},
+      {2.0, 'o', "日本語 and \xf0\x9f\x8e\x89"},
+      {2.5, 'o', ""},
+  };
+  struct vt100_cast_t cast;
+  std::string str = write_cast(events);
+
+  REQUIRE(vt100_cast_parse(str.data(), str.size(), &cast) == 0);
+  REQUIRE(cast.width == 80);
+  REQUIRE(cast.height == 24);
+  REQUIRE(cast.events.size() == events.size());
+  for (size_t i = 0; i < events.size(); i++) {
+    REQUIRE(cast.events[i].time == events[i].time);
+    REQUIRE(cast.events[i].type == events[i].type);
+    REQUIRE(cast.events[i].data == events[i].data);
+  }
+
+  /* Every line is JSON, so control characters are escaped */
+  REQUIRE(str.find('\x1b') == std::string::npos);
+  REQUIRE(str.find("\\u001b[31mred") != std::string::npos);
+}
+
+TEST_CASE("casts only hold well-formed UTF-8", "[vt100_cast]") {
+  struct vt100_cast_t cast;
+  /* A character split between two reads */
+  std::string str = write_cast({{0, 'i', "\xe6\x97"}, {0, 'i', "\xa5"}});
+
+  REQUIRE(vt100_cast_parse(str.data(), str.size(), &cast) == 0);
+  REQUIRE(cast.events[0].data == "\xef\xbf\xbd\xef\xbf\xbd");
+  REQUIRE(cast.events[1].data == "\xef\xbf\xbd");
+
+  /* An overlong "/", a surrogate, a lead byte past U+10FFFF, and one
+   *   decoding past it */
+  str = write_cast({{0, 'o', "\xc0\xaf"},
+                    {0, 'o', "\xed\xa0\x80"},
+                    {0, 'o', "\xf8\x88\x80\x80"},
+                    {0, 'o', "\xf4\x90\x80\x80"},
+                    {0, 'o', "\xef\xbf\xbd\xf4\x8f\xbf\xbf"}});
+  REQUIRE(vt100_cast_parse(str.data(), str.size(), &cast) == 0);
+  for (int i = 0; i < 4; i++)
+    REQUIRE(cast.events[i].data == "\xef\xbf\xbd");
+  REQUIRE(cast.events[4].data == "\xef\xbf\xbd\xf4\x8f\xbf\xbf");
+}
+
+TEST_CASE("casts are read as asciinema writes them", "[vt100_cast]") {
+  std::string str =
+      "{\"version\": 2, \"width\": 120, \"height\": 40, \"timestamp\": "
+      "1700000000, \"env\": {\"SHELL\": \"/bin/bash\", \"TERM\": "
+      "\"xterm-256color\"}}\n"
+      "[0.1, \"o\", \"\\u001b[1mhi\\u001b[0m \\ud83c\\udf89\"]\n"
+      "\n"
+      "[0.2, \"r\", \"100x30\"]\n"
+      "[1.5, \"m\", \"\"]\n";
+  struct vt100_cast_t cast;
+
+  REQUIRE(vt100_cast_parse(str.data(), str.size(), &cast) == 0);
+  REQUIRE(cast.width == 120);
+  REQUIRE(cast.height == 40);
+  REQUIRE(cast.events.size() == 3);
+  REQUIRE(cast.events[0].data == "\x1b[1mhi\x1b[0m \xf0\x9f\x8e\x89");
+  REQUIRE(cast.events[1].type == 'r');
+  REQUIRE(cast.events[1].data == "100x30");
+  REQUIRE(cast.events[2].time == 1.5);
+
+  std::string v1 = "{\"version\": 1, \"width\": 80, \"height\": 24}\n";
+  REQUIRE(vt100_cast_parse(v1.data(), v1.size(), &cast) == -1);
+  std::string truncated = str + "[2.0, \"o\", \"cut off";
+  REQUIRE(vt100_cast_parse(truncated.data(), truncated.size(), &cast) == -1);
+}
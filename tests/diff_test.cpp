@@ -0,0 +1,85 @@
+#include "../fuzz/vt100_diff.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+
+/* Fragments that random inputs are assembled from */
+static const char *fragments[] = {
+    "text",       " ",           "\n",          "\x1b[0m",     "\x1b[m",
+    "\x1b[1m",    "\x1b[2m",     "\x1b[22m",    "\x1b[1;2m",   "\x1b[3;4m",
+    "\x1b[4:3m",  "\x1b[21m",    "\x1b[24m",    "\x1b[5;6m",   "\x1b[25m",
+    "\x1b[7;8m",  "\x1b[27;28m", "\x1b[31m",    "\x1b[39m",    "\x1b[44m",
+    "\x1b[49m",   "\x1b[91m",    "\x1b[103m",   "\x1b[38;5;",  "196m",
+    "\x1b[48;5;21m", "\x1b[38;2;1;2;3m", "\x1b[48:2::4:5:6m", "\x1b[58;5;9m",
+    "\x1b[59m",   "\x1b[38;5;300m", "\x1b[",     ";",           ":",
+    "\x1b[2K",    "\x1b[H",      "\x1b]0;title\x07", "\x1b]8;;http://a\x1b\\",
+    "\x1b]8;;\x1b\\", "\x1b]8;;x\x07", "\x1bP1$r\x1b\\", "\x1b(B", "\x1b",
+    "\xc3\xa9",   "\xe2\x94\x80", "\x07",      "\r",
+};
+
+static std::string random_input(uint32_t &seed) {
+  std::string out;
+  int n = 1 + (seed >> 8) % 24;
+  for (int i = 0; i < n; i++) {
+    seed = seed * 1103515245 + 12345;
+    out += fragments[(seed >> 8) % (sizeof(fragments) / sizeof(*fragments))];
+  }
+  return out;
+}
+
+static char *encode_cached(struct vt100_node_t *head) {
+  struct vt100_styles_t *styles = vt100_styles_new();
+  global_sgr_cache = vt100_sgr_cache_new(styles, 16);
+  char *out = vt100_encode(head);
+  vt100_sgr_cache_free(global_sgr_cache);
+  global_sgr_cache = NULL;
+  vt100_styles_free(styles);
+  return out;
+}
+
+TEST_CASE("encoding round-trips through the decoder", "[vt100_diff]") {
+  uint32_t seed = 1;
+  for (int i = 0; i < 3000; i++) {
+    std::string input = random_input(seed);
+    INFO(input);
+    REQUIRE(vt100_diff_roundtrip(input.c_str()) == "");
+  }
+}
+
+TEST_CASE("strip matches the decoder", "[vt100_diff]") {
+  uint32_t seed = 2;
+  for (int i = 0; i < 3000; i++) {
+    std::string input = random_input(seed);
+    INFO(input);
+    REQUIRE(vt100_diff_strip(input.c_str()) == "");
+  }
+}
+
+TEST_CASE("cached encoding matches the reference", "[vt100_diff]") {
+  uint32_t seed = 3;
+  for (int i = 0; i < 3000; i++) {
+    std::string input = random_input(seed);
+    INFO(input);
+    vt100_diff_reset();
+    auto head = vt100_decode(input.c_str());
+    REQUIRE(vt100_diff_encoder(head, encode_cached) == "");
+
+    char *expected = vt100_encode(head), *actual = encode_cached(head);
+    REQUIRE(std::string(expected) == actual);
+    free(expected);
+    free(actual);
+    vt100_free(head);
+  }
+}
+
+TEST_CASE("the differential check reports differences", "[vt100_diff]") {
+  auto lossy = [](struct vt100_node_t *head) -> char * {
+    std::string text;
+    for (auto tmp = head; tmp != NULL; tmp = tmp->next)
+      text += tmp->str;
+    return strdup(text.c_str());
+  };
+  vt100_diff_reset();
+  auto head = vt100_decode("a\x1b[31mb");
+  REQUIRE(vt100_diff_encoder(head, lossy) == "attributes differ at byte 1");
+  vt100_free(head);
+}
@@ -0,0 +1,72 @@
+#define VT100UTILS_INSTRUMENT
+#include "../vt100utils.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("instrumentation counts library work", "[vt100_stats]") {
+  vt100_stats_snapshot(1);
+
+  auto head = vt100_decode("a\x1b[31mb\x1b[32;5;999mc");
+  char *out = vt100_encode(head);
+  struct vt100_stats_t stats = vt100_stats_snapshot(1);
+
+  REQUIRE(stats.decode_bytes == strlen("a\x1b[31mb\x1b[32;5;999mc"));
+  REQUIRE(stats.decode.calls == 1);
+  REQUIRE(stats.nodes == 3);
+  REQUIRE(stats.parse.calls == 2);
+  REQUIRE(stats.parse_aborts == 0);
+  REQUIRE(stats.encode.calls == 1);
+  REQUIRE(stats.encode_bytes == strlen(out));
+  REQUIRE(stats.sgr.calls == 3);
+  REQUIRE(stats.sgr_bytes > 0);
+  REQUIRE(stats.sgr_bytes < stats.encode_bytes);
+  REQUIRE(stats.allocs >= stats.nodes);
+  REQUIRE(vt100_stats_snapshot(0).nodes == 0);
+
+  struct vt100_node_t node = {};
+  vt100_parse(&node, "\x1b[38;5;999m");
+  REQUIRE(vt100_stats_snapshot(0).parse_aborts == 1);
+
+  free(out);
+  vt100_free(head);
+}
+
+TEST_CASE("every thread's counts are summed", "[vt100_stats]") {
+  std::vector<std::thread> threads;
+
+  vt100_stats_snapshot(1);
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([] {
+      for (int j = 0; j < 100; j++)
+        vt100_free(vt100_decode("a\x1b[31mb"));
+    });
+  }
+  /* Read while the threads count */
+  for (int i = 0; i < 100; i++)
+    REQUIRE(vt100_stats_snapshot(0).decode.calls <= 400);
+  for (auto &thread : threads)
+    thread.join();
+
+  /* Kept after the threads exit */
+  struct vt100_stats_t stats = vt100_stats_snapshot(1);
+  REQUIRE(stats.decode.calls == 400);
+  REQUIRE(stats.nodes == 800);
+  REQUIRE(vt100_stats_snapshot(0).decode.calls == 0);
+}
+
+TEST_CASE("stats export as JSON", "[vt100_stats]") {
+  struct vt100_stats_t stats = {};
+  stats.nodes = 3;
+  stats.decode = {2, 1500};
+
+  char buf[512];
+  int len = vt100_stats_json(&stats, buf, sizeof(buf));
+  REQUIRE(len == (int)strlen(buf));
+  std::string json(buf);
+  REQUIRE(json.starts_with("{\"nodes\":3,"));
+  REQUIRE(json.find("\"decode\":{\"calls\":2,\"ns\":1500}") !=
+          std::string::npos);
+  REQUIRE(json.ends_with("\"frame\":{\"calls\":0,\"ns\":0}}"));
+}
@@ -0,0 +1,101 @@
+#include "../vt100mux.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::string job_log(int stream, int lines) {
+  std::string out;
+  for (int i = 0; i < lines; i++) {
+    out += "\x1b[3" + std::to_string(1 + (stream + i) % 7) + "m[" +
+           std::to_string(i) + "]\x1b[0m stream " + std::to_string(stream) +
+           (i % 5 ? "\r\n" : "\r\x1b[2Kredrawn\r\n");
+  }
+  return out;
+}
+
+static std::string screen_text(std::string_view str, int cols, int rows) {
+  auto screen = vt100_screen_new(cols, rows, 100);
+  vt100_screen_feed(screen, str.data(), str.size());
+  char *out = vt100_screen_encode(screen, 0, 0);
+  std::string text(out);
+  free(out);
+  vt100_screen_free(screen);
+  return text;
+}
+
+TEST_CASE("mux decodes streams like a single screen", "[vt100_mux]") {
+  auto mux = vt100_mux_new(4);
+  std::vector<struct vt100_stream_t *> streams;
+  std::vector<std::thread> writers;
+  const int n = 64;
+
+  for (int i = 0; i < n; i++)
+    streams.push_back(vt100_mux_open(mux, 40, 10, 100));
+
+  /* Each writer owns a quarter of the streams, and splits their logs at
+   *   awkward places, including inside escape sequences */
+  for (int w = 0; w < 4; w++) {
+    writers.emplace_back([&, w] {
+      for (int i = w; i < n; i += 4) {
+        std::string str = job_log(i, 50);
+        for (size_t pos = 0, len; pos < str.size(); pos += len) {
+          len = 1 + (pos * 7 + i) % 23;
+          vt100_mux_write(mux, streams[i], str.data() + pos,
+                          std::min(len, str.size() - pos));
+        }
+      }
+    });
+  }
+  for (auto &writer : writers)
+    writer.join();
+  vt100_mux_flush(mux);
+
+  int mismatched = 0;
+  for (int i = 0; i < n; i++) {
+    auto snapshot = vt100_mux_snapshot(streams[i]);
+    std::string str = job_log(i, 50);
+    mismatched += !snapshot || snapshot->bytes != str.size() ||
+                  snapshot->text != screen_text(str, 40, 10);
+  }
+  REQUIRE(mismatched == 0);
+
+  vt100_mux_free(mux);
+}
+
+TEST_CASE("mux only touches streams with new output", "[vt100_mux]") {
+  auto mux = vt100_mux_new(2);
+  std::vector<struct vt100_stream_t *> changed;
+  std::atomic<int> notifications = 0;
+  int notified;
+
+  mux->notify = [](void *data) { (*(std::atomic<int> *)data)++; };
+  mux->notify_data = &notifications;
+
+  auto idle = vt100_mux_open(mux, 20, 2, 0);
+  auto busy = vt100_mux_open(mux, 20, 2, 0);
+
+  vt100_mux_write(mux, busy, "\x1b[1mbuild", 9);
+  vt100_mux_write(mux, busy, "ing\r\ndone", 9);
+  vt100_mux_flush(mux);
+
+  REQUIRE(vt100_mux_snapshot(idle) == nullptr);
+  REQUIRE(vt100_mux_snapshot(busy)->text.find("building") !=
+          std::string::npos);
+  REQUIRE(vt100_mux_snapshot(busy)->bytes == 18);
+
+  /* One notification until the changes are collected */
+  REQUIRE(notifications == 1);
+  notified = vt100_mux_changed(
+      mux, [&](struct vt100_stream_t *s) { changed.push_back(s); });
+  REQUIRE(notified == 1);
+  REQUIRE(changed[0] == busy);
+  REQUIRE(vt100_mux_changed(mux, [](struct vt100_stream_t *) {}) == 0);
+
+  vt100_mux_write(mux, busy, "!", 1);
+  vt100_mux_flush(mux);
+  REQUIRE(notifications == 2);
+  REQUIRE(vt100_mux_snapshot(busy)->text.find("done!") != std::string::npos);
+
+  vt100_mux_free(mux);
+}
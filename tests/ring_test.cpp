@@ -0,0 +1,103 @@
+#include "../vt100ring.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <thread>
+
+TEST_CASE("ring is first in, first out", "[vt100_ring]") {
+  auto ring = vt100_ring_new(3);
+  struct vt100_batch_t batch;
+
+  REQUIRE(ring->mask == 3);
+  REQUIRE(vt100_ring_pop(ring, &batch) == 0);
+
+  for (size_t i = 0; i < 4; i++)
+    REQUIRE(vt100_ring_push(ring, {NULL, i, NULL}) == 1);
+  REQUIRE(vt100_ring_push(ring, {NULL, 4, NULL}) == 0);
+  REQUIRE(ring->stalls == 1);
+
+  for (size_t i = 0; i < 4; i++) {
+    REQUIRE(vt100_ring_pop(ring, &batch) == 1);
+    REQUIRE(batch.bytes == i);
+  }
+  REQUIRE(vt100_ring_pop(ring, &batch) == 0);
+
+  /* Still in order once the counters wrap around the slots */
+  for (size_t i = 0; i < 10; i++) {
+    REQUIRE(vt100_ring_push(ring, {NULL, i, NULL}) == 1);
+    REQUIRE(vt100_ring_pop(ring, &batch) == 1);
+    REQUIRE(batch.bytes == i);
+  }
+
+  /* Batches left over are freed with the ring */
+  vt100_ring_push(ring, {vt100_decode("\x1b[31mleft over"), 0, NULL});
+  vt100_ring_free(ring);
+}
+
+static void wake(void *data) { (*(int *)data)++; }
+
+TEST_CASE("ring only wakes an idle consumer", "[vt100_ring]") {
+  auto ring = vt100_ring_new(8);
+  struct vt100_batch_t batch;
+  int wakes = 0;
+
+  ring->wake = wake;
+  ring->wake_data = &wakes;
+
+  vt100_ring_push(ring, {NULL, 0, NULL});
+  REQUIRE(wakes == 0);
+
+  /* Not idle while there is something to pop */
+  REQUIRE(vt100_ring_idle(ring) == 0);
+  vt100_ring_pop(ring, &batch);
+
+  REQUIRE(vt100_ring_idle(ring) == 1);
+  vt100_ring_push(ring, {NULL, 1, NULL});
+  vt100_ring_push(ring, {NULL, 2, NULL});
+  REQUIRE(wakes == 1);
+
+  vt100_ring_close(ring);
+  REQUIRE(wakes == 2);
+  REQUIRE(vt100_ring_closed(ring));
+  REQUIRE(vt100_ring_idle(ring) == 0);
+  vt100_ring_free(ring);
+}
+
+TEST_CASE("ring carries batches decoded on another thread",
+          "[vt100_ring]") {
+  auto ring = vt100_ring_new(4);
+  struct vt100_batch_t batch;
+  const int n = 2000;
+  int received = 0, ordered = 1, styled = 1;
+  struct vt100_color_t fg = global_fg;
+
+  /* A small ring, so the producer regularly has to wait */
+  std::thread producer([ring] {
+    for (int i = 0; i < n; i++) {
+      std::string line = "\x1b[" + std::to_string(31 + i % 7) + "m" +
+                         std::to_string(i) + "\n";
+      vt100_ring_push_wait(ring, {vt100_decode(line.c_str()),
+                                  line.size(), (void *)(intptr_t)i});
+    }
+    vt100_ring_close(ring);
+  });
+
+  while (vt100_ring_wait(ring)) {
+    while (vt100_ring_pop(ring, &batch)) {
+      struct vt100_node_t *text = batch.head->next;
+      ordered &= (intptr_t)batch.data == received;
+      styled &= text->fg.value == (uint32_t)(1 + received % 7) &&
+                std::string(text->str) == std::to_string(received) + "\n";
+      vt100_free(batch.head);
+      received++;
+    }
+  }
+  producer.join();
+
+  REQUIRE(received == n);
+  REQUIRE(ordered);
+  REQUIRE(styled);
+
+  /* Decoding on the producer left this thread's graphics state alone */
+  REQUIRE(global_fg.value == fg.value);
+  vt100_ring_free(ring);
+}
@@ -0,0 +1,254 @@
+#include "../vt100screen.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+
+static std::string text(struct vt100_screen_t *screen, int history = 0) {
+  char *out = vt100_screen_encode(screen, history, 1);
+  std::string s(out);
+  free(out);
+  return s;
+}
+
+static void feed(struct vt100_screen_t *screen, std::string_view str) {
+  vt100_screen_feed(screen, str.data(), str.size());
+}
+
+TEST_CASE("carriage returns overwrite progress output", "[vt100_screen]") {
+  auto screen = vt100_screen_new(20, 3, 0);
+
+  feed(screen, "[  0%] building\r[ 50%] building\r\x1b[2K[100%] done\r\n$ ");
+  REQUIRE(text(screen) == "[100%] done\n$\n");
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("cursor movement and erase", "[vt100_screen]") {
+  auto screen = vt100_screen_new(10, 3, 0);
+
+  feed(screen, "aaaaaaaaaa\r\nbbbbbbbbbb\r\ncccccccccc");
+  feed(screen, "\x1b[2;3H\x1b[K\x1b[1;1H\x1b[2X\x1b[3;5H\x1b[1K");
+  REQUIRE(text(screen) == "  aaaaaaaa\nbb\n     ccccc");
+
+  feed(screen, "\x1b[2J\x1b[H\x1b[3Cx\x1b[Bq\x1b[2Dz");
+  REQUIRE(text(screen) == "   x\n   zq\n");
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("wrapping and scrollback", "[vt100_screen]") {
+  auto screen = vt100_screen_new(4, 2, 2);
+
+  feed(screen, "abcdefgh");
+  REQUIRE(text(screen) == "abcd\nefgh");
+  REQUIRE(screen->wrap_pending);
+
+  feed(screen, "ij\r\nkl\r\nmn");
+  REQUIRE(text(screen) == "kl\nmn");
+  REQUIRE(screen->history->count == 2);
+  REQUIRE(text(screen, 1) == "efgh\nij\nkl\nmn");
+
+  feed(screen, "\x1b[?7l\x1b[H123456");
+  REQUIRE(text(screen) == "1236\nmn");
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("scroll regions", "[vt100_screen]") {
+  auto screen = vt100_screen_new(3, 4, 10);
+
+  feed(screen, "a\r\nb\r\nc\r\nd\x1b[2;3r\x1b[3;1H\n\nx");
+  REQUIRE(text(screen) == "a\n\nx\nd");
+  REQUIRE(screen->history->count == 0);
+
+  feed(screen, "\x1b[2;1H\x1bM\x1bMy");
+  REQUIRE(text(screen) == "a\ny\n\nd");
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("inserted and deleted lines", "[vt100_screen]") {
+  auto screen = vt100_screen_new(5, 3, 10);
+
+  /* Deleted from the top row, which must not save them */
+  feed(screen, "one\r\ntwo\r\nthree\x1b[H\x1b[2M");
+  REQUIRE(text(screen) == "three\n\n");
+  REQUIRE(screen->history->count == 0);
+
+  feed(screen, "\x1b[Lnew");
+  REQUIRE(text(screen) == "new\nthree\n");
+  REQUIRE(screen->history->count == 0);
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("attributes, UTF-8, and split sequences", "[vt100_screen]") {
+  auto screen = vt100_screen_new(8, 1, 0);
+
+  feed(screen, "\x1b[3");
+  feed(screen, "1mr\xc3");
+  feed(screen, "\xa9\x1b[0mn");
+  REQUIRE(text(screen) == "r\xc3\xa9n");
+  auto cell = screen->lines[0];
+  REQUIRE(vt100_style_attr(screen->styles, cell[0].style).fg ==
+          vt100_pack_color({palette_8, 1}));
+  REQUIRE(cell[1].ch == 0xe9);
+  REQUIRE(cell[1].style == cell[0].style);
+  REQUIRE(cell[2].style == 0);
+
+  char *out = vt100_screen_encode(screen, 0, 0);
+  REQUIRE(std::string_view(out).starts_with("\x1b[31;49;"));
+  free(out);
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("alternate screen", "[vt100_screen]") {
+  auto screen = vt100_screen_new(5, 2, 0);
+
+  feed(screen, "main\x1b[?1049h\x1b[Halt");
+  REQUIRE(text(screen) == "alt\n");
+  feed(screen, "\x1b[?1049l!");
+  REQUIRE(text(screen) == "main!\n");
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("erased cells keep the background color", "[vt100_screen]") {
+  auto screen = vt100_screen_new(4, 2, 0);
+
+  feed(screen, "\x1b[1;31;44mab\x1b[K");
+  auto row = screen->lines[0];
+  REQUIRE(row[0].style == row[1].style);
+  REQUIRE(row[2].style != row[0].style);
+  REQUIRE(row[2].style != 0);
+
+  auto attr = vt100_style_attr(screen->styles, row[2].style);
+  REQUIRE(attr.bg == vt100_pack_color({palette_8, 4}));
+  REQUIRE(attr.fg == vt100_pack_color(default_fg));
+  REQUIRE(attr.mode == 0);
+
+  vt100_screen_free(screen);
+}
+
+/* A different truecolor foreground for each i */
+static std::string rgb(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "\x1b[38;2;%i;%i;%im", i >> 16, (i >> 8) & 0xff,
+           i & 0xff);
+  return buf;
+}
+
+TEST_CASE("a full style table is rebuilt from the cells using it",
+          "[vt100_screen]") {
+  auto screen = vt100_screen_new(8, 2, 10000);
+  std::string str;
+
+  /* Enough history that its older pages are compressed */
+  for (int i = 0; i < 5000; i++)
+    str += "\x1b[31mred\x1b[0m\r\n";
+  /* Then more colors than there are ids, each overwriting the last */
+  for (int i = 0; i < 70000; i++)
+    str += "\x1b[2;1H" + rgb(i) + "x";
+  feed(screen, str);
+
+  REQUIRE(screen->style_misses == 0);
+  REQUIRE(screen->styles->count < 5000);
+  REQUIRE(screen->history->pages[0].data == NULL);
+
+  struct vt100_cell_t *line = vt100_screen_history(screen, 0);
+  REQUIRE(line[0].ch == 'r');
+  REQUIRE(vt100_style_attr(screen->styles, line[0].style).fg ==
+          vt100_pack_color({palette_8, 1}));
+  REQUIRE(vt100_style_attr(screen->styles, screen->lines[1][0].style).fg ==
+          vt100_pack_color({truecolor, 69999}));
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("styles that don't fit are counted", "[vt100_screen]") {
+  auto screen = vt100_screen_new(300, 240, 0);
+  std::string str;
+
+  for (int i = 0; i < 70000; i++)
+    str += rgb(i) + "x";
+  feed(screen, str);
+
+  /* Every cell is still shown, so no id can be freed */
+  REQUIRE(screen->style_misses == 70000 - (UINT16_MAX - 1));
+  REQUIRE(vt100_style_attr(screen->styles, screen->lines[0][1].style).fg ==
+          vt100_pack_color({truecolor, 1}));
+  REQUIRE(screen->lines[69999 / 300][69999 % 300].style == 0);
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("sequences too long to keep are skipped to their end",
+          "[vt100_screen]") {
+  auto screen = vt100_screen_new(20, 2, 0);
+  std::string url = "\x1b]8;;http://x/" + std::string(6000, 'u');
+
+  /* Reaching the limit within one call, ended by ST in the next */
+  feed(screen, "a" + url.substr(0, 5000));
+  feed(screen, url.substr(5000));
+  feed(screen, "\x1b");
+  feed(screen, "\\b");
+  REQUIRE(text(screen) == "ab\n");
+
+  /* Reaching it a little at a time, ended by BEL */
+  for (size_t i = 0; i < url.size(); i += 1000)
+    feed(screen, url.substr(i, 1000));
+  feed(screen, "\ac");
+  REQUIRE(text(screen) == "abc\n");
+
+  /* An ESC within a DCS string doesn't end it, nor does BEL */
+  feed(screen, "\x1bP" + std::string(5000, 'q') + "\x1b" + "x\a");
+  feed(screen, std::string(100, 'q') + "\x1b\\d");
+  REQUIRE(text(screen) == "abcd\n");
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("wide characters take two cells", "[vt100_screen]") {
+  auto screen = vt100_screen_new(6, 3, 2);
+
+  /* The third doesn't fit in the last column, so wraps early */
+  feed(screen, "a\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e");
+  REQUIRE(text(screen) == "a\xe6\x97\xa5\xe6\x9c\xac\n\xe8\xaa\x9e\n");
+  REQUIRE(screen->lines[0][1].ch == 0x65e5);
+  REQUIRE(screen->lines[0][2].ch == 0);
+  REQUIRE(screen->x == 2);
+
+  /* Overwriting either half blanks the other */
+  feed(screen, "\x1b[1;3Hx\x1b[1;4Hy");
+  REQUIRE(text(screen) == "a xy\n\xe8\xaa\x9e\n");
+
+  /* Ending in the last column defers the wrap */
+  feed(screen, "\x1b[3;5H\xe8\xaa\x9e");
+  REQUIRE(screen->x == 5);
+  feed(screen, "z");
+  REQUIRE(text(screen, 1) ==
+          "a xy\n\xe8\xaa\x9e\n    \xe8\xaa\x9e\nz");
+
+  vt100_screen_free(screen);
+}
+
+TEST_CASE("combining marks join the character before",
+          "[vt100_screen]") {
+  auto screen = vt100_screen_new(10, 2, 2);
+
+  feed(screen, "e\xcc\x81\xcc\xa3x \xe6\x97\xa5\xcc\x81!");
+  REQUIRE(text(screen) == "e\xcc\x81\xcc\xa3x \xe6\x97\xa5\xcc\x81!\n");
+  REQUIRE(screen->x == 6);
+
+  /* Clusters are shared, and survive the scrollback */
+  feed(screen, "\r\ne\xcc\x81\xcc\xa3\r\n\r\n");
+  REQUIRE(screen->clusters->count == 3);
+  REQUIRE(text(screen, 1) == "e\xcc\x81\xcc\xa3x \xe6\x97\xa5\xcc\x81!\n"
+                             "e\xcc\x81\xcc\xa3\n\n");
+
+  /* A mark with nothing before it is dropped */
+  feed(screen, "\xcc\x81q");
+  REQUIRE(text(screen) == "\nq");
+
+  vt100_screen_free(screen);
+}
@@ -0,0 +1,88 @@
+#include "../vt100scrollback.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <vector>
+
+static std::vector<struct vt100_cell_t> line(std::string_view text,
+                                             uint16_t style) {
+  std::vector<struct vt100_cell_t> cells;
+  for (char c : text)
+    cells.push_back({(uint32_t)c, style});
+  return cells;
+}
+
+TEST_CASE("lz round trip", "[vt100_lz]") {
+  std::string src;
+  for (int i = 0; i < 2000; i++)
+    src += "[" + std::to_string(i % 97) + "%] Building CXX object x.o\n";
+  src += "tail";
+
+  std::vector<char> z(vt100_lz_bound(src.size())), out(src.size());
+  int n = vt100_lz_compress(src.data(), src.size(), z.data());
+  REQUIRE(n < (int)src.size() / 4);
+  REQUIRE(vt100_lz_decompress(z.data(), n, out.data()) == (int)src.size());
+  REQUIRE(std::string_view(out.data(), out.size()) == src);
+
+  std::string tiny = "abc";
+  n = vt100_lz_compress(tiny.data(), tiny.size(), z.data());
+  REQUIRE(vt100_lz_decompress(z.data(), n, out.data()) == 3);
+  REQUIRE(std::string_view(out.data(), 3) == "abc");
+}
+
+TEST_CASE("scrollback keeps the most recent lines", "[vt100_scrollback]") {
+  auto sb = vt100_scrollback_new(3);
+
+  for (int i = 0; i < 5; i++) {
+    auto cells = line("line " + std::to_string(i), i);
+    vt100_scrollback_push(sb, cells.data(), cells.size());
+  }
+
+  REQUIRE(sb->count == 3);
+  auto l = vt100_scrollback_get(sb, 0);
+  REQUIRE(std::string_view(l.text, l.len) == "line 2");
+  REQUIRE(l.nruns == 1);
+  REQUIRE(l.runs[0].style == 2);
+
+  struct vt100_cell_t cells[8];
+  REQUIRE(vt100_scrollback_cells(sb, 2, cells, 8) == 6);
+  REQUIRE(cells[5].ch == '4');
+  REQUIRE(cells[5].style == 4);
+  REQUIRE(cells[6].ch == ' ');
+  REQUIRE(cells[6].style == 0);
+
+  vt100_scrollback_free(sb);
+}
+
+TEST_CASE("scrollback compresses old pages", "[vt100_scrollback]") {
+  auto sb = vt100_scrollback_new(100000);
+  size_t text = 0;
+
+  for (int i = 0; i < 100000; i++) {
+    auto cells = line("[" + std::to_string(i % 100) + "%] compiling file_" +
+                          std::to_string(i) + ".cpp ",
+                      0);
+    auto rest = line("x done", 2);
+    rest[0].ch = 0x2713;
+    cells.insert(cells.end(), rest.begin(), rest.end());
+    vt100_scrollback_push(sb, cells.data(), cells.size());
+    text += cells.size() + 2;
+  }
+
+  size_t stored = 0;
+  for (int i = 0; i < sb->npages; i++)
+    stored += sb->pages[i].data ? VT100_SB_PAGE_SIZE : sb->pages[i].z_len;
+  REQUIRE(stored < text);
+  REQUIRE(sb->pages[0].data == NULL);
+
+  auto l = vt100_scrollback_get(sb, 12345);
+  REQUIRE(std::string_view(l.text, l.len) ==
+          "[45%] compiling file_12345.cpp \xe2\x9c\x93 done");
+  REQUIRE(l.nruns == 2);
+
+  struct vt100_cell_t cells[64];
+  vt100_scrollback_cells(sb, 99999, cells, 64);
+  REQUIRE(cells[31].ch == 0x2713);
+  REQUIRE(cells[32].ch == ' ');
+
+  vt100_scrollback_free(sb);
+}
@@ -0,0 +1,158 @@
+#include "../vt100segment.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <vector>
+
+typedef const char *(*next_func)(const char *, const char *);
+
+static std::vector<std::string> split(std::string_view str, next_func next) {
+  std::vector<std::string> out;
+  const char *end = str.data() + str.size();
+
+  for (const char *p = str.data(), *q; p < end; p = q) {
+    q = next(p, end);
+    out.emplace_back(p, q);
+  }
+  return out;
+}
+
+static const char *line_next(const char *str, const char *end) {
+  int mandatory;
+  return vt100_line_next(str, end, &mandatory);
+}
+
+using strings = std::vector<std::string>;
+
+TEST_CASE("grapheme clusters", "[vt100_segment]") {
+  REQUIRE(split("ab\r\nc\n", vt100_grapheme_next) ==
+          strings{"a", "b", "\r\n", "c", "\n"});
+  /* Combining marks, and marks after a control */
+  REQUIRE(split("e\xcc\x81\xcc\xa3x\t\xcc\x81", vt100_grapheme_next) ==
+          strings{"e\xcc\x81\xcc\xa3", "x", "\t", "\xcc\x81"});
+  /* Hangul jamo, and a syllable with a trailing jamo */
+  REQUIRE(split("\xe1\x84\x80\xe1\x85\xa1\xe1\x86\xa8\xea\xb0\x80\xe1\x86\xa8"
+                "\xea\xb0\x80",
+                vt100_grapheme_next) ==
+          strings{"\xe1\x84\x80\xe1\x85\xa1\xe1\x86\xa8",
+                  "\xea\xb0\x80\xe1\x86\xa8", "\xea\xb0\x80"});
+  /* Flags are pairs of regional indicators */
+  REQUIRE(split("\xf0\x9f\x87\xaf\xf0\x9f\x87\xb5\xf0\x9f\x87\xab\xf0\x9f\x87"
+                "\xb7\xf0\x9f\x87\xaf",
+                vt100_grapheme_next) ==
+          strings{"\xf0\x9f\x87\xaf\xf0\x9f\x87\xb5",
+                  "\xf0\x9f\x87\xab\xf0\x9f\x87\xb7", "\xf0\x9f\x87\xaf"});
+  /* A family joined by ZWJs, and a skin tone */
+  std::string family = "\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x91\xa9\xe2\x80"
+                       "\x8d\xf0\x9f\x91\xa7";
+  std::string wave = "\xf0\x9f\x91\x8b\xf0\x9f\x8f\xbd";
+  REQUIRE(split(family + wave + "!", vt100_grapheme_next) ==
+          strings{family, wave, "!"});
+  /* ZWJ only joins pictographs */
+  REQUIRE(split("a\xe2\x80\x8d\xf0\x9f\x91\xa7", vt100_grapheme_next) ==
+          strings{"a\xe2\x80\x8d", "\xf0\x9f\x91\xa7"});
+  /* A Devanagari consonant and vowel sign */
+  REQUIRE(split("\xe0\xa4\x95\xe0\xa4\xbe\xe0\xa4\x95", vt100_grapheme_next) ==
+          strings{"\xe0\xa4\x95\xe0\xa4\xbe", "\xe0\xa4\x95"});
+}
+
+TEST_CASE("moving back a grapheme cluster", "[vt100_segment]") {
+  std::string str = "x\r\ne\xcc\x81\xf0\x9f\x87\xaf\xf0\x9f\x87\xb5"
+                    "\xf0\x9f\x87\xab\xf0\x9f\x87\xb7y";
+  const char *start = str.data(), *end = start + str.size();
+  std::vector<const char *> forward, back;
+
+  for (const char *p = start; p < end; p = vt100_grapheme_next(p, end))
+    forward.push_back(p);
+  for (const char *p = end; p > start;)
+    back.insert(back.begin(), p = vt100_grapheme_prev(start, p));
+  REQUIRE(forward == back);
+  REQUIRE(forward.size() == 6);
+}
+
+TEST_CASE("words", "[vt100_segment]") {
+  REQUIRE(split("The quick (\"brown\") fox can't jump 32.3 feet, right?",
+                vt100_word_next) ==
+          strings{"The",   " ",    "quick", " ",    "(",    "\"",
+                  "brown", "\"",   ")",     " ",    "fox",  " ",
+                  "can't", " ",    "jump",  " ",    "32.3", " ",
+                  "feet",  ",",    " ",     "right", "?"});
+  REQUIRE(split("snake_case e-mail 1,000 a.b. end.", vt100_word_next) ==
+          strings{"snake_case", " ", "e", "-", "mail", " ", "1,000", " ",
+                  "a.b", ".", " ", "end", "."});
+  /* Accents, and words in other scripts */
+  REQUIRE(split("na\xc3\xafve cafe\xcc\x81 \xd0\xbc\xd0\xb8\xd1\x80",
+                vt100_word_next) ==
+          strings{"na\xc3\xafve", " ", "cafe\xcc\x81", " ",
+                  "\xd0\xbc\xd0\xb8\xd1\x80"});
+  /* Each ideograph is a word, but katakana run together */
+  REQUIRE(split("\xe6\x97\xa5\xe6\x9c\xac\xe3\x82\xab\xe3\x82\xbf\xe3\x80\x82",
+                vt100_word_next) ==
+          strings{"\xe6\x97\xa5", "\xe6\x9c\xac", "\xe3\x82\xab\xe3\x82\xbf",
+                  "\xe3\x80\x82"});
+  REQUIRE(split("a\r\n\nb", vt100_word_next) ==
+          strings{"a", "\r\n", "\n", "b"});
+
+  std::string str = "can't stop, 2.5";
+  const char *end = str.data() + str.size();
+  strings words;
+  for (const char *p = str.data(), *q; p < end; p = q) {
+    q = vt100_word_next(p, end);
+    if (vt100_is_word(p, q))
+      words.emplace_back(p, q);
+  }
+  REQUIRE(words == strings{"can't", "stop", "2.5"});
+}
+
+TEST_CASE("line breaks", "[vt100_segment]") {
+  REQUIRE(split("The quick (brown) fox.  Jumps!", line_next) ==
+          strings{"The ", "quick ", "(brown) ", "fox.  ", "Jumps!"});
+  REQUIRE(split("well-known $10.50 100% a/b", line_next) ==
+          strings{"well-", "known ", "$10.50 ", "100% ", "a/", "b"});
+  /* Ideographs break anywhere, but not before closing punctuation */
+  REQUIRE(split("\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x80\x82\xe3\x81\x82",
+                line_next) ==
+          strings{"\xe6\x97\xa5", "\xe6\x9c\xac", "\xe8\xaa\x9e\xe3\x80\x82",
+                  "\xe3\x81\x82"});
+  /* No-break spaces glue, and newlines must break */
+  REQUIRE(split("10\xc2\xa0km a\nb", line_next) ==
+          strings{"10\xc2\xa0km ", "a\n", "b"});
+
+  int mandatory;
+  std::string str = "a b\nc";
+  const char *p = str.data(), *end = p + str.size();
+  REQUIRE(vt100_line_next(p, end, &mandatory) == p + 2);
+  REQUIRE(mandatory == 0);
+  REQUIRE(vt100_line_next(p + 2, end, &mandatory) == p + 4);
+  REQUIRE(mandatory == 1);
+}
+
+static strings wrap(std::string_view str, int cols) {
+  const char *end = str.data() + str.size();
+  strings lines;
+  int width;
+
+  for (const char *p = str.data(), *q; p < end; p = q) {
+    q = vt100_wrap(p, end, cols, &width);
+    lines.emplace_back(p, q);
+    REQUIRE(width <= cols);
+  }
+  return lines;
+}
+
+TEST_CASE("wrapping", "[vt100_segment]") {
+  REQUIRE(wrap("the quick brown fox jumps over the lazy dog", 10) ==
+          strings{"the quick ", "brown fox ", "jumps over ", "the lazy ",
+                  "dog"});
+  /* Spaces may hang past the edge, and long words are broken */
+  REQUIRE(wrap("abc   defghijklmnop", 5) ==
+          strings{"abc   ", "defgh", "ijklm", "nop"});
+  REQUIRE(wrap("one\ntwo three", 20) == strings{"one\n", "two three"});
+  /* Wide characters take two columns */
+  REQUIRE(wrap("\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae", 5) ==
+          strings{"\xe6\x97\xa5\xe6\x9c\xac", "\xe8\xaa\x9e\xe3\x81\xae"});
+
+  int width;
+  std::string str = "ab cd";
+  vt100_wrap(str.data(), str.data() + str.size(), 4, &width);
+  REQUIRE(width == 2);
+}
@@ -0,0 +1,59 @@
+#include "../vt100static.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+
+constexpr auto &text =
+    vt100_static<"a\x1b[31mb\x1b[1;38;2;1;2;3mcd\x1b[39;22m\x1b[4:3me">;
+
+static_assert(text.count() == 4);
+static_assert(text.runs[1].fg.type == palette_8 && text.runs[1].fg.value == 1);
+static_assert(text.runs[2].fg.type == truecolor &&
+              text.runs[2].fg.value == 0x010203);
+static_assert(text.runs[3].ul_style == 3);
+
+TEST_CASE("static literals decode like vt100_decode", "[vt100_static]") {
+  const char *src = "a\x1b[31mb\x1b[1;38;2;1;2;3mcd\x1b[39;22m\x1b[4:3me";
+  global_fg = default_fg;
+  global_bg = default_bg;
+  global_ul = default_ul;
+  global_mode = global_ul_style = 0;
+  auto head = vt100_decode(src);
+
+  size_t i = 0;
+  for (auto tmp = head; tmp != NULL; tmp = tmp->next) {
+    if (tmp->len <= 1)
+      continue;
+    REQUIRE(i < text.count());
+    REQUIRE(text.str(i) == tmp->str);
+    REQUIRE(text.runs[i].len == tmp->len);
+    auto node = text.nodes()[i];
+    REQUIRE(vt100_attr_eq(vt100_pack_attr(&node), vt100_pack_attr(tmp)));
+    i++;
+  }
+  REQUIRE(i == text.count());
+  vt100_free(head);
+}
+
+TEST_CASE("static sgr reproduces the run's attributes", "[vt100_static]") {
+  REQUIRE(text.sgr(0) == "\x1b[0m");
+  REQUIRE(text.sgr(1) == "\x1b[0;31m");
+  REQUIRE(text.sgr(2) == "\x1b[0;38;2;1;2;3;1m");
+  REQUIRE(text.sgr(3) == "\x1b[0;4:3m");
+}
+
+TEST_CASE("build styled literals at compile time", "[vt100_static]") {
+  constexpr auto built = vt100_static_build<64>({
+      {.str = "plain "},
+      {.str = "bold", .fg = {palette_256, 100}, .mode = 1},
+      {.str = "!", .fg = {palette_256, 100}, .mode = 1},
+      {.str = " link", .bg = {palette_8_bright, 4}},
+  });
+  REQUIRE(std::string(built.str) ==
+          "plain \x1b[0;38;5;100;1mbold!\x1b[0;104m link\x1b[0m");
+
+  /* The result can itself be decoded statically */
+  constexpr auto &runs = vt100_static<built>;
+  REQUIRE(runs.count() == 3);
+  REQUIRE(runs.str(1) == "bold!");
+  REQUIRE(runs.runs[2].bg.type == palette_8_bright);
+}
@@ -0,0 +1,289 @@
+#include "../demos/tui.h"
+#include "../vt100screen.h"
+#include "../vt100ring.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <thread>
+
+/* The screen's text, without graphics */
+static std::string plain(ui_t_headless *term) {
+  std::string text = term->text(), out;
+  char *buf = (char *)malloc(text.size() + 1);
+  size_t len = vt100_strip(text.data(), text.size(), buf, NULL);
+  out.assign(buf, len);
+  free(buf);
+  return out;
+}
+
+TEST_CASE("headless tui draws to its screen", "[tui]") {
+  auto term = new ui_t_headless(40, 10);
+  tui u(0, term);
+
+  REQUIRE(u.cols() == 40);
+  REQUIRE(u.rows() == 10);
+  u.add({3, 2, 20, 2}, [](tui_box) { return "\x1b[31mhello\nworld"; }, {}, {});
+  u.draw();
+
+  REQUIRE(term->writes() == 1);
+  REQUIRE(term->bytes() == u.frame_stats().bytes);
+  REQUIRE(plain(term).find("\n  hello\n  world") != std::string::npos);
+}
+
+static int g_keys = 0;
+
+TEST_CASE("headless tui reads scripted input", "[tui]") {
+  auto term = new ui_t_headless(40, 10);
+  tui u(0, term);
+  int clicks = 0;
+
+  u.add({3, 2, 20, 1},
+        [&](tui_box) { return "clicked " + std::to_string(clicks); },
+        [&](tui_box b, int, int, int) {
+          clicks++;
+          u.invalidate(b);
+          u.draw();
+        },
+        {});
+  u.on_key("k", [] { g_keys++; });
+  u.draw();
+
+  /* Released over the box, then outside it */
+  term->push("\x1b[<0;5;2m");
+  term->push("\x1b[<0;5;5m");
+  term->push("k");
+  term->push("\x1b[<0;3;2m");
+  term->close();
+  u.mainloop();
+
+  REQUIRE(clicks == 2);
+  REQUIRE(g_keys == 1);
+  REQUIRE(plain(term).find("clicked 2") != std::string::npos);
+}
+
+/* A list scrolled by the wheel, and boxes which grow when clicked */
+static std::string session(int clicks) {
+  auto term = new ui_t_headless(60, 20);
+  tui u(0, term);
+  std::vector<int> widths(8, 1);
+  std::vector<tui_box> boxes;
+
+  for (int i = 0; i < 8; i++) {
+    boxes.push_back(u.add(
+        {1 + i * 7, 1, 6, 1},
+        [&, i](tui_box) {
+          return "\x1b[3" + std::to_string(i % 7 + 1) + "m" +
+                 std::string(widths[i], '#');
+        },
+        [&, i](tui_box b, int, int, int) {
+          widths[i] = widths[i] % 6 + 1;
+          u.invalidate(b);
+          u.refresh();
+        },
+        {}));
+  }
+  u.add_list(
+      {1, 3, 60, 16}, 10000,
+      [](size_t i, std::string &out) { out += "row " + std::to_string(i); },
+      {});
+  u.draw();
+
+  for (int k = 0; k < clicks; k++) {
+    term->push("\x1b[<0;" + std::to_string(1 + k * 13 % 56) + ";1m");
+    if (k % 3 == 0)
+      term->push("\x1b[<65;10;5M");
+  }
+  term->close();
+  u.mainloop();
+  return term->text();
+}
+
+TEST_CASE("headless tuis run on many threads at once", "[tui]") {
+  std::string expected = session(200);
+  std::vector<std::string> texts(8);
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < texts.size(); i++)
+    threads.emplace_back([&, i] { texts[i] = session(200); });
+  for (auto &thread : threads)
+    thread.join();
+
+  REQUIRE(expected.find("row 201") != std::string::npos);
+  for (auto &text : texts)
+    REQUIRE(text == expected);
+}
+
+TEST_CASE("a removed box's handle is ignored once its slot is reused",
+          "[tui]") {
+  auto term = new ui_t_headless(40, 10);
+  tui u(0, term);
+
+  tui_box old = u.add({1, 1, 20, 1}, [](tui_box) { return "old"; }, {}, {});
+  u.remove(old);
+  tui_box box = u.add({1, 1, 20, 1}, [](tui_box) { return "new"; }, {}, {});
+  u.draw();
+
+  REQUIRE(box.index == old.index);
+  REQUIRE(!u.valid(old));
+  REQUIRE(u.valid(box));
+  REQUIRE(u.rect(box).w == 20);
+  REQUIRE(u.rect(old).w == 0);
+
+  u.invalidate(old);
+  u.refresh();
+  REQUIRE(u.frame_stats().rebuilt == 0);
+  u.remove(old);
+  REQUIRE(u.valid(box));
+  REQUIRE(plain(term).find("new") != std::string::npos);
+}
+
+/* A headless terminal which also keeps everything written to it */
+struct ui_t_capture : ui_t_headless {
+  std::string out;
+
+  using ui_t_headless::ui_t_headless;
+  int Write(std::string_view str) override {
+    out.append(str);
+    return ui_t_headless::Write(str);
+  }
+};
+
+TEST_CASE("switching back to a screen replays what it showed", "[tui]") {
+  auto term = new ui_t_capture(40, 10);
+  tui u(0, term);
+  std::string text = "first";
+
+  tui_box box = u.add({1, 1, 20, 1}, [&](tui_box) { return text; }, {}, {});
+  u.draw();
+  text = "second";
+  u.invalidate(box);
+  u.refresh();
+  std::string shown = term->out, screen = term->text();
+
+  u.set_screen(1);
+  u.add({1, 1, 20, 1}, [](tui_box) { return "other"; }, {}, {});
+  u.draw();
+  REQUIRE(plain(term).find("other") != std::string::npos);
+
+  size_t at = term->out.size();
+  u.set_screen(0);
+  REQUIRE(term->out.substr(at) == shown);
+  REQUIRE(u.frame_stats().rebuilt == 0);
+  REQUIRE(term->text() == screen);
+}
+
+TEST_CASE("a tween finishes at its target", "[tui]") {
+  auto term = new ui_t_headless(40, 10);
+  tui u(0, term);
+  int x = 0, calls = 0;
+  double last = -1;
+
+  u.set_frame_ms(1);
+  u.add({1, 1, 20, 1}, [&](tui_box) { return "x=" + std::to_string(x); },
+        [&](tui_box b, int, int, int) {
+          u.animate(20, [&, b](double t) {
+            calls++;
+            last = t;
+            x = tui_lerp(0, 50, t);
+            u.invalidate(b);
+          });
+        },
+        {});
+  u.draw();
+
+  /* mainloop returns once the tween the click starts has finished */
+  term->push("\x1b[<0;2;2m");
+  term->close();
+  u.mainloop();
+
+  REQUIRE(calls > 1);
+  REQUIRE(last == 1);
+  REQUIRE(x == 50);
+  REQUIRE(plain(term).find("x=50") != std::string::npos);
+}
+
+TEST_CASE("a click goes to the boxes under it when it happens", "[tui]") {
+  auto term = new ui_t_headless(40, 10);
+  tui u(0, term);
+  tui_flow *flow = u.add_flow({1, 1, 40, 5}, 0, 0);
+  std::string first = "wide ";
+  int clicks[2] = {0, 0};
+
+  /* Clicking the first box shrinks it, moving the second under the mouse */
+  u.add(flow, [&](tui_box) { return first; },
+        [&](tui_box b, int, int, int) {
+          clicks[0]++;
+          first = "a ";
+          u.invalidate(b);
+          u.draw();
+        },
+        {});
+  u.add(flow, [](tui_box) { return "b"; },
+        [&](tui_box, int, int, int) { clicks[1]++; }, {});
+  u.draw();
+
+  term->push("\x1b[<0;3;1m");
+  term->close();
+  u.mainloop();
+
+  REQUIRE(clicks[0] == 1);
+  REQUIRE(clicks[1] == 0);
+}
+
+TEST_CASE("batches from the feed repaint only the boxes they invalidate",
+          "[tui]") {
+  auto term = new ui_t_headless(40, 10);
+  tui u(0, term);
+  struct vt100_ring_t *ring = vt100_ring_new(4);
+  std::string text = "before";
+  tui_frame_stats last = {};
+
+  tui_box box = u.add({1, 1, 20, 1}, [&](tui_box) { return text; }, {}, {});
+  u.add({1, 3, 20, 1}, [](tui_box) { return "unchanged"; }, {}, {});
+  u.draw();
+  u.on_frame([&](const tui_frame_stats &stats) { last = stats; });
+  u.feed(ring, [&](vt100_batch_t &batch) {
+    vt100_free(batch.head);
+    text = "after";
+    u.invalidate(box);
+  });
+
+  REQUIRE(vt100_ring_push(ring, {vt100_decode("x"), 1, NULL}));
+  term->push("k");
+  term->close();
+  u.mainloop();
+  vt100_ring_free(ring);
+
+  REQUIRE(last.batches == 1);
+  REQUIRE(last.boxes == 1);
+  REQUIRE(plain(term).find("after") != std::string::npos);
+  REQUIRE(plain(term).find("unchanged") != std::string::npos);
+}
+
+TEST_CASE("a click skips boxes removed by an earlier listener", "[tui]") {
+  auto term = new ui_t_headless(40, 10);
+  tui u(0, term);
+  int clicks[3] = {0, 0, 0};
+  tui_box second, third;
+
+  /* The first box replaces the second, whose slot the third then reuses */
+  u.add({1, 1, 5, 1}, [](tui_box) { return "a"; },
+        [&](tui_box, int, int, int) {
+          clicks[0]++;
+          u.remove(second);
+          third = u.add({1, 1, 5, 1}, [](tui_box) { return "c"; },
+                        [&](tui_box, int, int, int) { clicks[2]++; }, {});
+        },
+        {});
+  second = u.add({1, 1, 5, 1}, [](tui_box) { return "b"; },
+                 [&](tui_box, int, int, int) { clicks[1]++; }, {});
+  u.draw();
+
+  term->push("\x1b[<0;2;1m");
+  term->close();
+  u.mainloop();
+
+  REQUIRE(third.index == second.index);
+  REQUIRE(clicks[0] == 1);
+  REQUIRE(clicks[1] == 0);
+  REQUIRE(clicks[2] == 0);
+}
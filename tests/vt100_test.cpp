@@ -0,0 +1,473 @@
+#include "../vt100utils.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <vector>
+
+static std::string strip(std::string_view src, std::vector<size_t> *map = NULL) {
+  std::string out(src.size(), '\0');
+  if (map)
+    map->resize(src.size());
+  out.resize(vt100_strip(src.data(), src.size(), out.data(),
+                         map ? map->data() : NULL));
+  return out;
+}
+
+TEST_CASE("strip removes escape sequences", "[vt100_strip]") {
+  REQUIRE(strip("plain text") == "plain text");
+  REQUIRE(strip("\x1b[32mHello\x1b[0m world") == "Hello world");
+  REQUIRE(strip("\x1b[38;2;1;2;3mA\x1b[2KB\x1b[?25lC") == "ABC");
+  REQUIRE(strip("\x1b]8;;http://x\x1b\\link\x1b]8;;\x1b\\") == "link");
+  REQUIRE(strip("\x1b]0;title\aafter") == "after");
+  REQUIRE(strip("\x1b(Bx\x1b" "7y") == "xy");
+  REQUIRE(strip("unterminated\x1b[31") == "unterminated");
+  REQUIRE(strip("a\x1b") == "a");
+}
+
+TEST_CASE("strip scans long runs", "[vt100_strip]") {
+  std::string src, expected;
+  for (int i = 0; i < 100; i++) {
+    src += "\x1b[3" + std::to_string(i % 8) + "m" + std::string(i, 'x');
+    expected += std::string(i, 'x');
+  }
+  REQUIRE(strip(src) == expected);
+}
+
+TEST_CASE("strip in place with offset map", "[vt100_strip]") {
+  std::string src = "ab\x1b[1mcd\x1b[0me";
+  std::vector<size_t> map(src.size());
+  size_t n = vt100_strip(src.data(), src.size(), src.data(), map.data());
+
+  REQUIRE(std::string_view(src.data(), n) == "abcde");
+  REQUIRE(map[0] == 0);
+  REQUIRE(map[1] == 1);
+  REQUIRE(map[2] == 6);
+  REQUIRE(map[3] == 7);
+  REQUIRE(map[4] == 12);
+}
+
+TEST_CASE("downsample truecolor and 256 colors", "[vt100_downsample]") {
+  struct vt100_color_t red = {truecolor, 0xff0000},
+                       gray = {truecolor, 0x767676};
+
+  auto c = vt100_downsample(red, depth_256);
+  REQUIRE((c.type == palette_256 && c.value == 196));
+  c = vt100_downsample(gray, depth_256);
+  REQUIRE((c.type == palette_256 && c.value == 243));
+  c = vt100_downsample(red, depth_16);
+  REQUIRE((c.type == palette_8_bright && c.value == 1));
+  c = vt100_downsample(red, depth_8);
+  REQUIRE((c.type == palette_8 && c.value == 1));
+  c = vt100_downsample({palette_256, 46}, depth_16);
+  REQUIRE((c.type == palette_8_bright && c.value == 2));
+  c = vt100_downsample({palette_256, 12}, depth_16);
+  REQUIRE((c.type == palette_8_bright && c.value == 4));
+  c = vt100_downsample({palette_8_bright, 3}, depth_8);
+  REQUIRE((c.type == palette_8 && c.value == 3));
+  c = vt100_downsample(red, depth_truecolor);
+  REQUIRE((c.type == truecolor && c.value == 0xff0000));
+}
+
+TEST_CASE("sgr honors the target color depth", "[vt100_sgr]") {
+  struct vt100_node_t node = {}, prev = {};
+  node.fg = {truecolor, 0xff0000};
+  node.bg = {palette_256, 21};
+  prev = node;
+
+  global_depth = depth_256;
+  char *buf = vt100_sgr(&node, NULL);
+  REQUIRE(std::string_view(buf).starts_with("\x1b[38;5;196;48;5;21;"));
+  free(buf);
+
+  global_depth = depth_mono;
+  buf = vt100_sgr(&node, NULL);
+  REQUIRE(std::string_view(buf).starts_with("\x1b[22;23"));
+  free(buf);
+
+  global_depth = depth_16;
+  prev.fg = {truecolor, 0xfe0000};
+  buf = vt100_sgr(&node, &prev);
+  REQUIRE(std::string_view(buf) == "");
+  free(buf);
+
+  prev.fg = {palette_8, 2};
+  buf = vt100_sgr(&node, &prev);
+  REQUIRE(std::string_view(buf) == "\x1b[91m");
+  free(buf);
+
+  global_depth = depth_truecolor;
+}
+
+static struct vt100_node_t parse(const char *seq) {
+  struct vt100_node_t node = {};
+  global_fg = default_fg;
+  global_bg = default_bg;
+  global_ul = default_ul;
+  global_mode = global_ul_style = 0;
+  vt100_parse(&node, seq);
+  return node;
+}
+
+TEST_CASE("parse individual resets and defaults", "[vt100_parse]") {
+  auto node = parse("\x1b[1;2;3;4;5;7;8;22;23;24;25;27;28m");
+  REQUIRE(node.mode == 0);
+  REQUIRE(node.ul_style == 0);
+
+  node = parse("\x1b[1;3;23m");
+  REQUIRE(node.mode == 1);
+
+  node = parse("\x1b[31;44;39;49m");
+  REQUIRE(node.fg.type == default_color);
+  REQUIRE(node.bg.type == default_color);
+}
+
+TEST_CASE("parse colon subparameters", "[vt100_parse]") {
+  auto node = parse("\x1b[38:2::1:2:3;48:5:200m");
+  REQUIRE((node.fg.type == truecolor && node.fg.value == 0x010203));
+  REQUIRE((node.bg.type == palette_256 && node.bg.value == 200));
+
+  node = parse("\x1b[38:2:4:5:6m");
+  REQUIRE((node.fg.type == truecolor && node.fg.value == 0x040506));
+
+  node = parse("\x1b[4:3;58:2::255:0:0m");
+  REQUIRE(node.ul_style == 3);
+  REQUIRE((node.mode & (1 << 3)));
+  REQUIRE((node.ul.type == truecolor && node.ul.value == 0xff0000));
+
+  node = parse("\x1b[4;58;5;9;59;4:0m");
+  REQUIRE(node.ul_style == 0);
+  REQUIRE((node.mode & (1 << 3)) == 0);
+  REQUIRE(node.ul.type == default_color);
+}
+
+TEST_CASE("parse skips unknown codes without losing later ones",
+          "[vt100_parse]") {
+  auto node = parse("\x1b[53;73:1:2;31m");
+  REQUIRE((node.fg.type == palette_8 && node.fg.value == 1));
+
+  node = parse("\x1b[38;5m");
+  REQUIRE((node.fg.type == default_fg.type &&
+           node.fg.value == default_fg.value));
+}
+
+TEST_CASE("sgr emits underline style and color", "[vt100_sgr]") {
+  auto node = parse("\x1b[4:3;58:5:196m");
+  struct vt100_node_t prev = parse("\x1b[0m");
+
+  char *buf = vt100_sgr(&node, &prev);
+  REQUIRE(std::string_view(buf) == "\x1b[58;5;196;4:3m");
+  free(buf);
+
+  prev = node;
+  node = parse("\x1b[4m");
+  buf = vt100_sgr(&node, &prev);
+  REQUIRE(std::string_view(buf) == "\x1b[59;4m");
+  free(buf);
+}
+
+TEST_CASE("sgr resets only attributes which were set", "[vt100_sgr]") {
+  auto sgr = [](const char *from, const char *to) {
+    struct vt100_node_t prev = parse(from), node = parse(to);
+    char *buf = vt100_sgr(&node, &prev);
+    std::string out(buf);
+    free(buf);
+    return out;
+  };
+
+  REQUIRE(sgr("\x1b[1m", "\x1b[0m") == "\x1b[22m");
+  REQUIRE(sgr("\x1b[0m", "\x1b[1m") == "\x1b[1m");
+  REQUIRE(sgr("\x1b[1;3m", "\x1b[3;7m") == "\x1b[22;7m");
+  /* 22 clears faint as well, which is set again */
+  REQUIRE(sgr("\x1b[1;2m", "\x1b[2m") == "\x1b[22;2m");
+  REQUIRE(sgr("\x1b[5;6;9m", "\x1b[6m") == "\x1b[25;6m");
+  REQUIRE(sgr("\x1b[4:3m", "\x1b[4:2m") == "\x1b[4:2m");
+}
+
+TEST_CASE("classify escape sequences", "[vt100_classify]") {
+  auto classify = [](std::string_view seq) {
+    const char *end = vt100_seq_end(seq.data(), seq.data() + seq.size());
+    REQUIRE(end == seq.data() + seq.size());
+    return vt100_classify(seq.data(), end);
+  };
+
+  REQUIRE(classify("\x1b[1;31m") == seq_sgr);
+  REQUIRE(classify("\x1b[m") == seq_sgr);
+  REQUIRE(classify("\x1b[?1m") == seq_other);
+  REQUIRE(classify("\x1b[10;5H") == seq_cursor);
+  REQUIRE(classify("\x1b[3A") == seq_cursor);
+  REQUIRE(classify("\x1b" "7") == seq_cursor);
+  REQUIRE(classify("\x1b[2K") == seq_erase);
+  REQUIRE(classify("\x1b[J") == seq_erase);
+  REQUIRE(classify("\x1b]8;;http://example.com\x1b\\") == seq_hyperlink);
+  REQUIRE(classify("\x1b]2;title\a") == seq_title);
+  REQUIRE(classify("\x1b]52;c;Zm9v\a") == seq_other);
+  REQUIRE(classify("\x1bPq#0\x1b\\") == seq_other);
+  REQUIRE(classify("\x1b[?25l") == seq_other);
+}
+
+TEST_CASE("decode strips non-SGR sequences", "[vt100_decode]") {
+  global_preserve = 0;
+  auto head = vt100_decode("\x1b[32m[ 50%]\x1b[2K\r\x1b[1Adone\x1b]0;t\a!");
+
+  REQUIRE(std::string_view(head->str) == "");
+  REQUIRE(head->next != NULL);
+  REQUIRE(std::string_view(head->next->str) == "[ 50%]\rdone!");
+  REQUIRE(head->next->len == 13);
+  REQUIRE(head->next->fg.value == 2);
+  REQUIRE(head->next->next == NULL);
+
+  vt100_free(head);
+}
+
+TEST_CASE("decode preserves selected sequences", "[vt100_decode]") {
+  global_preserve = (1 << seq_erase) | (1 << seq_cursor);
+  auto head = vt100_decode("a\x1b[2Kb\x1b[?25lc\x1b[H");
+
+  REQUIRE(std::string_view(head->str) == "a");
+  auto node = head->next;
+  REQUIRE(node->seq == seq_erase);
+  REQUIRE(std::string_view(node->str) == "\x1b[2K");
+  node = node->next;
+  REQUIRE(node->seq == seq_none);
+  REQUIRE(std::string_view(node->str) == "bc");
+  node = node->next;
+  REQUIRE(node->seq == seq_cursor);
+  REQUIRE(node->next == NULL);
+
+  char *out = vt100_encode(head);
+  REQUIRE(std::string_view(out).find("\x1b[2Kbc\x1b[H") != std::string_view::npos);
+  free(out);
+
+  vt100_free(head);
+  global_preserve = 0;
+}
+
+TEST_CASE("decode handles empty and trailing sequences", "[vt100_decode]") {
+  auto head = vt100_decode("");
+  REQUIRE(std::string_view(head->str) == "");
+  REQUIRE(head->next == NULL);
+  vt100_free(head);
+
+  head = vt100_decode("text\x1b[0m");
+  REQUIRE(std::string_view(head->next->str) == "");
+  vt100_free(head);
+}
+
+TEST_CASE("decode interns hyperlinks", "[vt100_decode]") {
+  auto head = vt100_decode(
+      "see \x1b]8;;https://a\x1b\\one\x1b]8;;\x1b\\ and "
+      "\x1b]8;id=2;https://a\atwo\x1b]8;;\x1b\\ or "
+      "\x1b]8;;https://b\x1b\\\x1b[1mthree\x1b]8;;\x1b\\");
+
+  std::vector<std::pair<std::string, std::string>> runs;
+  for (auto tmp = head; tmp != NULL; tmp = tmp->next) {
+    if (tmp->len > 1) {
+      const char *url = vt100_link_url(head, tmp);
+      runs.push_back({tmp->str, url ? url : ""});
+    }
+  }
+
+  REQUIRE(runs.size() == 6);
+  REQUIRE(runs[1] == std::pair<std::string, std::string>("one", "https://a"));
+  REQUIRE(runs[3] == std::pair<std::string, std::string>("two", "https://a"));
+  REQUIRE(runs[5] == std::pair<std::string, std::string>("three", "https://b"));
+  REQUIRE(runs[4].second == "");
+  REQUIRE(vt100_head_links(head)->count == 2);
+
+  char *out = vt100_encode(head);
+  std::string_view encoded(out);
+  REQUIRE(encoded.find("\x1b]8;;https://a\x1b\\") != std::string_view::npos);
+  REQUIRE(encoded.ends_with("three\x1b]8;;\x1b\\"));
+  free(out);
+
+  vt100_free(head);
+}
+
+TEST_CASE("encode only re-emits changed hyperlinks", "[vt100_encode]") {
+  auto head = vt100_decode("\x1b]8;;u\x1b\\a\x1b[31mb\x1b[32mc");
+  char *out = vt100_encode(head);
+  std::string_view encoded(out);
+
+  REQUIRE(encoded.find("\x1b]8;;u") == encoded.rfind("\x1b]8;;u"));
+  free(out);
+  vt100_free(head);
+}
+
+TEST_CASE("encode keeps the terminal's default colors", "[vt100_encode]") {
+  parse("\x1b[0m");
+  auto head = vt100_decode("\x1b[31;44mred\x1b[39;49m def");
+  char *out = vt100_encode(head);
+  std::string_view encoded(out);
+
+  REQUIRE(encoded.find("\x1b[39;49m def") != std::string_view::npos);
+  REQUIRE(encoded.find("37") == std::string_view::npos);
+  free(out);
+  vt100_free(head);
+
+  /* A reset is the same default as 39/49 */
+  head = vt100_decode("\x1b[31;44mred\x1b[0m def");
+  struct vt100_node_t *last = head;
+  while (last->next)
+    last = last->next;
+  REQUIRE(last->fg.type == default_color);
+  REQUIRE(last->bg.type == default_color);
+  out = vt100_encode(head);
+  encoded = out;
+  REQUIRE(encoded.find("\x1b[39;49m def") != std::string_view::npos);
+  REQUIRE(encoded.find("37") == std::string_view::npos);
+  REQUIRE(encoded.find("40") == std::string_view::npos);
+  free(out);
+  vt100_free(head);
+}
+
+TEST_CASE("find the hyperlink at a position", "[vt100_link_at]") {
+  std::string_view str =
+      "\x1b[1mab\x1b]8;;http://x\x1b\\c\xc3\xa9\nd\x1b]8;;\x1b\\e";
+  const char *url;
+  size_t len;
+
+  REQUIRE(vt100_link_at(str.data(), str.size(), 0, 1, &url, &len) == 0);
+  REQUIRE(vt100_link_at(str.data(), str.size(), 0, 3, &url, &len) == 1);
+  REQUIRE(std::string_view(url, len) == "http://x");
+  REQUIRE(vt100_link_at(str.data(), str.size(), 1, 0, &url, &len) == 1);
+  REQUIRE(vt100_link_at(str.data(), str.size(), 1, 1, &url, &len) == 0);
+
+  /* Wide characters take two columns, combining marks none, and empty
+   *   lines no row */
+  str = "\xe6\x97\xa5"
+        "e\xcc\x81\x1b]8;;http://y\x1b\\z\n\nw\x1b]8;;\x1b\\v";
+  REQUIRE(vt100_link_at(str.data(), str.size(), 0, 1, &url, &len) == 0);
+  REQUIRE(vt100_link_at(str.data(), str.size(), 0, 2, &url, &len) == 0);
+  REQUIRE(vt100_link_at(str.data(), str.size(), 0, 3, &url, &len) == 1);
+  REQUIRE(std::string_view(url, len) == "http://y");
+  REQUIRE(vt100_link_at(str.data(), str.size(), 0, 4, &url, &len) == 0);
+  REQUIRE(vt100_link_at(str.data(), str.size(), 1, 0, &url, &len) == 1);
+  REQUIRE(vt100_link_at(str.data(), str.size(), 1, 1, &url, &len) == 0);
+  REQUIRE(vt100_link_at(str.data(), str.size(), 2, 0, &url, &len) == 0);
+}
+
+TEST_CASE("styles are interned", "[vt100_styles]") {
+  auto styles = vt100_styles_new();
+  struct vt100_node_t node = parse("\x1b[0m");
+
+  REQUIRE(vt100_style_intern(styles, vt100_pack_attr(&node)) == 0);
+  node = parse("\x1b[1;31m");
+  uint16_t red = vt100_style_intern(styles, vt100_pack_attr(&node));
+  REQUIRE(red == 1);
+  node = parse("\x1b[32m");
+  REQUIRE(vt100_style_intern(styles, vt100_pack_attr(&node)) == 2);
+  node = parse("\x1b[31;1m");
+  REQUIRE(vt100_style_intern(styles, vt100_pack_attr(&node)) == red);
+
+  for (int i = 0; i < 1000; i++) {
+    node.fg = {truecolor, (uint32_t)i};
+    REQUIRE(vt100_style_intern(styles, vt100_pack_attr(&node)) == 3 + i);
+  }
+  REQUIRE(styles->count == 1003);
+
+  const char *sgr = vt100_style_sgr(styles, red);
+  REQUIRE(std::string_view(sgr) == "\x1b[31;49;22;23;24;25;27;28;1m");
+  REQUIRE(vt100_style_sgr(styles, red) == sgr);
+
+  /* Once every id is taken, new styles are reported rather than aliased */
+  for (uint32_t i = 1000; styles->count < vt100_style_none; i++) {
+    node.fg = {truecolor, i};
+    vt100_style_intern(styles, vt100_pack_attr(&node));
+  }
+  node.fg = {truecolor, 0xffffff};
+  REQUIRE(vt100_style_intern(styles, vt100_pack_attr(&node)) ==
+          vt100_style_none);
+  node = parse("\x1b[1;31m");
+  REQUIRE(vt100_style_intern(styles, vt100_pack_attr(&node)) == red);
+
+  /* Which the encoder formats without its cache */
+  auto head = vt100_decode("\x1b[38;2;1;2;3mnew\x1b[31mred");
+  char *plain = vt100_encode(head);
+  global_sgr_cache = vt100_sgr_cache_new(styles, 64);
+  char *cached = vt100_encode(head);
+  REQUIRE(std::string_view(cached) == plain);
+  vt100_sgr_cache_free(global_sgr_cache);
+  global_sgr_cache = NULL;
+  free(plain);
+  free(cached);
+  vt100_free(head);
+
+  vt100_styles_free(styles);
+}
+
+TEST_CASE("decode assigns style ids", "[vt100_decode]") {
+  parse("\x1b[0m");
+  global_styles = vt100_styles_new();
+  auto head = vt100_decode("a\x1b[31mb\x1b[32mc\x1b[31md\x1b[2Ke");
+
+  REQUIRE(head->style == 0);
+  auto b = head->next, c = b->next, d = c->next;
+  REQUIRE(b->style == 1);
+  REQUIRE(c->style == 2);
+  REQUIRE(d->style == 1);
+  REQUIRE(std::string_view(d->str) == "de");
+
+  vt100_free(head);
+  vt100_styles_free(global_styles);
+  global_styles = NULL;
+}
+
+TEST_CASE("sgr transitions are cached", "[vt100_sgr_cache]") {
+  parse("\x1b[0m");
+  global_styles = vt100_styles_new();
+  auto head = vt100_decode("a\x1b[31mb\x1b[32mc\x1b[31md\x1b[32me\x1b[31mf");
+  char *plain = vt100_encode(head);
+
+  global_sgr_cache = vt100_sgr_cache_new(global_styles, 16);
+  char *cached = vt100_encode(head);
+  REQUIRE(std::string_view(cached) == plain);
+  REQUIRE(global_sgr_cache->misses == 4);
+  REQUIRE(global_sgr_cache->hits == 2);
+
+  /* Nodes changed after decoding are re-interned */
+  head->next->fg = {palette_8, 4};
+  char *changed = vt100_encode(head);
+  REQUIRE(std::string_view(changed).find("a\x1b[34mb") !=
+          std::string_view::npos);
+  REQUIRE(head->next->style == 3);
+
+  /* Colliding transitions evict each other */
+  struct vt100_sgr_cache_t *tiny = vt100_sgr_cache_new(global_styles, 1);
+  char out[128];
+  vt100_sgr_cached(tiny, 0, 1, out);
+  vt100_sgr_cached(tiny, 1, 2, out);
+  REQUIRE(vt100_sgr_cached(tiny, 0, 1, out) == 5);
+  REQUIRE(std::string_view(out, 5) == "\x1b[31m");
+  REQUIRE(tiny->hits == 0);
+  REQUIRE(tiny->evictions == 2);
+
+  free(plain);
+  free(cached);
+  free(changed);
+  vt100_sgr_cache_free(tiny);
+  vt100_sgr_cache_free(global_sgr_cache);
+  global_sgr_cache = NULL;
+  vt100_free(head);
+  vt100_styles_free(global_styles);
+  global_styles = NULL;
+}
+
+TEST_CASE("measure display width", "[vt100_width]") {
+  auto width = [](std::string_view str) {
+    return vt100_width(str.data(), str.size());
+  };
+
+  REQUIRE(width("") == 0);
+  REQUIRE(width("\x1b[1;31mhello\x1b[0m world") == 11);
+  REQUIRE(width("\x1b]8;;http://example.com\x1b\\link\x1b]8;;\x1b\\") == 4);
+  REQUIRE(width("caf\xc3\xa9") == 4);             /* precomposed */
+  REQUIRE(width("cafe\xcc\x81") == 4);            /* combining acute */
+  REQUIRE(width("\xe6\x97\xa5\xe6\x9c\xac") == 4); /* CJK */
+  REQUIRE(width("\xf0\x9f\x98\x80!") == 3);        /* emoji */
+  REQUIRE(width("a\tb\x7f") == 2);
+  /* Malformed and truncated sequences are one replacement character each */
+  REQUIRE(width("\x80x\xe6\x97") == 4);
+
+  REQUIRE(vt100_wcwidth(0xac00) == 2);
+  REQUIRE(vt100_wcwidth(0x200d) == 0);
+  REQUIRE(vt100_wcwidth(0x2500) == 1);
+}
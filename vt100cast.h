@@ -0,0 +1,259 @@
+/*
+ * vt100cast.h: Recording terminal sessions as asciicast (v2) files
+ *
+ * A cast is a header line (a JSON object with the terminal's size) and then
+ *   one JSON array per event: the seconds since the start, the type ("o"
+ *   for output, "i" for input, "r" for a resize) and the bytes, as a JSON
+ *   string.  Casts can be played back with asciinema, or read back with
+ *   vt100_cast_parse, e.g. to replay a session's input (see tui::replay).
+ *
+ * JSON strings hold UTF-8, so malformed UTF-8 (e.g. a character split
+ *   between two reads) is written as U+FFFD.
+ */
+
+#ifndef __VT100CAST_H
+#define __VT100CAST_H
+
+#include "vt100utils.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ * STRUCTS
+ */
+
+struct vt100_cast_event_t {
+  double time; /* Seconds since the start */
+  char type;   /* 'o', 'i', 'r' or 'm' */
+  std::string data;
+};
+
+struct vt100_cast_t {
+  int width, height;
+  std::vector<struct vt100_cast_event_t> events;
+};
+
+/**
+ * LIBRARY FUNCTIONS
+ */
+
+inline void vt100_cast_header(FILE *f, int width, int height) {
+  fprintf(f, "{\"version\": 2, \"width\": %i, \"height\": %i}\n", width,
+          height);
+}
+
+/*
+ * vt100_cast_quote: Appends str as a
+ *   JSON string to out
+ */
+inline void vt100_cast_quote(std::string &out, const char *str, size_t len) {
+  const char *end = str + len, *start;
+  char buf[8];
+  uint32_t cp;
+
+  out += '"';
+  while (str < end) {
+    uint8_t c = *str;
+    if (c >= 0x80) {
+      /* Copied through if well-formed: not a stray byte, an overlong
+       *   encoding, a surrogate or past U+10FFFF */
+      start = str;
+      cp = vt100_utf8_get(&str, end);
+      if ((cp == 0xfffd && str - start != 3) ||
+          cp < (str - start == 2 ? 0x80u : str - start == 3 ? 0x800u
+                                                              : 0x10000u) ||
+          (cp >= 0xd800 && cp < 0xe000) || cp > 0x10ffff)
+        out += "\\ufffd";
+      else
+        out.append(start, str - start);
+      continue;
+    }
+    str++;
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c == '\r') {
+      out += "\\r";
+    } else if (c == '\t') {
+      out += "\\t";
+    } else if (c < 0x20 || c == 0x7f) {
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+/*
+ * vt100_cast_event: Writes an event of the
+ *   given type, time seconds in
+ */
+inline void vt100_cast_event(FILE *f, double time, char type, const char *str,
+                             size_t len) {
+  char buf[48];
+  std::string line(buf, snprintf(buf, sizeof(buf), "[%.6f, \"%c\", ", time,
+                                 type));
+
+  vt100_cast_quote(line, str, len);
+  line += "]\n";
+  fwrite(line.data(), 1, line.size(), f);
+}
+
+/*
+ * vt100_cast_unquote: Reads the JSON string
+ *   at *str into out, returning 0, or -1
+ *   if it is malformed
+ */
+inline int vt100_cast_unquote(const char **str, const char *end,
+                              std::string &out) {
+  const char *p = *str;
+  char buf[4];
+  uint32_t cp, low;
+
+  if (p == end || *p++ != '"')
+    return -1;
+  while (p < end && *p != '"') {
+    if (*p != '\\') {
+      out += *p++;
+      continue;
+    }
+    if (++p == end)
+      return -1;
+    switch (*p++) {
+    case 'n':
+      out += '\n';
+      break;
+    case 'r':
+      out += '\r';
+      break;
+    case 't':
+      out += '\t';
+      break;
+    case 'b':
+      out += '\b';
+      break;
+    case 'f':
+      out += '\f';
+      break;
+    case 'u':
+      if (end - p < 4 || sscanf(p, "%4x", &cp) != 1)
+        return -1;
+      p += 4;
+      /* A surrogate pair */
+      if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' &&
+          p[1] == 'u' && sscanf(p + 2, "%4x", &low) == 1 && low >= 0xdc00 &&
+          low < 0xe000) {
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+        p += 6;
+      }
+      out.append(buf, vt100_utf8_put(buf, cp));
+      break;
+    default:
+      out += p[-1];
+      break;
+    }
+  }
+  if (p == end)
+    return -1;
+  *str = p + 1;
+  return 0;
+}
+
+inline const char *vt100_cast_skip(const char *str, const char *end, char c) {
+  while (str < end && (*str == ' ' || *str == '\t'))
+    str++;
+  if (c) {
+    if (str == end || *str != c)
+      return NULL;
+    str++;
+    while (str < end && (*str == ' ' || *str == '\t'))
+      str++;
+  }
+  return str;
+}
+
+/*
+ * vt100_cast_header_int: Reads the number
+ *   after "key": in the header
+ */
+inline int vt100_cast_header_int(const std::string &header, const char *key) {
+  size_t at = header.find(std::string("\"") + key + "\"");
+
+  if (at == std::string::npos ||
+      (at = header.find(':', at)) == std::string::npos)
+    return 0;
+  return atoi(header.c_str() + at + 1);
+}
+
+/*
+ * vt100_cast_parse: Reads a cast of len bytes
+ *   into cast, returning 0, or -1 if it is
+ *   malformed (or not version 2)
+ */
+inline int vt100_cast_parse(const char *str, size_t len,
+                            struct vt100_cast_t *cast) {
+  const char *end = str + len, *eol, *p;
+  struct vt100_cast_event_t event;
+  std::string type;
+  char *after;
+
+  eol = (const char *)memchr(str, '\n', len);
+  std::string header(str, eol ? eol : end);
+  if (vt100_cast_header_int(header, "version") != 2)
+    return -1;
+  cast->width = vt100_cast_header_int(header, "width");
+  cast->height = vt100_cast_header_int(header, "height");
+  cast->events.clear();
+
+  for (p = eol; p && p < end; p = eol) {
+    p++;
+    eol = (const char *)memchr(p, '\n', end - p);
+    const char *line_end = eol ? eol : end;
+    if (!(p = vt100_cast_skip(p, line_end, 0)) || p == line_end)
+      continue;
+
+    /* [time, "type", "data"] */
+    if (!(p = vt100_cast_skip(p, line_end, '[')))
+      return -1;
+    event.time = strtod(p, &after);
+    if (after == p || !(p = vt100_cast_skip(after, line_end, ',')))
+      return -1;
+    type.clear();
+    event.data.clear();
+    if (vt100_cast_unquote(&p, line_end, type) || type.empty() ||
+        !(p = vt100_cast_skip(p, line_end, ',')) ||
+        vt100_cast_unquote(&p, line_end, event.data) ||
+        !vt100_cast_skip(p, line_end, ']'))
+      return -1;
+    event.type = type[0];
+    cast->events.push_back(event);
+  }
+  return 0;
+}
+
+/*
+ * vt100_cast_load: Reads the cast at path,
+ *   returning 0, or -1 if it can't be
+ *   read or is malformed
+ */
+inline int vt100_cast_load(const char *path, struct vt100_cast_t *cast) {
+  FILE *f = fopen(path, "rb");
+  std::string str;
+  char buf[65536];
+  size_t n;
+
+  if (!f)
+    return -1;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    str.append(buf, n);
+  fclose(f);
+  return vt100_cast_parse(str.data(), str.size(), cast);
+}
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * vt100mux.h: Decoding many output streams at once on a pool of threads
+ *
+ * Each stream is a vt100_screen_t, which keeps its own incremental decoder
+ *   state and its recent lines (as scrollback), so bytes can be fed as
+ *   they arrive instead of decoding whole documents.  Writing to an idle
+ *   stream queues it on one worker's deque; workers decode the streams on
+ *   their own deque and steal from the others' when it runs dry.  A stream
+ *   is queued at most once however much is written to it, and streams with
+ *   nothing new are never touched.
+ *
+ * After decoding, a worker publishes a snapshot of the stream's screen,
+ *   which other threads (e.g. the renderer) can read at any time without
+ *   waiting for the decoder.
+ *
+ * With VT100UTILS_INSTRUMENT, each worker counts into stats of its own,
+ *   which vt100_stats_snapshot sums, so it can be called from any thread
+ *   while the workers run.  Allocator hooks (VT100_MALLOC, etc.) are
+ *   called from the workers too, and must be thread safe.
+ */
+
+#ifndef __VT100MUX_H
+#define __VT100MUX_H
+
+#include "vt100screen.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * PREPROCESSOR
+ */
+#define VT100_MUX_SLICE 65536 /* Bytes decoded before moving on */
+
+/**
+ * STRUCTS
+ */
+
+struct vt100_snapshot_t {
+  uint64_t version; /* Snapshots published for the stream so far */
+  uint64_t bytes;   /* Bytes decoded so far */
+  std::string text; /* The screen, with graphics as SGR sequences */
+};
+
+struct vt100_stream_t {
+  void *data; /* For the caller */
+  int cols, rows;
+
+  /* Only touched by the worker decoding the stream */
+  struct vt100_screen_t *screen;
+  uint64_t bytes, version;
+
+  std::mutex lock;   /* Guards input and scheduled */
+  std::string input; /* Written but not yet decoded */
+  int scheduled;     /* Queued or being decoded */
+
+  std::mutex snapshot_lock;
+  std::shared_ptr<const struct vt100_snapshot_t> snapshot;
+  std::atomic<int> changed; /* Since the last vt100_mux_changed */
+};
+
+struct vt100_worker_t {
+  std::mutex lock;
+  std::deque<struct vt100_stream_t *> queue;
+  std::thread thread;
+};
+
+struct vt100_mux_t {
+  std::vector<std::unique_ptr<struct vt100_worker_t>> workers;
+  std::atomic<uint32_t> next;   /* Worker to queue the next stream on */
+  std::atomic<uint32_t> queued; /* Streams in all deques */
+  std::atomic<uint32_t> busy;   /* Streams queued or being decoded */
+  std::atomic<int> stop;
+  std::atomic<uint64_t> steals;
+
+  std::mutex lock; /* Guards streams */
+  std::deque<struct vt100_stream_t> streams;
+
+  /* Called (on a worker) when a snapshot is published, if none has been
+   *   since the last vt100_mux_changed */
+  void (*notify)(void *);
+  void *notify_data;
+  std::atomic<int> changed;
+};
+
+/**
+ * LIBRARY FUNCTIONS
+ */
+
+inline void vt100_mux_queue(struct vt100_mux_t *mux,
+                            struct vt100_worker_t *worker,
+                            struct vt100_stream_t *stream) {
+  {
+    std::lock_guard<std::mutex> guard(worker->lock);
+    worker->queue.push_back(stream);
+  }
+  mux->queued.fetch_add(1);
+  mux->queued.notify_one();
+}
+
+/*
+ * vt100_mux_take: Returns the next stream from
+ *   the worker's deque, or steals the most
+ *   recently queued one from another's
+ */
+inline struct vt100_stream_t *vt100_mux_take(struct vt100_mux_t *mux,
+                                             size_t self) {
+  struct vt100_stream_t *stream = NULL;
+  size_t n = mux->workers.size();
+
+  for (size_t i = 0; i < n && !stream; i++) {
+    struct vt100_worker_t *worker = mux->workers[(self + i) % n].get();
+    std::lock_guard<std::mutex> guard(worker->lock);
+    if (worker->queue.empty())
+      continue;
+    if (i == 0) {
+      stream = worker->queue.front();
+      worker->queue.pop_front();
+    } else {
+      stream = worker->queue.back();
+      worker->queue.pop_back();
+      mux->steals.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  if (stream)
+    mux->queued.fetch_sub(1);
+  return stream;
+}
+
+/*
+ * vt100_mux_decode: Feeds a slice of the
+ *   stream's input to its screen, and
+ *   publishes a snapshot
+ */
+inline void vt100_mux_decode(struct vt100_mux_t *mux,
+                             struct vt100_worker_t *worker,
+                             struct vt100_stream_t *stream) {
+  auto snapshot = std::make_shared<struct vt100_snapshot_t>();
+  std::string input;
+  char *text;
+
+  {
+    std::lock_guard<std::mutex> guard(stream->lock);
+    if (stream->input.size() <= VT100_MUX_SLICE) {
+      input.swap(stream->input);
+    } else {
+      input = stream->input.substr(0, VT100_MUX_SLICE);
+      stream->input.erase(0, VT100_MUX_SLICE);
+    }
+  }
+
+  vt100_screen_feed(stream->screen, input.data(), input.size());
+  stream->bytes += input.size();
+
+  text = vt100_screen_encode(stream->screen, 0, 0);
+  snapshot->version = ++stream->version;
+  snapshot->bytes = stream->bytes;
+  snapshot->text = text;
+  VT100_FREE(text);
+  {
+    std::lock_guard<std::mutex> guard(stream->snapshot_lock);
+    stream->snapshot = snapshot;
+  }
+
+  stream->changed.store(1);
+  if (!mux->changed.exchange(1) && mux->notify)
+    mux->notify(mux->notify_data);
+
+  /* Go to the back of the line if more arrived, so others get a turn */
+  {
+    std::lock_guard<std::mutex> guard(stream->lock);
+    if (!stream->input.empty()) {
+      vt100_mux_queue(mux, worker, stream);
+      return;
+    }
+    stream->scheduled = 0;
+  }
+  if (mux->busy.fetch_sub(1) == 1)
+    mux->busy.notify_all();
+}
+
+inline void vt100_mux_work(struct vt100_mux_t *mux, size_t self) {
+  struct vt100_stream_t *stream;
+
+  while (!mux->stop.load()) {
+    if ((stream = vt100_mux_take(mux, self)))
+      vt100_mux_decode(mux, mux->workers[self].get(), stream);
+    else
+      mux->queued.wait(0);
+  }
+}
+
+/*
+ * vt100_mux_new: Starts a pool of threads
+ *   (one per core if threads is 0)
+ */
+inline struct vt100_mux_t *vt100_mux_new(int threads) {
+  struct vt100_mux_t *mux = new struct vt100_mux_t();
+
+  if (threads <= 0)
+    threads = MAX((int)std::thread::hardware_concurrency(), 1);
+  for (int i = 0; i < threads; i++)
+    mux->workers.push_back(std::make_unique<struct vt100_worker_t>());
+  for (int i = 0; i < threads; i++)
+    mux->workers[i]->thread = std::thread(vt100_mux_work, mux, i);
+  return mux;
+}
+
+/*
+ * vt100_mux_free: Stops the threads (dropping
+ *   input not yet decoded) and frees every
+ *   stream
+ */
+inline void vt100_mux_free(struct vt100_mux_t *mux) {
+  mux->stop.store(1);
+  mux->queued.fetch_add(1);
+  mux->queued.notify_all();
+  for (auto &worker : mux->workers)
+    worker->thread.join();
+
+  for (auto &stream : mux->streams)
+    vt100_screen_free(stream.screen);
+  delete mux;
+}
+
+/*
+ * vt100_mux_open: Adds a stream decoded onto a
+ *   screen of the given size, keeping up to
+ *   scrollback lines of history
+ */
+inline struct vt100_stream_t *vt100_mux_open(struct vt100_mux_t *mux,
+                                             int cols, int rows,
+                                             int scrollback) {
+  std::lock_guard<std::mutex> guard(mux->lock);
+  struct vt100_stream_t *stream = &mux->streams.emplace_back();
+
+  stream->cols = cols;
+  stream->rows = rows;
+  stream->screen = vt100_screen_new(cols, rows, scrollback);
+  return stream;
+}
+
+/*
+ * vt100_mux_write: Queues len bytes of output
+ *   to be decoded into the stream
+ *
+ * May be called from any thread, but writes
+ *   to one stream must not be concurrent.
+ */
+inline void vt100_mux_write(struct vt100_mux_t *mux,
+                            struct vt100_stream_t *stream, const char *str,
+                            size_t len) {
+  {
+    std::lock_guard<std::mutex> guard(stream->lock);
+    stream->input.append(str, len);
+    if (stream->scheduled)
+      return;
+    stream->scheduled = 1;
+  }
+  mux->busy.fetch_add(1);
+  vt100_mux_queue(
+      mux,
+      mux->workers[mux->next.fetch_add(1, std::memory_order_relaxed) %
+                   mux->workers.size()]
+          .get(),
+      stream);
+}
+
+/*
+ * vt100_mux_flush: Waits until everything
+ *   written so far has been decoded
+ */
+inline void vt100_mux_flush(struct vt100_mux_t *mux) {
+  uint32_t busy;
+
+  while ((busy = mux->busy.load()))
+    mux->busy.wait(busy);
+}
+
+/*
+ * vt100_mux_snapshot: Returns the stream's
+ *   latest snapshot, or NULL if nothing has
+ *   been decoded yet
+ */
+inline std::shared_ptr<const struct vt100_snapshot_t>
+vt100_mux_snapshot(struct vt100_stream_t *stream) {
+  std::lock_guard<std::mutex> guard(stream->snapshot_lock);
+  return stream->snapshot;
+}
+
+/*
+ * vt100_mux_changed: Calls f with each stream
+ *   with a new snapshot since the last call,
+ *   returning how many there were
+ */
+template <typename F>
+inline int vt100_mux_changed(struct vt100_mux_t *mux, F &&f) {
+  std::lock_guard<std::mutex> guard(mux->lock);
+  int n = 0;
+
+  mux->changed.store(0);
+  for (auto &stream : mux->streams) {
+    if (stream.changed.load(std::memory_order_relaxed) &&
+        stream.changed.exchange(0)) {
+      f(&stream);
+      n++;
+    }
+  }
+  return n;
+}
+
+#endif
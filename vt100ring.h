@@ -0,0 +1,228 @@
+/*
+ * vt100ring.h: Lock-free queue of decoded batches between two threads
+ *
+ * A single producer (e.g. a thread reading and decoding a pty) pushes
+ *   batches of nodes, which a single consumer (e.g. the tui mainloop)
+ *   pops.  Neither side ever takes a lock: the ring is a fixed array of
+ *   slots indexed by two counters, each written by one side only.
+ *
+ * When the ring is full, the producer either gives up (vt100_ring_push)
+ *   or sleeps until the consumer frees a slot (vt100_ring_push_wait), which
+ *   in turn stops it reading, so the writer on the other end is throttled
+ *   instead of memory growing without bound.  The consumer is only woken
+ *   when it said it was about to sleep, so a busy stream costs no syscalls.
+ */
+
+#ifndef __VT100RING_H
+#define __VT100RING_H
+
+#include "vt100utils.h"
+
+#include <atomic>
+
+/**
+ * STRUCTS
+ */
+
+struct vt100_batch_t {
+  struct vt100_node_t *head; /* Decoded nodes, owned by whoever pops them */
+  size_t bytes;              /* Input bytes they were decoded from */
+  void *data;                /* For the producer, e.g. the box to update */
+};
+
+enum vt100_ring_flag {
+  ring_consumer_idle = 1,   /* Wake the consumer on the next push */
+  ring_producer_waiting = 2, /* Wake the producer on the next pop */
+  ring_closed = 4,
+};
+
+struct vt100_ring_t {
+  /* Each side's counter on its own cache line, with its cached copy of the
+   *   other side's, so they only share a line when the ring looks full
+   *   or empty */
+  alignas(64) std::atomic<uint32_t> head; /* Next slot to pop */
+  uint32_t tail_cache;
+  alignas(64) std::atomic<uint32_t> tail; /* Next slot to push */
+  uint32_t head_cache;
+  uint64_t stalls; /* Pushes that found the ring full */
+
+  alignas(64) std::atomic<uint32_t> flags;
+  uint32_t mask;
+  struct vt100_batch_t *slots;
+
+  /* Called (on the producer's thread) to wake an idle consumer, or NULL
+   *   for consumers blocked in vt100_ring_wait */
+  void (*wake)(void *);
+  void *wake_data;
+};
+
+/**
+ * LIBRARY FUNCTIONS
+ */
+
+/*
+ * vt100_ring_new: Allocates a ring holding
+ *   capacity batches, rounded up to a
+ *   power of two
+ */
+inline struct vt100_ring_t *vt100_ring_new(uint32_t capacity) {
+  struct vt100_ring_t *ring = new struct vt100_ring_t();
+  uint32_t size = 2;
+
+  while (size < capacity)
+    size <<= 1;
+  ring->mask = size - 1;
+  ring->slots = (struct vt100_batch_t *)VT100_CALLOC(
+      size, sizeof(struct vt100_batch_t));
+  return ring;
+}
+
+/*
+ * vt100_ring_free: Frees the ring and any
+ *   batches still in it
+ */
+inline void vt100_ring_free(struct vt100_ring_t *ring) {
+  uint32_t tail = ring->tail.load();
+
+  for (uint32_t i = ring->head.load(); i != tail; i++) {
+    if (ring->slots[i & ring->mask].head)
+      vt100_free(ring->slots[i & ring->mask].head);
+  }
+  VT100_FREE(ring->slots);
+  delete ring;
+}
+
+/*
+ * vt100_ring_push: Queues a batch, returning
+ *   0 (and keeping ownership of it) if the
+ *   ring is full
+ *
+ * Producer only.
+ */
+inline int vt100_ring_push(struct vt100_ring_t *ring,
+                           struct vt100_batch_t batch) {
+  uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+
+  if (tail - ring->head_cache > ring->mask) {
+    ring->head_cache = ring->head.load(std::memory_order_acquire);
+    if (tail - ring->head_cache > ring->mask) {
+      ring->stalls++;
+      return 0;
+    }
+  }
+
+  ring->slots[tail & ring->mask] = batch;
+  /* seq_cst, so that either this store is seen by a consumer about to
+   *   sleep, or its idle flag is seen below */
+  ring->tail.store(tail + 1);
+
+  if (ring->flags.load() & ring_consumer_idle &&
+      ring->flags.fetch_and(~ring_consumer_idle) & ring_consumer_idle) {
+    if (ring->wake)
+      ring->wake(ring->wake_data);
+    else
+      ring->flags.notify_one();
+  }
+  return 1;
+}
+
+/*
+ * vt100_ring_push_wait: Queues a batch,
+ *   sleeping while the ring is full
+ *
+ * Producer only.
+ */
+inline void vt100_ring_push_wait(struct vt100_ring_t *ring,
+                                 struct vt100_batch_t batch) {
+  uint32_t head;
+
+  while (!vt100_ring_push(ring, batch)) {
+    head = ring->head_cache;
+    ring->flags.fetch_or(ring_producer_waiting);
+    if (ring->head.load() == head)
+      ring->head.wait(head);
+  }
+}
+
+/*
+ * vt100_ring_pop: Takes the oldest batch,
+ *   returning 0 if the ring is empty
+ *
+ * Consumer only.
+ */
+inline int vt100_ring_pop(struct vt100_ring_t *ring,
+                          struct vt100_batch_t *batch) {
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+
+  if (head == ring->tail_cache) {
+    ring->tail_cache = ring->tail.load(std::memory_order_acquire);
+    if (head == ring->tail_cache)
+      return 0;
+  }
+
+  *batch = ring->slots[head & ring->mask];
+  ring->head.store(head + 1);
+
+  if (ring->flags.load() & ring_producer_waiting) {
+    ring->flags.fetch_and(~ring_producer_waiting);
+    ring->head.notify_one();
+  }
+  return 1;
+}
+
+/*
+ * vt100_ring_idle: Tells the producer that
+ *   the consumer is about to sleep, returning
+ *   0 if it shouldn't, since batches (or the
+ *   end of the stream) arrived in the meantime
+ *
+ * Consumer only.
+ */
+inline int vt100_ring_idle(struct vt100_ring_t *ring) {
+  ring->flags.fetch_or(ring_consumer_idle);
+  if (ring->tail.load() != ring->head.load(std::memory_order_relaxed) ||
+      ring->flags.load() & ring_closed) {
+    ring->flags.fetch_and(~ring_consumer_idle);
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * vt100_ring_wait: Sleeps until there is a
+ *   batch to pop, returning 0 once the ring
+ *   is closed and empty
+ *
+ * Consumer only, and only if wake is unset.
+ */
+inline int vt100_ring_wait(struct vt100_ring_t *ring) {
+  uint32_t flags;
+
+  if (vt100_ring_idle(ring)) {
+    /* Until a push or close clears the idle flag */
+    while ((flags = ring->flags.load()) & ring_consumer_idle)
+      ring->flags.wait(flags);
+  }
+  return ring->tail.load() != ring->head.load(std::memory_order_relaxed);
+}
+
+/*
+ * vt100_ring_close: Marks the end of the
+ *   stream, waking the consumer
+ *
+ * Producer only.
+ */
+inline void vt100_ring_close(struct vt100_ring_t *ring) {
+  ring->flags.fetch_or(ring_closed);
+  ring->flags.fetch_and(~ring_consumer_idle);
+  if (ring->wake)
+    ring->wake(ring->wake_data);
+  else
+    ring->flags.notify_one();
+}
+
+inline int vt100_ring_closed(struct vt100_ring_t *ring) {
+  return (ring->flags.load() & ring_closed) != 0;
+}
+
+#endif
@@ -0,0 +1,955 @@
+/*
+ * vt100screen.h: A headless VT100 screen model built on vt100utils
+ *
+ * Consumes a byte stream (e.g. a captured pty) into a grid of cells
+ *   plus scrollback, so that output from programs which redraw (progress
+ *   bars, "\r" spinners, full-screen interfaces) can be turned into a
+ *   final-screen snapshot.
+ */
+
+#ifndef __VT100SCREEN_H
+#define __VT100SCREEN_H
+
+#include "vt100scrollback.h"
+
+/**
+ * PREPROCESSOR
+ */
+/* Cells holding a character with combining marks store the id of its
+ *   text in the screen's cluster table, plus this (past any codepoint) */
+#define VT100_SCREEN_CLUSTER 0x110000
+#define VT100_SCREEN_MAX_CLUSTERS (0x200000 - VT100_SCREEN_CLUSTER)
+#define VT100_SCREEN_CLUSTER_LEN 32 /* Further marks are dropped */
+
+/**
+ * STRUCTS
+ */
+
+struct vt100_screen_t {
+  int cols, rows;
+  /* Rows of the active and inactive (main or alternate) buffers, as
+   *   pointers into cells so that scrolling only moves pointers */
+  struct vt100_cell_t **lines, **other, **scratch;
+  struct vt100_cell_t *cells; /* 2 * rows * cols */
+  /* The right half of a wide character is a cell with ch 0 */
+  int alternate;
+
+  int x, y;
+  int wrap_pending; /* Cursor is past the last column (deferred wrap) */
+  int autowrap;
+  int top, bottom; /* Scroll region, inclusive */
+  int saved_x, saved_y;
+
+  /* The pen is a node so that vt100_apply_sgr can be reused */
+  struct vt100_node_t pen, saved_pen;
+  struct vt100_styles_t *styles;
+  uint16_t style, blank_style; /* Style of the pen, and of erased cells */
+  uint32_t blank_bg;
+  /* Pens drawn in the default style, since every style id was in use */
+  uint64_t style_misses;
+
+  /* Text of characters with combining marks (interned like URLs) */
+  struct vt100_links_t *clusters;
+
+  /* Lines scrolled off the top of the main screen */
+  struct vt100_scrollback_t *history;
+  struct vt100_cell_t *history_line; /* Scratch line for reading it back */
+
+  /* Partial escape sequence / UTF-8 character left over by a feed */
+  char pending[4096];
+  int npending;
+  /* Introducer of a sequence too long for pending, skipped up to its end,
+   *   and whether the last byte skipped was ESC (which may begin ST) */
+  char discard;
+  int discard_esc;
+  uint32_t utf8;
+  int utf8_need;
+};
+
+/**
+ * LIBRARY FUNCTIONS
+ */
+
+/*
+ * vt100_screen_compact_styles: Rebuilds the
+ *   style table from the styles still used
+ *   by cells (of either buffer, or in the
+ *   scrollback) and the pen, freeing the
+ *   ids of the rest
+ */
+inline void vt100_screen_compact_styles(struct vt100_screen_t *screen) {
+  struct vt100_styles_t *old = screen->styles, *styles = vt100_styles_new();
+  uint16_t *map = (uint16_t *)VT100_MALLOC(sizeof(uint16_t) * old->count);
+  struct vt100_cell_t *cells = screen->cells;
+  int ncells = screen->cols * screen->rows * 2;
+  struct vt100_sb_line_t line;
+
+  /* Ids are given out in the order they are found */
+  auto keep = [&](uint16_t id) {
+    if (map[id] == vt100_style_none)
+      map[id] = vt100_style_intern(styles, old->styles[id].attr);
+  };
+  for (int i = 0; i < old->count; i++)
+    map[i] = vt100_style_none;
+  map[0] = 0;
+
+  keep(screen->style);
+  keep(screen->blank_style);
+  for (int i = 0; i < ncells; i++)
+    keep(cells[i].style);
+  for (int i = 0; i < screen->history->count; i++) {
+    line = vt100_scrollback_get(screen->history, i);
+    for (int r = 0; r < line.nruns; r++)
+      keep(line.runs[r].style);
+  }
+
+  for (int i = 0; i < ncells; i++)
+    cells[i].style = map[cells[i].style];
+  vt100_scrollback_restyle(screen->history, map);
+  screen->style = map[screen->style];
+  screen->blank_style = map[screen->blank_style];
+
+  vt100_styles_free(old);
+  VT100_FREE(map);
+  screen->styles = styles;
+}
+
+/*
+ * vt100_screen_intern: Returns the style id
+ *   of attr, rebuilding the table if it is
+ *   full
+ *
+ * If every id is still in use, the miss is
+ *   counted in style_misses, and the default
+ *   style is used.  The table is then only
+ *   rebuilt again after every 4096 misses.
+ */
+inline uint16_t vt100_screen_intern(struct vt100_screen_t *screen,
+                                    struct vt100_attr_t attr) {
+  uint16_t id = vt100_style_intern(screen->styles, attr);
+
+  if (id == vt100_style_none && screen->style_misses % 4096 == 0) {
+    vt100_screen_compact_styles(screen);
+    id = vt100_style_intern(screen->styles, attr);
+  }
+  if (id == vt100_style_none) {
+    screen->style_misses++;
+    return 0;
+  }
+  return id;
+}
+
+/*
+ * vt100_screen_update_pen: Looks up the style
+ *   ids for the pen after it changes
+ */
+inline void vt100_screen_update_pen(struct vt100_screen_t *screen) {
+  struct vt100_node_t blank = {};
+  struct vt100_attr_t attr = vt100_pack_attr(&screen->pen);
+
+  screen->style = vt100_screen_intern(screen, attr);
+
+  /* Erased cells take only the background color */
+  if (attr.bg != screen->blank_bg) {
+    blank.fg = default_fg;
+    blank.bg = screen->pen.bg;
+    blank.ul = default_ul;
+    screen->blank_style = vt100_screen_intern(screen, vt100_pack_attr(&blank));
+    screen->blank_bg = attr.bg;
+  }
+}
+
+inline void vt100_screen_reset_pen(struct vt100_screen_t *screen) {
+  memset(&screen->pen, 0, sizeof(screen->pen));
+  screen->pen.fg = default_fg;
+  screen->pen.bg = default_bg;
+  screen->pen.ul = default_ul;
+  vt100_screen_update_pen(screen);
+}
+
+/*
+ * vt100_screen_blank: Fills n cells with
+ *   spaces in the current background color
+ */
+inline void vt100_screen_blank(struct vt100_screen_t *screen,
+                               struct vt100_cell_t *cell, int n) {
+  struct vt100_cell_t blank = {' ', screen->blank_style};
+  for (int i = 0; i < n; i++)
+    cell[i] = blank;
+}
+
+/*
+ * vt100_screen_split_wide: Blanks both halves
+ *   of a wide character if the boundary
+ *   before cell x of row cuts through it
+ */
+inline void vt100_screen_split_wide(struct vt100_screen_t *screen,
+                                    struct vt100_cell_t *row, int x) {
+  if (x > 0 && x < screen->cols && row[x].ch == 0) {
+    row[x - 1].ch = ' ';
+    row[x].ch = ' ';
+  }
+}
+
+/*
+ * vt100_screen_cluster: Returns the text of
+ *   a cell's character (with any combining
+ *   marks) in buf, which must hold
+ *   VT100_SCREEN_CLUSTER_LEN bytes, and its
+ *   length
+ */
+inline int vt100_screen_cluster(struct vt100_screen_t *screen, uint32_t ch,
+                                char *buf) {
+  const char *text;
+  int len;
+
+  if (ch < VT100_SCREEN_CLUSTER)
+    return vt100_utf8_put(buf, ch);
+  text = screen->clusters->urls[ch - VT100_SCREEN_CLUSTER];
+  len = strlen(text);
+  memcpy(buf, text, len);
+  return len;
+}
+
+/*
+ * vt100_screen_new: Creates a screen of the
+ *   given size, keeping up to scrollback
+ *   lines of history
+ */
+inline struct vt100_screen_t *vt100_screen_new(int cols, int rows,
+                                               int scrollback) {
+  struct vt100_screen_t *screen =
+      (struct vt100_screen_t *)VT100_CALLOC(1, sizeof(struct vt100_screen_t));
+
+  screen->cols = cols;
+  screen->rows = rows;
+  screen->cells = (struct vt100_cell_t *)VT100_MALLOC(
+      sizeof(struct vt100_cell_t) * cols * rows * 2);
+  screen->lines = (struct vt100_cell_t **)VT100_MALLOC(
+      sizeof(struct vt100_cell_t *) * rows);
+  screen->other = (struct vt100_cell_t **)VT100_MALLOC(
+      sizeof(struct vt100_cell_t *) * rows);
+  screen->scratch = (struct vt100_cell_t **)VT100_MALLOC(
+      sizeof(struct vt100_cell_t *) * rows);
+  for (int y = 0; y < rows; y++) {
+    screen->lines[y] = screen->cells + y * cols;
+    screen->other[y] = screen->cells + (rows + y) * cols;
+  }
+  screen->history = vt100_scrollback_new(scrollback);
+  screen->history_line =
+      (struct vt100_cell_t *)VT100_MALLOC(sizeof(struct vt100_cell_t) * cols);
+  screen->autowrap = 1;
+  screen->bottom = rows - 1;
+  screen->styles = vt100_styles_new();
+  screen->clusters =
+      (struct vt100_links_t *)VT100_CALLOC(1, sizeof(struct vt100_links_t));
+  screen->blank_bg = UINT32_MAX;
+
+  vt100_screen_reset_pen(screen);
+  screen->saved_pen = screen->pen;
+  vt100_screen_blank(screen, screen->cells, cols * rows * 2);
+
+  return screen;
+}
+
+inline void vt100_screen_free(struct vt100_screen_t *screen) {
+  VT100_FREE(screen->cells);
+  VT100_FREE(screen->lines);
+  VT100_FREE(screen->other);
+  VT100_FREE(screen->scratch);
+  vt100_scrollback_free(screen->history);
+  vt100_styles_free(screen->styles);
+  vt100_links_free(screen->clusters);
+  VT100_FREE(screen->history_line);
+  VT100_FREE(screen);
+}
+
+/*
+ * vt100_screen_line_len: Length of a line,
+ *   excluding trailing blank cells
+ */
+inline int vt100_screen_line_len(struct vt100_screen_t *screen,
+                                 struct vt100_cell_t *line) {
+  int n = screen->cols;
+  while (n > 0 && line[n - 1].ch == ' ' && line[n - 1].style == 0)
+    n--;
+  return n;
+}
+
+/*
+ * vt100_screen_history: Returns line i of the
+ *   scrollback, where 0 is the oldest line
+ *   still kept
+ *
+ * The line is only valid until the next call.
+ */
+inline struct vt100_cell_t *vt100_screen_history(struct vt100_screen_t *screen,
+                                                 int i) {
+  vt100_scrollback_cells(screen->history, i, screen->history_line,
+                         screen->cols);
+  return screen->history_line;
+}
+
+/*
+ * vt100_screen_scroll: Scrolls the scroll
+ *   region up (n > 0) or down (n < 0),
+ *   saving lines that leave the top of the
+ *   main screen to the scrollback if save
+ *   is set (lines deleted by DL are not)
+ */
+inline void vt100_screen_scroll(struct vt100_screen_t *screen, int n,
+                                int save) {
+  struct vt100_cell_t **region = screen->lines + screen->top,
+                      **tmp = screen->scratch;
+  int height = screen->bottom - screen->top + 1;
+
+  if (n > height)
+    n = height;
+  if (n < -height)
+    n = -height;
+
+  if (n > 0) {
+    if (save && screen->top == 0 && !screen->alternate) {
+      for (int i = 0; i < n; i++) {
+        vt100_scrollback_push(screen->history, region[i],
+                              vt100_screen_line_len(screen, region[i]));
+      }
+    }
+    memcpy(tmp, region, sizeof(*tmp) * n);
+    memmove(region, region + n, sizeof(*tmp) * (height - n));
+    memcpy(region + height - n, tmp, sizeof(*tmp) * n);
+    for (int i = height - n; i < height; i++)
+      vt100_screen_blank(screen, region[i], screen->cols);
+  } else if (n < 0) {
+    n = -n;
+    memcpy(tmp, region + height - n, sizeof(*tmp) * n);
+    memmove(region + n, region, sizeof(*tmp) * (height - n));
+    memcpy(region, tmp, sizeof(*tmp) * n);
+    for (int i = 0; i < n; i++)
+      vt100_screen_blank(screen, region[i], screen->cols);
+  }
+}
+
+inline void vt100_screen_linefeed(struct vt100_screen_t *screen) {
+  if (screen->y == screen->bottom)
+    vt100_screen_scroll(screen, 1, 1);
+  else if (screen->y < screen->rows - 1)
+    screen->y++;
+}
+
+/*
+ * vt100_screen_put: Writes n printable ASCII
+ *   characters at the cursor, wrapping
+ *   (or not) at the right margin
+ */
+inline void vt100_screen_put(struct vt100_screen_t *screen, const char *str,
+                             int n) {
+  struct vt100_cell_t *row;
+  int count;
+
+  while (n > 0) {
+    if (screen->wrap_pending) {
+      screen->wrap_pending = 0;
+      screen->x = 0;
+      vt100_screen_linefeed(screen);
+    }
+
+    count = screen->cols - screen->x;
+    if (count > n)
+      count = n;
+
+    row = screen->lines[screen->y];
+    vt100_screen_split_wide(screen, row, screen->x);
+    vt100_screen_split_wide(screen, row, screen->x + count);
+    row += screen->x;
+    for (int i = 0; i < count; i++) {
+      row[i].ch = (uint8_t)str[i];
+      row[i].style = screen->style;
+    }
+    str += count;
+    n -= count;
+    screen->x += count;
+
+    if (screen->x == screen->cols) {
+      screen->x = screen->cols - 1;
+      if (screen->autowrap) {
+        screen->wrap_pending = 1;
+      } else if (n > 0) {
+        /* Without autowrap, the rest overwrites the last column */
+        str += n - 1;
+        n = 1;
+      }
+    }
+  }
+}
+
+/*
+ * vt100_screen_combine: Adds a combining
+ *   mark to the character before the cursor
+ */
+inline void vt100_screen_combine(struct vt100_screen_t *screen, uint32_t cp) {
+  struct vt100_cell_t *row = screen->lines[screen->y];
+  int x = screen->wrap_pending ? screen->x : screen->x - 1, len, id;
+  char buf[VT100_SCREEN_CLUSTER_LEN];
+
+  /* C1 controls are zero width too, but are not marks */
+  if (x < 0 || cp < 0xa0)
+    return;
+  if (x > 0 && row[x].ch == 0)
+    x--;
+
+  len = vt100_screen_cluster(screen, row[x].ch, buf);
+  if (len + 4 > VT100_SCREEN_CLUSTER_LEN ||
+      screen->clusters->count == VT100_SCREEN_MAX_CLUSTERS)
+    return;
+  len += vt100_utf8_put(buf + len, cp);
+  id = vt100_link_intern(screen->clusters, buf, len);
+  row[x].ch = VT100_SCREEN_CLUSTER + id - 1;
+}
+
+/*
+ * vt100_screen_put_cp: Writes a codepoint at
+ *   the cursor, taking two cells if it is
+ *   wide, or none if it combines with the
+ *   character before
+ */
+inline void vt100_screen_put_cp(struct vt100_screen_t *screen, uint32_t cp) {
+  struct vt100_cell_t *row;
+  int width = vt100_wcwidth(cp), x;
+
+  if (width == 0) {
+    vt100_screen_combine(screen, cp);
+    return;
+  }
+  if (width > screen->cols)
+    return;
+
+  if (screen->wrap_pending) {
+    screen->wrap_pending = 0;
+    screen->x = 0;
+    vt100_screen_linefeed(screen);
+  }
+  if (screen->x + width > screen->cols) {
+    /* A wide character never starts in the last column */
+    if (screen->autowrap) {
+      screen->x = 0;
+      vt100_screen_linefeed(screen);
+    } else {
+      screen->x = screen->cols - width;
+    }
+  }
+
+  row = screen->lines[screen->y];
+  x = screen->x;
+  vt100_screen_split_wide(screen, row, x);
+  vt100_screen_split_wide(screen, row, x + width);
+  row[x] = {cp, screen->style};
+  if (width == 2)
+    row[x + 1] = {0, screen->style};
+
+  if (x + width == screen->cols) {
+    screen->x = screen->cols - 1;
+    screen->wrap_pending = screen->autowrap;
+  } else {
+    screen->x = x + width;
+  }
+}
+
+inline void vt100_screen_move(struct vt100_screen_t *screen, int x, int y) {
+  screen->x = x < 0 ? 0 : x >= screen->cols ? screen->cols - 1 : x;
+  screen->y = y < 0 ? 0 : y >= screen->rows ? screen->rows - 1 : y;
+  screen->wrap_pending = 0;
+}
+
+/*
+ * vt100_screen_erase: Blanks the cells from
+ *   (x0, y0) up to but not including (x1, y1)
+ *   in reading order
+ */
+inline void vt100_screen_erase(struct vt100_screen_t *screen, int x0, int y0,
+                               int x1, int y1) {
+  for (int y = y0; y <= y1 && y < screen->rows; y++) {
+    int from = y == y0 ? x0 : 0, to = y == y1 ? x1 : screen->cols;
+    if (to > from) {
+      vt100_screen_split_wide(screen, screen->lines[y], from);
+      vt100_screen_split_wide(screen, screen->lines[y], to);
+      vt100_screen_blank(screen, screen->lines[y] + from, to - from);
+    }
+  }
+}
+
+inline void vt100_screen_set_alternate(struct vt100_screen_t *screen,
+                                       int alternate) {
+  struct vt100_cell_t **tmp;
+
+  if (screen->alternate == alternate)
+    return;
+  tmp = screen->lines;
+  screen->lines = screen->other;
+  screen->other = tmp;
+  screen->alternate = alternate;
+  if (alternate)
+    vt100_screen_erase(screen, 0, 0, 0, screen->rows);
+}
+
+/*
+ * vt100_screen_csi: Executes a complete CSI
+ *   sequence [str, end)
+ */
+inline void vt100_screen_csi(struct vt100_screen_t *screen, const char *str,
+                             const char *end) {
+  const char *p = str + 2;
+  int args[16] = {0}, n = 0, i, count;
+  char private_marker = 0, final = end[-1];
+  struct vt100_cell_t *row;
+
+  if (final == 'm') {
+    /* If malformed, whatever was applied is kept, as in a terminal */
+    vt100_apply_sgr(&screen->pen, p, end - 1);
+    vt100_screen_update_pen(screen);
+    return;
+  }
+
+  if (*p >= '<' && *p <= '?')
+    private_marker = *p++;
+  for (; p < end - 1; p++) {
+    if (*p >= '0' && *p <= '9') {
+      if (args[n] < 100000)
+        args[n] = args[n] * 10 + (*p - '0');
+    } else if (*p == ';' && n < 15) {
+      n++;
+    } else if (*p < 0x30) {
+      /* Intermediate bytes: no supported sequence uses them */
+      return;
+    }
+  }
+  n++;
+
+  /* Most sequences treat 0 like their default of 1 */
+  count = args[0] ? args[0] : 1;
+
+  if (private_marker) {
+    if (private_marker != '?' || (final != 'h' && final != 'l'))
+      return;
+    for (i = 0; i < n; i++) {
+      switch (args[i]) {
+      case 7:
+        screen->autowrap = (final == 'h');
+        break;
+      case 47:
+      case 1047:
+      case 1049:
+        if (args[i] == 1049 && final == 'h') {
+          screen->saved_x = screen->x;
+          screen->saved_y = screen->y;
+          screen->saved_pen = screen->pen;
+        }
+        vt100_screen_set_alternate(screen, final == 'h');
+        if (args[i] == 1049 && final == 'l') {
+          screen->pen = screen->saved_pen;
+          vt100_screen_update_pen(screen);
+          vt100_screen_move(screen, screen->saved_x, screen->saved_y);
+        }
+        break;
+      }
+    }
+    return;
+  }
+
+  switch (final) {
+  case 'A': /* CUU */
+    vt100_screen_move(screen, screen->x,
+                      screen->y - count < screen->top && screen->y >= screen->top
+                          ? screen->top
+                          : screen->y - count);
+    break;
+  case 'B': /* CUD */
+  case 'e': /* VPR */
+    vt100_screen_move(screen, screen->x,
+                      screen->y + count > screen->bottom &&
+                              screen->y <= screen->bottom
+                          ? screen->bottom
+                          : screen->y + count);
+    break;
+  case 'C': /* CUF */
+  case 'a': /* HPR */
+    vt100_screen_move(screen, screen->x + count, screen->y);
+    break;
+  case 'D': /* CUB */
+    vt100_screen_move(screen, screen->x - count, screen->y);
+    break;
+  case 'E': /* CNL */
+    vt100_screen_move(screen, 0, screen->y + count);
+    break;
+  case 'F': /* CPL */
+    vt100_screen_move(screen, 0, screen->y - count);
+    break;
+  case 'G': /* CHA */
+  case '`': /* HPA */
+    vt100_screen_move(screen, count - 1, screen->y);
+    break;
+  case 'd': /* VPA */
+    vt100_screen_move(screen, screen->x, count - 1);
+    break;
+  case 'H': /* CUP */
+  case 'f': /* HVP */
+    vt100_screen_move(screen, (n > 1 && args[1] ? args[1] : 1) - 1,
+                      count - 1);
+    break;
+  case 'J': /* ED */
+    if (args[0] == 0)
+      vt100_screen_erase(screen, screen->x, screen->y, 0, screen->rows);
+    else if (args[0] == 1)
+      vt100_screen_erase(screen, 0, 0, screen->x + 1, screen->y);
+    else
+      vt100_screen_erase(screen, 0, 0, 0, screen->rows);
+    break;
+  case 'K': /* EL */
+    if (args[0] == 0)
+      vt100_screen_erase(screen, screen->x, screen->y, 0, screen->y + 1);
+    else if (args[0] == 1)
+      vt100_screen_erase(screen, 0, screen->y, screen->x + 1, screen->y);
+    else
+      vt100_screen_erase(screen, 0, screen->y, 0, screen->y + 1);
+    break;
+  case 'X': /* ECH */
+    if (count > screen->cols - screen->x)
+      count = screen->cols - screen->x;
+    vt100_screen_erase(screen, screen->x, screen->y, screen->x + count,
+                       screen->y);
+    break;
+  case 'P': /* DCH */
+  case '@': /* ICH */
+    if (count > screen->cols - screen->x)
+      count = screen->cols - screen->x;
+    row = screen->lines[screen->y];
+    vt100_screen_split_wide(screen, row, screen->x);
+    vt100_screen_split_wide(screen, row,
+                            final == 'P' ? screen->x + count
+                                         : screen->cols - count);
+    if (final == 'P') {
+      memmove(row + screen->x, row + screen->x + count,
+              sizeof(struct vt100_cell_t) *
+                  (screen->cols - screen->x - count));
+      vt100_screen_blank(screen, row + screen->cols - count, count);
+    } else {
+      memmove(row + screen->x + count, row + screen->x,
+              sizeof(struct vt100_cell_t) *
+                  (screen->cols - screen->x - count));
+      vt100_screen_blank(screen, row + screen->x, count);
+    }
+    break;
+  case 'L': /* IL */
+  case 'M': /* DL */
+    if (screen->y >= screen->top && screen->y <= screen->bottom) {
+      i = screen->top;
+      screen->top = screen->y;
+      vt100_screen_scroll(screen, final == 'L' ? -count : count, 0);
+      screen->top = i;
+      screen->x = 0;
+    }
+    break;
+  case 'S': /* SU */
+    vt100_screen_scroll(screen, count, 1);
+    break;
+  case 'T': /* SD */
+    vt100_screen_scroll(screen, -count, 0);
+    break;
+  case 'r': /* DECSTBM */
+    i = (n > 1 && args[1]) ? args[1] : screen->rows;
+    if (i > screen->rows)
+      i = screen->rows;
+    if (count < i) {
+      screen->top = count - 1;
+      screen->bottom = i - 1;
+      vt100_screen_move(screen, 0, 0);
+    }
+    break;
+  case 's': /* SCOSC */
+    screen->saved_x = screen->x;
+    screen->saved_y = screen->y;
+    break;
+  case 'u': /* SCORC */
+    vt100_screen_move(screen, screen->saved_x, screen->saved_y);
+    break;
+  }
+}
+
+/*
+ * vt100_screen_esc: Executes a complete
+ *   escape sequence [str, end)
+ */
+inline void vt100_screen_esc(struct vt100_screen_t *screen, const char *str,
+                             const char *end) {
+  if (end - str < 2)
+    return;
+
+  switch (str[1]) {
+  case '[':
+    if (end - str >= 3 && end[-1] >= 0x40 && end[-1] <= 0x7e)
+      vt100_screen_csi(screen, str, end);
+    break;
+  case '7': /* DECSC */
+    screen->saved_x = screen->x;
+    screen->saved_y = screen->y;
+    screen->saved_pen = screen->pen;
+    break;
+  case '8': /* DECRC */
+    screen->pen = screen->saved_pen;
+    vt100_screen_update_pen(screen);
+    vt100_screen_move(screen, screen->saved_x, screen->saved_y);
+    break;
+  case 'D': /* IND */
+    vt100_screen_linefeed(screen);
+    break;
+  case 'E': /* NEL */
+    screen->x = 0;
+    screen->wrap_pending = 0;
+    vt100_screen_linefeed(screen);
+    break;
+  case 'M': /* RI */
+    if (screen->y == screen->top)
+      vt100_screen_scroll(screen, -1, 0);
+    else if (screen->y > 0)
+      screen->y--;
+    break;
+  case 'c': /* RIS */
+    vt100_screen_set_alternate(screen, 0);
+    vt100_screen_reset_pen(screen);
+    screen->top = 0;
+    screen->bottom = screen->rows - 1;
+    screen->autowrap = 1;
+    vt100_screen_erase(screen, 0, 0, 0, screen->rows);
+    vt100_screen_move(screen, 0, 0);
+    break;
+  }
+}
+
+/*
+ * vt100_seq_complete: Whether [str, end), as
+ *   returned by vt100_seq_end, is a complete
+ *   sequence rather than one cut off by end
+ */
+inline int vt100_seq_complete(const char *str, const char *end) {
+  if (end - str < 2)
+    return 0;
+  switch (str[1]) {
+  case '[':
+    return end - str >= 3 && end[-1] >= 0x40 && end[-1] <= 0x7e;
+  case ']':
+  case 'P':
+  case 'X':
+  case '^':
+  case '_':
+    return (str[1] == ']' && end[-1] == '\a') ||
+           (end - str >= 4 && end[-2] == '\x1b' && end[-1] == '\\');
+  default:
+    return end[-1] >= 0x30 && end[-1] <= 0x7e;
+  }
+}
+
+/*
+ * vt100_screen_control: Executes a C0 control
+ *   character or non-ASCII byte
+ */
+inline void vt100_screen_control(struct vt100_screen_t *screen, uint8_t c) {
+  if (c >= 0x80) {
+    if (c >= 0xc0) {
+      screen->utf8_need = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+      screen->utf8 = c & (0x3f >> screen->utf8_need);
+    } else if (screen->utf8_need) {
+      screen->utf8 = (screen->utf8 << 6) | (c & 0x3f);
+      if (--screen->utf8_need == 0)
+        vt100_screen_put_cp(screen, screen->utf8);
+    }
+    return;
+  }
+  screen->utf8_need = 0;
+
+  switch (c) {
+  case '\r':
+    screen->x = 0;
+    screen->wrap_pending = 0;
+    break;
+  case '\n':
+  case '\v':
+  case '\f':
+    vt100_screen_linefeed(screen);
+    break;
+  case '\b':
+    if (screen->x > 0 && !screen->wrap_pending)
+      screen->x--;
+    screen->wrap_pending = 0;
+    break;
+  case '\t':
+    vt100_screen_move(screen, (screen->x / 8 + 1) * 8, screen->y);
+    break;
+  }
+}
+
+/*
+ * vt100_screen_discard: Skips the rest of a
+ *   sequence too long to keep, returning a
+ *   pointer past its end, or NULL if it
+ *   runs past end
+ */
+inline const char *vt100_screen_discard(struct vt100_screen_t *screen,
+                                        const char *p, const char *end) {
+  switch (screen->discard) {
+  case '[':
+    while (p < end && *p >= 0x20 && *p <= 0x3f)
+      p++;
+    if (p == end)
+      return NULL;
+    if (*p >= 0x40 && *p <= 0x7e)
+      p++;
+    break;
+  case ']':
+  case 'P':
+  case 'X':
+  case '^':
+  case '_':
+    for (; p < end; p++) {
+      if ((*p == '\\' && screen->discard_esc) ||
+          (*p == '\a' && screen->discard == ']'))
+        break;
+      screen->discard_esc = *p == '\x1b';
+    }
+    if (p == end)
+      return NULL;
+    p++;
+    break;
+  default:
+    while (p < end && *p >= 0x20 && *p <= 0x2f)
+      p++;
+    if (p == end)
+      return NULL;
+    if (*p >= 0x30 && *p <= 0x7e)
+      p++;
+    break;
+  }
+
+  screen->discard = 0;
+  screen->discard_esc = 0;
+  return p;
+}
+
+/*
+ * vt100_screen_feed: Consumes len bytes of
+ *   output; sequences and characters may be
+ *   split across calls
+ */
+inline void vt100_screen_feed(struct vt100_screen_t *screen, const char *str,
+                              size_t len) {
+  const char *p = str, *end = str + len, *run, *seq_end;
+  int n, old;
+
+  /* Finish a sequence left over by the previous call */
+  while (screen->npending && p < end) {
+    old = screen->npending;
+    n = end - p;
+    if (n > (int)sizeof(screen->pending) - old)
+      n = sizeof(screen->pending) - old;
+    memcpy(screen->pending + old, p, n);
+    seq_end = vt100_seq_end(screen->pending, screen->pending + old + n);
+
+    if (vt100_seq_complete(screen->pending, seq_end) ||
+        seq_end < screen->pending + old + n) {
+      vt100_screen_esc(screen, screen->pending, seq_end);
+      p += seq_end - (screen->pending + old);
+      screen->npending = 0;
+    } else if (old + n == (int)sizeof(screen->pending)) {
+      /* Too long to be anything meaningful: skip it */
+      screen->discard = screen->pending[1];
+      screen->discard_esc = screen->pending[old + n - 1] == '\x1b';
+      p += n;
+      screen->npending = 0;
+    } else {
+      screen->npending += n;
+      return;
+    }
+  }
+
+  if (screen->discard && !(p = vt100_screen_discard(screen, p, end)))
+    return;
+
+  while (p < end) {
+    /* Fast path: printable ASCII */
+    run = p;
+    while (p < end && *p >= 0x20 && *p <= 0x7e)
+      p++;
+    if (p != run) {
+      if (screen->utf8_need)
+        screen->utf8_need = 0;
+      vt100_screen_put(screen, run, p - run);
+      if (p == end)
+        break;
+    }
+
+    if (*p == '\x1b') {
+      seq_end = vt100_seq_end(p, end);
+      if (seq_end == end && !vt100_seq_complete(p, seq_end)) {
+        if (end - p < (int)sizeof(screen->pending)) {
+          memcpy(screen->pending, p, end - p);
+          screen->npending = end - p;
+        } else {
+          screen->discard = p[1];
+          screen->discard_esc = end[-1] == '\x1b';
+        }
+        break;
+      }
+      vt100_screen_esc(screen, p, seq_end);
+      p = seq_end;
+    } else {
+      vt100_screen_control(screen, *p++);
+    }
+  }
+}
+
+/*
+ * vt100_screen_encode: Renders the scrollback
+ *   (if history is nonzero) and the screen as
+ *   a string, with graphics encoded as SGR
+ *   sequences unless plain is nonzero
+ */
+inline char *vt100_screen_encode(struct vt100_screen_t *screen, int history,
+                                 int plain) {
+  int count = history ? screen->history->count : 0;
+  int lines = screen->rows + count;
+  size_t size = 256, len = 0, sgr_len;
+  char *out = (char *)VT100_MALLOC(size);
+  const char *sgr;
+  struct vt100_cell_t *line;
+  int style = -1, n;
+
+  for (int i = 0; i < lines; i++) {
+    line = i < count ? vt100_screen_history(screen, i)
+                     : screen->lines[i - count];
+
+    n = vt100_screen_line_len(screen, line);
+    for (int x = 0; x < n; x++) {
+      if (len + 160 > size)
+        out = (char *)VT100_REALLOC(out, (size *= 2));
+
+      if (!plain && line[x].style != style) {
+        style = line[x].style;
+        sgr = vt100_style_sgr(screen->styles, style);
+        sgr_len = strlen(sgr);
+        memcpy(out + len, sgr, sgr_len);
+        len += sgr_len;
+      }
+      if (line[x].ch)
+        len += vt100_screen_cluster(screen, line[x].ch, out + len);
+    }
+
+    if (len + 2 > size)
+      out = (char *)VT100_REALLOC(out, (size *= 2));
+    if (i < lines - 1)
+      out[len++] = '\n';
+  }
+
+  out[len] = '\0';
+  return out;
+}
+
+#endif
@@ -0,0 +1,436 @@
+/*
+ * vt100scrollback.h: Compact, compressed storage for scrollback history
+ *
+ * Lines are kept in a fixed-capacity ring.  Their text is stored as UTF-8
+ *   in large pages, followed by their attributes as runs of
+ *   (style id, cell count), with ids from the vt100_styles_t the cells
+ *   were written with.  Pages older than the most recent few are compressed,
+ *   and transparently decompressed (one page at a time) when read.
+ *   Cells that are not codepoints (see vt100screen.h) are encoded the same
+ *   way, so they come back as they were.
+ */
+
+#ifndef __VT100SCROLLBACK_H
+#define __VT100SCROLLBACK_H
+
+#include "vt100utils.h"
+
+/**
+ * PREPROCESSOR
+ */
+#define VT100_SB_PAGE_SIZE 16384
+#define VT100_SB_HOT_PAGES 2 /* Most recent pages kept uncompressed */
+#define VT100_SB_MAX_CELLS 2000 /* Longer lines are truncated */
+
+/**
+ * STRUCTS
+ */
+struct vt100_sb_run_t {
+  uint16_t style;
+  uint16_t count;
+};
+
+struct vt100_sb_line_t {
+  const char *text; /* UTF-8, not null-terminated */
+  int len;
+  const struct vt100_sb_run_t *runs;
+  int nruns;
+};
+
+struct vt100_sb_page_t {
+  char *data; /* Raw contents, or NULL once compressed */
+  char *z;    /* Compressed contents */
+  int len, z_len;
+  int live; /* Lines still in the ring */
+};
+
+struct vt100_scrollback_t {
+  /* Ring of (page, offset) per line */
+  uint32_t *line_page, *line_offset;
+  int capacity, count, head;
+
+  /* Pages, where page id i is pages[i - first_page] */
+  struct vt100_sb_page_t *pages;
+  int npages, pages_size;
+  uint32_t first_page;
+
+  /* Most recently decompressed page */
+  uint32_t cache_page;
+  char *cache;
+  struct vt100_sb_run_t *run_buf;
+};
+
+/**
+ * COMPRESSION
+ */
+
+/*
+ * vt100_lz_compress: Compresses n bytes (an LZ77
+ *   variant in the style of LZ4) into dst, which
+ *   must hold vt100_lz_bound(n) bytes, returning
+ *   the compressed size
+ */
+inline int vt100_lz_bound(int n) { return n + n / 255 + 16; }
+
+inline uint8_t *vt100_lz_length(uint8_t *out, int len) {
+  for (; len >= 255; len -= 255)
+    *out++ = 255;
+  *out++ = len;
+  return out;
+}
+
+inline int vt100_lz_compress(const char *src, int n, char *dst) {
+  const uint8_t *in = (const uint8_t *)src, *anchor = in, *end = in + n;
+  uint8_t *out = (uint8_t *)dst, *token;
+  int table[4096], pos, len, lits;
+  uint32_t seq, hash;
+
+  for (int i = 0; i < 4096; i++)
+    table[i] = -1;
+
+  for (const uint8_t *p = in; p + 4 <= end;) {
+    memcpy(&seq, p, 4);
+    hash = (seq * 2654435761u) >> 20;
+    pos = table[hash];
+    table[hash] = p - in;
+
+    if (pos < 0 || p - in - pos > 65535 || memcmp(in + pos, p, 4) != 0) {
+      p++;
+      continue;
+    }
+
+    for (len = 4; p + len < end && in[pos + len] == p[len]; len++)
+      ;
+
+    lits = p - anchor;
+    token = out++;
+    *token = (lits >= 15 ? 15 : lits) << 4 | (len - 4 >= 15 ? 15 : len - 4);
+    if (lits >= 15)
+      out = vt100_lz_length(out, lits - 15);
+    memcpy(out, anchor, lits);
+    out += lits;
+    out[0] = (p - in - pos) & 0xff;
+    out[1] = (p - in - pos) >> 8;
+    out += 2;
+    if (len - 4 >= 15)
+      out = vt100_lz_length(out, len - 4 - 15);
+
+    p += len;
+    anchor = p;
+  }
+
+  /* Trailing literals, with no match */
+  lits = end - anchor;
+  token = out++;
+  *token = (lits >= 15 ? 15 : lits) << 4;
+  if (lits >= 15)
+    out = vt100_lz_length(out, lits - 15);
+  memcpy(out, anchor, lits);
+  out += lits;
+
+  return out - (uint8_t *)dst;
+}
+
+inline int vt100_lz_decompress(const char *src, int n, char *dst) {
+  const uint8_t *in = (const uint8_t *)src, *end = in + n;
+  uint8_t *out = (uint8_t *)dst;
+  int lits, len, offset;
+
+  while (in < end) {
+    lits = *in >> 4;
+    len = (*in++ & 15) + 4;
+    if (lits == 15) {
+      do
+        lits += *in;
+      while (*in++ == 255);
+    }
+    memcpy(out, in, lits);
+    out += lits;
+    in += lits;
+    if (in >= end)
+      break;
+
+    offset = in[0] | (in[1] << 8);
+    in += 2;
+    if (len == 19) {
+      do
+        len += *in;
+      while (*in++ == 255);
+    }
+    /* Byte by byte, since matches may overlap their own output */
+    for (int i = 0; i < len; i++, out++)
+      *out = out[-offset];
+  }
+
+  return out - (uint8_t *)dst;
+}
+
+/**
+ * LIBRARY FUNCTIONS
+ */
+
+/*
+ * vt100_scrollback_new: Creates a store
+ *   holding up to capacity lines
+ */
+inline struct vt100_scrollback_t *vt100_scrollback_new(int capacity) {
+  struct vt100_scrollback_t *sb = (struct vt100_scrollback_t *)VT100_CALLOC(
+      1, sizeof(struct vt100_scrollback_t));
+
+  sb->capacity = capacity;
+  sb->line_page = (uint32_t *)VT100_MALLOC(sizeof(uint32_t) * capacity);
+  sb->line_offset = (uint32_t *)VT100_MALLOC(sizeof(uint32_t) * capacity);
+  sb->cache_page = UINT32_MAX;
+  sb->cache = (char *)VT100_MALLOC(VT100_SB_PAGE_SIZE);
+  sb->run_buf = (struct vt100_sb_run_t *)VT100_MALLOC(VT100_SB_PAGE_SIZE);
+
+  return sb;
+}
+
+inline void vt100_scrollback_free(struct vt100_scrollback_t *sb) {
+  for (int i = 0; i < sb->npages; i++) {
+    VT100_FREE(sb->pages[i].data);
+    VT100_FREE(sb->pages[i].z);
+  }
+  VT100_FREE(sb->pages);
+  VT100_FREE(sb->line_page);
+  VT100_FREE(sb->line_offset);
+  VT100_FREE(sb->cache);
+  VT100_FREE(sb->run_buf);
+  VT100_FREE(sb);
+}
+
+inline struct vt100_sb_page_t *vt100_scrollback_page(struct vt100_scrollback_t *sb,
+                                                     uint32_t id) {
+  return &sb->pages[id - sb->first_page];
+}
+
+inline void vt100_scrollback_compress(struct vt100_sb_page_t *page) {
+  page->z = (char *)VT100_MALLOC(vt100_lz_bound(page->len));
+  page->z_len = vt100_lz_compress(page->data, page->len, page->z);
+  page->z = (char *)VT100_REALLOC(page->z, page->z_len);
+  VT100_FREE(page->data);
+  page->data = NULL;
+}
+
+/*
+ * vt100_scrollback_seal: Compresses the page
+ *   which just left the hot set
+ */
+inline void vt100_scrollback_seal(struct vt100_scrollback_t *sb) {
+  struct vt100_sb_page_t *page;
+
+  if (sb->npages <= VT100_SB_HOT_PAGES)
+    return;
+  page = &sb->pages[sb->npages - 1 - VT100_SB_HOT_PAGES];
+  if (!page->data || page->live == 0)
+    return;
+  vt100_scrollback_compress(page);
+}
+
+/*
+ * vt100_scrollback_evict: Drops the oldest line,
+ *   freeing its page if no lines remain in it
+ */
+inline void vt100_scrollback_evict(struct vt100_scrollback_t *sb) {
+  struct vt100_sb_page_t *page =
+      vt100_scrollback_page(sb, sb->line_page[sb->head]);
+
+  sb->head = (sb->head + 1) % sb->capacity;
+  sb->count--;
+
+  if (--page->live == 0 && page == &sb->pages[0] && sb->npages > 1) {
+    VT100_FREE(page->data);
+    VT100_FREE(page->z);
+    memmove(sb->pages, sb->pages + 1,
+            sizeof(struct vt100_sb_page_t) * --sb->npages);
+    sb->first_page++;
+  }
+}
+
+/*
+ * vt100_scrollback_push: Appends a line of n
+ *   cells, evicting the oldest line if full
+ */
+inline void vt100_scrollback_push(struct vt100_scrollback_t *sb,
+                                  const struct vt100_cell_t *cells, int n) {
+  struct vt100_sb_page_t *page;
+  struct vt100_sb_run_t run;
+  uint16_t len = 0, nruns = 0;
+  char *p, *text;
+  int slot, size;
+
+  if (sb->capacity == 0)
+    return;
+  /* Keep the worst case within one page */
+  if (n > VT100_SB_MAX_CELLS)
+    n = VT100_SB_MAX_CELLS;
+  if (sb->count == sb->capacity)
+    vt100_scrollback_evict(sb);
+
+  size = 4 + n * 4 + n * (int)sizeof(run);
+  page = sb->npages ? &sb->pages[sb->npages - 1] : NULL;
+  if (!page || !page->data || page->len + size > VT100_SB_PAGE_SIZE) {
+    if (sb->npages == sb->pages_size) {
+      sb->pages_size = sb->pages_size ? sb->pages_size * 2 : 8;
+      sb->pages = (struct vt100_sb_page_t *)VT100_REALLOC(
+          sb->pages, sizeof(struct vt100_sb_page_t) * sb->pages_size);
+    }
+    page = &sb->pages[sb->npages++];
+    memset(page, 0, sizeof(*page));
+    page->data = (char *)VT100_MALLOC(VT100_SB_PAGE_SIZE);
+    vt100_scrollback_seal(sb);
+  }
+
+  /* Header (text length, run count), text, then runs */
+  p = page->data + page->len;
+  text = p + 4;
+  for (int i = 0; i < n; i++)
+    len += vt100_utf8_put(text + len, cells[i].ch);
+
+  p = text + len;
+  for (int i = 0; i < n; i++) {
+    run.style = cells[i].style;
+    run.count = 1;
+    while (i + 1 < n && cells[i + 1].style == run.style) {
+      run.count++;
+      i++;
+    }
+    memcpy(p, &run, sizeof(run));
+    p += sizeof(run);
+    nruns++;
+  }
+
+  memcpy(page->data + page->len, &len, 2);
+  memcpy(page->data + page->len + 2, &nruns, 2);
+
+  slot = (sb->head + sb->count) % sb->capacity;
+  sb->line_page[slot] = sb->first_page + sb->npages - 1;
+  sb->line_offset[slot] = page->len;
+  sb->count++;
+  page->live++;
+  page->len = p - page->data;
+}
+
+/*
+ * vt100_scrollback_get: Returns line i, where
+ *   0 is the oldest line kept
+ *
+ * The returned pointers remain valid until the
+ *   next call into the store.
+ */
+inline struct vt100_sb_line_t vt100_scrollback_get(struct vt100_scrollback_t *sb,
+                                                   int i) {
+  struct vt100_sb_line_t line;
+  struct vt100_sb_page_t *page;
+  uint16_t len, nruns;
+  const char *p;
+
+  i = (sb->head + i) % sb->capacity;
+  page = vt100_scrollback_page(sb, sb->line_page[i]);
+
+  if (page->data) {
+    p = page->data;
+  } else {
+    if (sb->cache_page != sb->line_page[i]) {
+      vt100_lz_decompress(page->z, page->z_len, sb->cache);
+      sb->cache_page = sb->line_page[i];
+    }
+    p = sb->cache;
+  }
+  p += sb->line_offset[i];
+
+  memcpy(&len, p, 2);
+  memcpy(&nruns, p + 2, 2);
+  line.text = p + 4;
+  line.len = len;
+  line.nruns = nruns;
+
+  /* Runs are unaligned within the page */
+  memcpy(sb->run_buf, p + 4 + len, sizeof(struct vt100_sb_run_t) * nruns);
+  line.runs = sb->run_buf;
+
+  return line;
+}
+
+/*
+ * vt100_scrollback_restyle: Replaces each
+ *   style id s in the lines kept with map[s]
+ */
+inline void vt100_scrollback_restyle(struct vt100_scrollback_t *sb,
+                                     const uint16_t *map) {
+  struct vt100_sb_page_t *page;
+  struct vt100_sb_run_t run;
+  uint16_t len, nruns;
+  char *p;
+  int slot;
+
+  /* Compressed pages are expanded, rewritten, then compressed again */
+  for (int i = 0; i < sb->npages; i++) {
+    page = &sb->pages[i];
+    if (!page->data && page->live) {
+      page->data = (char *)VT100_MALLOC(VT100_SB_PAGE_SIZE);
+      vt100_lz_decompress(page->z, page->z_len, page->data);
+    }
+  }
+
+  for (int i = 0; i < sb->count; i++) {
+    slot = (sb->head + i) % sb->capacity;
+    p = vt100_scrollback_page(sb, sb->line_page[slot])->data +
+        sb->line_offset[slot];
+    memcpy(&len, p, 2);
+    memcpy(&nruns, p + 2, 2);
+    p += 4 + len;
+    for (int r = 0; r < nruns; r++, p += sizeof(run)) {
+      memcpy(&run, p, sizeof(run));
+      run.style = map[run.style];
+      memcpy(p, &run, sizeof(run));
+    }
+  }
+
+  for (int i = 0; i < sb->npages; i++) {
+    page = &sb->pages[i];
+    if (page->z && page->data) {
+      VT100_FREE(page->z);
+      vt100_scrollback_compress(page);
+    }
+  }
+  sb->cache_page = UINT32_MAX;
+}
+
+/*
+ * vt100_scrollback_cells: Expands line i into
+ *   at most n cells, padding with blanks in
+ *   style 0, and returns the number of cells
+ *   stored
+ */
+inline int vt100_scrollback_cells(struct vt100_scrollback_t *sb, int i,
+                                  struct vt100_cell_t *cells, int n) {
+  struct vt100_sb_line_t line = vt100_scrollback_get(sb, i);
+  const uint8_t *p = (const uint8_t *)line.text, *end = p + line.len;
+  int x = 0, stored;
+  uint32_t cp;
+
+  for (int r = 0; r < line.nruns; r++) {
+    for (int k = 0; k < line.runs[r].count && x < n && p < end; k++, x++) {
+      cp = *p++;
+      if (cp >= 0xc0) {
+        int extra = cp >= 0xf0 ? 3 : cp >= 0xe0 ? 2 : 1;
+        cp &= 0x3f >> extra;
+        while (extra-- && p < end)
+          cp = (cp << 6) | (*p++ & 0x3f);
+      }
+      cells[x].ch = cp;
+      cells[x].style = line.runs[r].style;
+    }
+  }
+
+  stored = x;
+  for (; x < n; x++) {
+    cells[x].ch = ' ';
+    cells[x].style = 0;
+  }
+  return stored;
+}
+
+#endif
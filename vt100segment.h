@@ -0,0 +1,791 @@
+/*
+ * vt100segment.h: Grapheme clusters, words and line breaks in decoded text
+ *
+ * Finds the boundaries of user-perceived characters (UAX #29 grapheme
+ *   clusters), of words (UAX #29 word boundaries) and where lines may be
+ *   broken (UAX #14), within a run of text such as a node's str.  Each
+ *   function takes and returns pointers into the run, so nothing is copied.
+ *
+ * Only the common subset of each algorithm is implemented, with character
+ *   properties for the scripts terminals mostly show: Prepend characters,
+ *   Hebrew letters and the rarer line breaking classes (e.g. for
+ *   Southeast Asian scripts, which need a dictionary) are left out.
+ *   ASCII, which has few properties, is looked up in a table and never
+ *   decoded as UTF-8.
+ */
+
+#ifndef __VT100SEGMENT_H
+#define __VT100SEGMENT_H
+
+#include "vt100utils.h"
+
+/**
+ * CHARACTER PROPERTIES
+ */
+
+/* Grapheme_Cluster_Break */
+enum vt100_gcb {
+  gcb_other,
+  gcb_cr,
+  gcb_lf,
+  gcb_control,
+  gcb_extend,
+  gcb_zwj,
+  gcb_ri, /* Regional indicator, half of a flag */
+  gcb_spacing_mark,
+  gcb_l, /* Hangul jamo and syllables */
+  gcb_v,
+  gcb_t,
+  gcb_lv,
+  gcb_lvt,
+};
+
+/* Word_Break, with Hebrew letters as ALetter */
+enum vt100_wb {
+  wb_other,
+  wb_cr,
+  wb_lf,
+  wb_newline,
+  wb_extend, /* And Format */
+  wb_zwj,
+  wb_ri,
+  wb_katakana,
+  wb_aletter,
+  wb_single_quote,
+  wb_mid_num_let,
+  wb_mid_letter,
+  wb_mid_num,
+  wb_numeric,
+  wb_extend_num_let,
+  wb_wseg_space,
+};
+
+/* Line_Break, with the classes of the first character of each grapheme */
+enum vt100_lb {
+  lb_al, /* Alphabetic, and anything else not listed */
+  lb_bk, /* Mandatory break after */
+  lb_cr,
+  lb_lf,
+  lb_sp,
+  lb_zw, /* Zero width space */
+  lb_gl, /* Glue, and word joiners */
+  lb_op, /* Opening punctuation */
+  lb_cl, /* Closing punctuation */
+  lb_ex, /* Exclamation and interrogation */
+  lb_is, /* Infix separators */
+  lb_sy, /* Solidus */
+  lb_qu, /* Quotation */
+  lb_hy, /* Hyphen-minus */
+  lb_ba, /* Break after */
+  lb_bb, /* Break before */
+  lb_ns, /* Nonstarters */
+  lb_nu, /* Numeric */
+  lb_pr, /* Prefix numeric */
+  lb_po, /* Postfix numeric */
+  lb_id, /* Ideographs, kana, Hangul and emoji */
+};
+
+/* Tables for ASCII, in which every character is a grapheme cluster */
+inline constexpr struct vt100_ascii_props_t {
+  uint8_t wb[128], lb[128];
+
+  constexpr vt100_ascii_props_t() : wb(), lb() {
+    for (int c = 0; c < 128; c++) {
+      wb[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ? wb_aletter
+              : c >= '0' && c <= '9'                            ? wb_numeric
+                                                                : wb_other;
+      lb[c] = lb_al; /* Including controls, as combining marks are */
+    }
+    wb['\r'] = wb_cr;
+    wb['\n'] = wb_lf;
+    wb['\v'] = wb['\f'] = wb_newline;
+    wb['\''] = wb_single_quote;
+    wb['.'] = wb_mid_num_let;
+    wb[':'] = wb_mid_letter;
+    wb[','] = wb[';'] = wb_mid_num;
+    wb['_'] = wb_extend_num_let;
+    wb[' '] = wb_wseg_space;
+
+    for (int c = '0'; c <= '9'; c++)
+      lb[c] = lb_nu;
+    lb['\r'] = lb_cr;
+    lb['\n'] = lb_lf;
+    lb['\v'] = lb['\f'] = lb_bk;
+    lb['\t'] = lb['|'] = lb_ba;
+    lb[' '] = lb_sp;
+    lb['!'] = lb['?'] = lb_ex;
+    lb['"'] = lb['\''] = lb_qu;
+    lb['$'] = lb['+'] = lb['\\'] = lb_pr;
+    lb['%'] = lb_po;
+    lb['('] = lb['['] = lb['{'] = lb_op;
+    lb[')'] = lb[']'] = lb['}'] = lb_cl;
+    lb[','] = lb['.'] = lb[':'] = lb[';'] = lb_is;
+    lb['-'] = lb_hy;
+    lb['/'] = lb_sy;
+  }
+} vt100_ascii_props;
+
+/* Combining marks not in vt100_zero_width */
+inline constexpr uint32_t vt100_extend[][2] = {
+    {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff}, {0x2cef, 0x2cf1},
+    {0xa66f, 0xa672}, {0xa674, 0xa67d}, {0xa69e, 0xa69f},
+};
+
+/* Vowel signs and the like, which attach to the letter before them */
+inline constexpr uint32_t vt100_spacing_mark[][2] = {
+    {0x0903, 0x0903}, {0x093b, 0x093b}, {0x093e, 0x0940}, {0x0949, 0x094c},
+    {0x094e, 0x094f}, {0x0982, 0x0983}, {0x09bf, 0x09c0}, {0x09c7, 0x09c8},
+    {0x09cb, 0x09cc}, {0x0a03, 0x0a03}, {0x0a3e, 0x0a40}, {0x0b02, 0x0b03},
+    {0x0bbf, 0x0bbf}, {0x0bc1, 0x0bc2}, {0x0bc6, 0x0bc8}, {0x0bca, 0x0bcc},
+    {0x0c01, 0x0c03}, {0x0c41, 0x0c44}, {0x0d02, 0x0d03}, {0x0d3f, 0x0d40},
+    {0x0d46, 0x0d48}, {0x0d4a, 0x0d4c}, {0x0e33, 0x0e33}, {0x0eb3, 0x0eb3},
+};
+
+/* Extended_Pictographic, which ZWJ joins into one emoji */
+inline constexpr uint32_t vt100_pictographic[][2] = {
+    {0x00a9, 0x00a9},   {0x00ae, 0x00ae},   {0x203c, 0x203c},
+    {0x2049, 0x2049},   {0x2122, 0x2122},   {0x2139, 0x2139},
+    {0x2194, 0x2199},   {0x21a9, 0x21aa},   {0x231a, 0x231b},
+    {0x2328, 0x2328},   {0x23cf, 0x23cf},   {0x23e9, 0x23f3},
+    {0x23f8, 0x23fa},   {0x24c2, 0x24c2},   {0x25aa, 0x25ab},
+    {0x25b6, 0x25b6},   {0x25c0, 0x25c0},   {0x25fb, 0x25fe},
+    {0x2600, 0x27bf},   {0x2934, 0x2935},   {0x2b05, 0x2b07},
+    {0x2b1b, 0x2b1c},   {0x2b50, 0x2b50},   {0x2b55, 0x2b55},
+    {0x3030, 0x3030},   {0x303d, 0x303d},   {0x3297, 0x3297},
+    {0x3299, 0x3299},   {0x1f000, 0x1f0ff}, {0x1f10d, 0x1f10f},
+    {0x1f12f, 0x1f12f}, {0x1f16c, 0x1f171}, {0x1f17e, 0x1f17f},
+    {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f1ad, 0x1f1e5},
+    {0x1f201, 0x1f20f}, {0x1f21a, 0x1f21a}, {0x1f22f, 0x1f22f},
+    {0x1f232, 0x1f23a}, {0x1f23c, 0x1f23f}, {0x1f249, 0x1f3fa},
+    {0x1f400, 0x1f53d}, {0x1f546, 0x1f64f}, {0x1f680, 0x1f6ff},
+    {0x1f774, 0x1f77f}, {0x1f7d5, 0x1f7ff}, {0x1f80c, 0x1f80f},
+    {0x1f848, 0x1f84f}, {0x1f85a, 0x1f85f}, {0x1f888, 0x1f88f},
+    {0x1f8ae, 0x1f8ff}, {0x1f90c, 0x1f93a}, {0x1f93c, 0x1f945},
+    {0x1f947, 0x1faff}, {0x1fc00, 0x1fffd},
+};
+
+/* Ideographs and kana, each of which is a word of its own */
+inline constexpr uint32_t vt100_ideographic[][2] = {
+    {0x2e80, 0x2fdf},   {0x3005, 0x3007},   {0x3021, 0x3029},
+    {0x3038, 0x303c},   {0x3041, 0x3096},   {0x309d, 0x309f},
+    {0x3400, 0x4dbf},   {0x4e00, 0x9fff},   {0xf900, 0xfaff},
+    {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+};
+
+/* Punctuation and symbols, which are not letters */
+inline constexpr uint32_t vt100_symbols[][2] = {
+    {0x00a1, 0x00a9},   {0x00ab, 0x00b4},   {0x00b6, 0x00b9},
+    {0x00bb, 0x00bf},   {0x00d7, 0x00d7},   {0x00f7, 0x00f7},
+    {0x037e, 0x037e},   {0x0387, 0x0387},   {0x055a, 0x055f},
+    {0x0589, 0x058a},   {0x05be, 0x05be},   {0x05c0, 0x05c0},
+    {0x05c3, 0x05c3},   {0x05c6, 0x05c6},   {0x05f3, 0x05f4},
+    {0x060c, 0x060d},   {0x061b, 0x061f},   {0x066a, 0x066d},
+    {0x06d4, 0x06d4},   {0x0964, 0x0965},   {0x0970, 0x0970},
+    {0x0e3f, 0x0e3f},   {0x0e4f, 0x0e4f},   {0x0e5a, 0x0e5b},
+    {0x2000, 0x2bff},   {0x2e00, 0x2e7f},   {0x3000, 0x3004},
+    {0x3008, 0x3020},   {0x3030, 0x3030},   {0x303d, 0x303f},
+    {0x3200, 0x33ff},   {0x4dc0, 0x4dff},   {0xfe10, 0xfe19},
+    {0xfe30, 0xfe6f},   {0xff01, 0xff0f},   {0xff1a, 0xff20},
+    {0xff3b, 0xff40},   {0xff5b, 0xff65},   {0xffe0, 0xffef},
+    {0x1f000, 0x1faff},
+};
+
+inline int vt100_is_extend(uint32_t cp) {
+  return vt100_in_ranges(vt100_zero_width, cp) ||
+         vt100_in_ranges(vt100_extend, cp);
+}
+
+inline int vt100_is_pictographic(uint32_t cp) {
+  return cp >= 0xa9 && vt100_in_ranges(vt100_pictographic, cp);
+}
+
+inline enum vt100_gcb vt100_gcb_of(uint32_t cp) {
+  if (cp < 0x80)
+    return cp == '\r' ? gcb_cr
+           : cp == '\n'                 ? gcb_lf
+           : cp < 0x20 || cp == 0x7f    ? gcb_control
+                                        : gcb_other;
+  if (cp < 0xa0 || cp == 0xad)
+    return gcb_control;
+  if (cp < 0x300)
+    return gcb_other;
+
+  if ((cp >= 0x1100 && cp <= 0x115f) || (cp >= 0xa960 && cp <= 0xa97c))
+    return gcb_l;
+  if ((cp >= 0x1160 && cp <= 0x11a7) || (cp >= 0xd7b0 && cp <= 0xd7c6))
+    return gcb_v;
+  if ((cp >= 0x11a8 && cp <= 0x11ff) || (cp >= 0xd7cb && cp <= 0xd7fb))
+    return gcb_t;
+  if (cp >= 0xac00 && cp <= 0xd7a3)
+    return (cp - 0xac00) % 28 == 0 ? gcb_lv : gcb_lvt;
+
+  if (cp == 0x200d)
+    return gcb_zwj;
+  if (cp == 0x200b || cp == 0x200e || cp == 0x200f || cp == 0x2028 ||
+      cp == 0x2029 || (cp >= 0x202a && cp <= 0x202e) ||
+      (cp >= 0x2060 && cp <= 0x206f) || cp == 0xfeff ||
+      (cp >= 0xfff0 && cp <= 0xfffb) || (cp >= 0xe0000 && cp <= 0xe001f))
+    return gcb_control;
+  if (cp >= 0x1f1e6 && cp <= 0x1f1ff)
+    return gcb_ri;
+  if (vt100_in_ranges(vt100_spacing_mark, cp))
+    return gcb_spacing_mark;
+  return vt100_is_extend(cp) ? gcb_extend : gcb_other;
+}
+
+inline enum vt100_wb vt100_wb_of(uint32_t cp) {
+  if (cp < 0x80)
+    return (enum vt100_wb)vt100_ascii_props.wb[cp];
+
+  switch (cp) {
+  case 0x85:
+  case 0x2028:
+  case 0x2029:
+    return wb_newline;
+  case 0x2018:
+  case 0x2019:
+  case 0x2024:
+  case 0xfe52:
+  case 0xff07:
+  case 0xff0e:
+    return wb_mid_num_let;
+  case 0xb7:
+  case 0x387:
+  case 0x5f4:
+  case 0x2027:
+  case 0xfe13:
+  case 0xfe55:
+  case 0xff1a:
+    return wb_mid_letter;
+  case 0x37e:
+  case 0x589:
+  case 0x60c:
+  case 0x60d:
+  case 0x66c:
+  case 0x2044:
+  case 0xfe10:
+  case 0xfe14:
+  case 0xfe50:
+  case 0xfe54:
+  case 0xff0c:
+  case 0xff1b:
+    return wb_mid_num;
+  case 0x202f:
+  case 0x203f:
+  case 0x2040:
+  case 0x2054:
+  case 0xfe33:
+  case 0xfe34:
+  case 0xff3f:
+    return wb_extend_num_let;
+  case 0x1680:
+  case 0x205f:
+  case 0x3000:
+    return wb_wseg_space;
+  case 0x200d:
+    return wb_zwj;
+  case 0xad:
+  case 0x200e:
+  case 0x200f:
+  case 0xfeff:
+    return wb_extend;
+  }
+  if (cp < 0xa0)
+    return wb_other;
+  if ((cp >= 0x2000 && cp <= 0x2006) || (cp >= 0x2008 && cp <= 0x200a))
+    return wb_wseg_space;
+  if ((cp >= 0x202a && cp <= 0x202e) || (cp >= 0x2060 && cp <= 0x2064))
+    return wb_extend;
+  if (cp >= 0x1f1e6 && cp <= 0x1f1ff)
+    return wb_ri;
+  if ((cp >= 0x30a0 && cp <= 0x30ff && cp != 0x30fb) ||
+      (cp >= 0x31f0 && cp <= 0x31ff) || (cp >= 0x3031 && cp <= 0x3035) ||
+      cp == 0x309b || cp == 0x309c || (cp >= 0xff66 && cp <= 0xff9d))
+    return wb_katakana;
+  if ((cp >= 0x660 && cp <= 0x669) || (cp >= 0x6f0 && cp <= 0x6f9) ||
+      (cp >= 0x966 && cp <= 0x96f) || (cp >= 0xff10 && cp <= 0xff19))
+    return wb_numeric;
+  if (cp >= 0x300 && vt100_gcb_of(cp) >= gcb_extend &&
+      vt100_gcb_of(cp) <= gcb_spacing_mark)
+    return wb_extend;
+  if (vt100_in_ranges(vt100_symbols, cp) ||
+      vt100_in_ranges(vt100_ideographic, cp))
+    return wb_other;
+  return wb_aletter;
+}
+
+inline enum vt100_lb vt100_lb_of(uint32_t cp) {
+  if (cp < 0x80)
+    return (enum vt100_lb)vt100_ascii_props.lb[cp];
+
+  switch (cp) {
+  case 0x85:
+  case 0x2028:
+  case 0x2029:
+    return lb_bk;
+  case 0x200b:
+    return lb_zw;
+  case 0xa0:
+  case 0x202f:
+  case 0x2007:
+  case 0x2011:
+  case 0x2060:
+  case 0xfeff:
+    return lb_gl;
+  case 0xab:
+  case 0xbb:
+    return lb_qu;
+  case 0xb4:
+    return lb_bb;
+  case 0xad:
+  case 0x2010:
+  case 0x2012:
+  case 0x2013:
+    return lb_ba;
+  case 0xa2:
+  case 0xb0:
+  case 0x2030:
+  case 0x2031:
+  case 0x2032:
+  case 0x2033:
+  case 0xff05:
+    return lb_po;
+  case 0xa3:
+  case 0xa4:
+  case 0xa5:
+  case 0xb1:
+  case 0x20ac:
+  case 0xff04:
+    return lb_pr;
+  case 0x3001:
+  case 0x3002:
+  case 0xff0c:
+  case 0xff0e:
+  case 0x3009:
+  case 0x300b:
+  case 0x300d:
+  case 0x300f:
+  case 0x3011:
+  case 0x3015:
+  case 0xff09:
+  case 0xff3d:
+  case 0xff5d:
+    return lb_cl;
+  case 0x3008:
+  case 0x300a:
+  case 0x300c:
+  case 0x300e:
+  case 0x3010:
+  case 0x3014:
+  case 0xff08:
+  case 0xff3b:
+  case 0xff5b:
+    return lb_op;
+  case 0xff01:
+  case 0xff1f:
+    return lb_ex;
+  case 0x3005:
+  case 0x301c:
+  case 0x303b:
+  case 0x303c:
+  case 0x30a0:
+  case 0x30fb:
+  case 0x30fc:
+  case 0xff1a:
+  case 0xff1b:
+    return lb_ns;
+  }
+  if ((cp >= 0x2000 && cp <= 0x2006) || (cp >= 0x2008 && cp <= 0x200a))
+    return lb_ba;
+  if (cp >= 0x2018 && cp <= 0x201f)
+    return lb_qu;
+  if ((cp >= 0x660 && cp <= 0x669) || (cp >= 0x6f0 && cp <= 0x6f9) ||
+      (cp >= 0x966 && cp <= 0x96f))
+    return lb_nu;
+  if (vt100_in_ranges(vt100_ideographic, cp) ||
+      (cp >= 0x30a1 && cp <= 0x30fa) || (cp >= 0xac00 && cp <= 0xd7a3) ||
+      (cp >= 0x1100 && cp <= 0x11ff) || (cp >= 0xff66 && cp <= 0xff9d) ||
+      (cp >= 0x1f1e6 && cp <= 0x1f1ff) || vt100_is_pictographic(cp))
+    return lb_id;
+  return lb_al;
+}
+
+/**
+ * GRAPHEME CLUSTERS
+ */
+
+/*
+ * vt100_grapheme_next: Returns the end of the
+ *   grapheme cluster starting at str
+ */
+inline const char *vt100_grapheme_next(const char *str, const char *end) {
+  const char *p = str, *q;
+  enum vt100_gcb prev, next;
+  uint32_t cp;
+  int emoji, ri;
+
+  if (str >= end)
+    return end;
+
+  /* ASCII before ASCII is always a boundary, but for CR LF */
+  if ((uint8_t)str[0] < 0x80 &&
+      (str + 1 == end || (uint8_t)str[1] < 0x80 || str[0] < 0x20 ||
+       str[0] == 0x7f))
+    return str + 1 + (str[0] == '\r' && str + 1 < end && str[1] == '\n');
+
+  cp = vt100_utf8_get(&p, end);
+  prev = vt100_gcb_of(cp);
+  if (prev == gcb_control || prev == gcb_lf)
+    return p;
+  emoji = vt100_is_pictographic(cp);
+  ri = prev == gcb_ri;
+
+  while (p < end) {
+    q = p;
+    cp = vt100_utf8_get(&q, end);
+    next = vt100_gcb_of(cp);
+
+    if (next == gcb_control || next == gcb_cr || next == gcb_lf)
+      break;
+    if (prev == gcb_l &&
+        (next == gcb_l || next == gcb_v || next == gcb_lv || next == gcb_lvt))
+      ;
+    else if ((prev == gcb_lv || prev == gcb_v) &&
+             (next == gcb_v || next == gcb_t))
+      ;
+    else if ((prev == gcb_lvt || prev == gcb_t) && next == gcb_t)
+      ;
+    else if (next == gcb_extend || next == gcb_zwj ||
+             next == gcb_spacing_mark)
+      ;
+    else if (prev == gcb_zwj && emoji && vt100_is_pictographic(cp))
+      ;
+    else if (prev == gcb_ri && next == gcb_ri && ri % 2)
+      ;
+    else
+      break;
+
+    /* A pictograph, then only Extend until the ZWJ */
+    if (vt100_is_pictographic(cp))
+      emoji = 1;
+    else if (next != gcb_extend && next != gcb_zwj)
+      emoji = 0;
+    ri = next == gcb_ri ? ri + 1 : 0;
+    prev = next;
+    p = q;
+  }
+  return p;
+}
+
+/*
+ * vt100_grapheme_prev: Returns the start of the
+ *   grapheme cluster before str, within a run
+ *   starting at start
+ *
+ * Only ever looks back to the last ASCII
+ *   character, before which there is always
+ *   a boundary.
+ */
+inline const char *vt100_grapheme_prev(const char *start, const char *str) {
+  const char *p = str, *q;
+
+  if (str <= start)
+    return start;
+  do
+    p--;
+  while (p > start && ((uint8_t)*p >= 0x80 || *p == '\n'));
+  while ((q = vt100_grapheme_next(p, str)) < str)
+    p = q;
+  return p;
+}
+
+/**
+ * WORDS
+ */
+
+/* AHLetter, MidNumLetQ */
+#define VT100_WB_LETTER(c) ((c) == wb_aletter)
+#define VT100_WB_MID_LETTER(c)                                                 \
+  ((c) == wb_mid_letter || (c) == wb_mid_num_let || (c) == wb_single_quote)
+#define VT100_WB_MID_NUM(c)                                                    \
+  ((c) == wb_mid_num || (c) == wb_mid_num_let || (c) == wb_single_quote)
+
+/* The class of the codepoint at str, and the end of it */
+inline enum vt100_wb vt100_wb_get(const char **str, const char *end,
+                                  uint32_t *cp) {
+  if ((uint8_t)**str < 0x80) {
+    *cp = (uint8_t) * (*str)++;
+    return (enum vt100_wb)vt100_ascii_props.wb[*cp];
+  }
+  *cp = vt100_utf8_get(str, end);
+  return vt100_wb_of(*cp);
+}
+
+/* The class after str, skipping Extend, Format and ZWJ */
+inline enum vt100_wb vt100_wb_peek(const char *str, const char *end) {
+  enum vt100_wb c;
+  uint32_t cp;
+
+  while (str < end) {
+    if ((c = vt100_wb_get(&str, end, &cp)) != wb_extend && c != wb_zwj)
+      return c;
+  }
+  return wb_other;
+}
+
+/*
+ * vt100_word_next: Returns the end of the word,
+ *   run of spaces, or punctuation character
+ *   starting at str (see vt100_is_word)
+ */
+inline const char *vt100_word_next(const char *str, const char *end) {
+  const char *p = str, *q;
+  enum vt100_wb prev, next;
+  uint32_t cp;
+  int zwj = 0, mid = 0, ri;
+
+  if (str >= end)
+    return end;
+  prev = vt100_wb_get(&p, end, &cp);
+  if (prev == wb_cr)
+    return p + (p < end && *p == '\n');
+  if (prev == wb_lf || prev == wb_newline)
+    return p;
+  ri = prev == wb_ri;
+
+  while (p < end) {
+    /* Runs of ASCII letters and digits */
+    if ((prev == wb_aletter || prev == wb_numeric) && !mid) {
+      while (p < end && (uint8_t)*p < 0x80 &&
+             (vt100_ascii_props.wb[(uint8_t)*p] == wb_aletter ||
+              vt100_ascii_props.wb[(uint8_t)*p] == wb_numeric)) {
+        prev = (enum vt100_wb)vt100_ascii_props.wb[(uint8_t)*p];
+        p++;
+      }
+      if (p == end)
+        break;
+    }
+
+    q = p;
+    next = vt100_wb_get(&q, end, &cp);
+    if (next == wb_cr || next == wb_lf || next == wb_newline)
+      break;
+
+    /* Extend, Format and ZWJ belong to what they follow */
+    if (next == wb_extend || next == wb_zwj) {
+      zwj = next == wb_zwj;
+      p = q;
+      continue;
+    }
+
+    if (zwj && vt100_is_pictographic(cp))
+      ;
+    else if (prev == wb_wseg_space && next == wb_wseg_space)
+      ;
+    else if (mid)
+      ; /* The letter or digit that let the punctuation join */
+    else if ((VT100_WB_LETTER(prev) || prev == wb_numeric) &&
+             (VT100_WB_LETTER(next) || next == wb_numeric))
+      ;
+    else if (VT100_WB_LETTER(prev) && VT100_WB_MID_LETTER(next) &&
+             VT100_WB_LETTER(vt100_wb_peek(q, end)))
+      mid = 2;
+    else if (prev == wb_numeric && VT100_WB_MID_NUM(next) &&
+             vt100_wb_peek(q, end) == wb_numeric)
+      mid = 2;
+    else if (prev == wb_katakana && next == wb_katakana)
+      ;
+    else if ((VT100_WB_LETTER(prev) || prev == wb_numeric ||
+              prev == wb_katakana || prev == wb_extend_num_let) &&
+             next == wb_extend_num_let)
+      ;
+    else if (prev == wb_extend_num_let &&
+             (VT100_WB_LETTER(next) || next == wb_numeric ||
+              next == wb_katakana))
+      ;
+    else if (prev == wb_ri && next == wb_ri && ri % 2)
+      ;
+    else
+      break;
+
+    mid = mid ? mid - 1 : 0;
+    ri = next == wb_ri ? ri + 1 : 0;
+    zwj = 0;
+    prev = next;
+    p = q;
+  }
+  return p;
+}
+
+/*
+ * vt100_is_word: Returns whether the segment
+ *   found by vt100_word_next is a word (of
+ *   letters, digits, ideographs or emoji),
+ *   rather than spaces or punctuation
+ */
+inline int vt100_is_word(const char *str, const char *end) {
+  enum vt100_wb c;
+  uint32_t cp;
+
+  while (str < end) {
+    c = vt100_wb_get(&str, end, &cp);
+    if (c == wb_aletter || c == wb_numeric || c == wb_katakana ||
+        c == wb_extend_num_let || c == wb_ri ||
+        (cp >= 0x2e80 && vt100_in_ranges(vt100_ideographic, cp)) ||
+        vt100_is_pictographic(cp))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * LINE BREAKS
+ */
+
+/* The class of the grapheme at str, and its end */
+inline enum vt100_lb vt100_lb_get(const char **str, const char *end) {
+  const char *p = *str;
+  uint32_t cp;
+
+  *str = vt100_grapheme_next(p, end);
+  if ((uint8_t)*p < 0x80)
+    return (enum vt100_lb)vt100_ascii_props.lb[(uint8_t)*p];
+  cp = vt100_utf8_get(&p, end);
+  return vt100_lb_of(cp);
+}
+
+/*
+ * vt100_line_next: Returns the first place after
+ *   str where a line may be broken (after any
+ *   spaces), setting mandatory if it must be
+ *   (after a newline)
+ *
+ * Lines are only broken between grapheme
+ *   clusters.
+ */
+inline const char *vt100_line_next(const char *str, const char *end,
+                                   int *mandatory) {
+  const char *p = str, *q;
+  enum vt100_lb base, last, next;
+
+  *mandatory = 0;
+  if (str >= end)
+    return end;
+  last = base = vt100_lb_get(&p, end);
+  if (base == lb_bk || base == lb_lf || base == lb_cr) {
+    *mandatory = 1;
+    return p;
+  }
+
+  while (p < end) {
+    q = p;
+    next = vt100_lb_get(&q, end);
+
+    if (next == lb_bk || next == lb_lf || next == lb_cr) {
+      *mandatory = 1;
+      return q;
+    }
+    if (next == lb_sp) {
+      last = lb_sp;
+      p = q;
+      continue;
+    }
+    if (base == lb_zw && next != lb_zw)
+      break;
+    if (next == lb_zw)
+      ;
+    else if (next == lb_gl && !(last == lb_sp || last == lb_ba ||
+                                last == lb_hy))
+      ;
+    else if (last == lb_gl)
+      ;
+    else if (next == lb_cl || next == lb_ex || next == lb_is || next == lb_sy)
+      ;
+    else if (base == lb_op)
+      ; /* Even after spaces */
+    else if (base == lb_qu && next == lb_op)
+      ;
+    else if (base == lb_cl && next == lb_ns)
+      ;
+    else if (last == lb_sp)
+      break;
+    else if (next == lb_qu || last == lb_qu)
+      ;
+    else if (next == lb_ba || next == lb_hy || next == lb_ns || last == lb_bb)
+      ;
+    else if ((last == lb_al && (next == lb_nu || next == lb_al ||
+                                next == lb_pr || next == lb_po)) ||
+             (last == lb_nu && (next == lb_al || next == lb_nu ||
+                                next == lb_po || next == lb_pr)))
+      ;
+    else if ((last == lb_pr || last == lb_po) &&
+             (next == lb_al || next == lb_nu || next == lb_op))
+      ;
+    else if ((last == lb_pr && next == lb_id) ||
+             (last == lb_id && next == lb_po))
+      ;
+    else if ((last == lb_hy || last == lb_is || last == lb_sy) &&
+             next == lb_nu)
+      ;
+    else if (last == lb_is && next == lb_al)
+      ;
+    else if ((last == lb_al || last == lb_nu) && next == lb_op)
+      ;
+    else if (last == lb_cl && (next == lb_al || next == lb_nu))
+      ;
+    else
+      break;
+
+    base = last = next;
+    p = q;
+  }
+  return p;
+}
+
+/*
+ * vt100_wrap: Returns where the first line of
+ *   the text at str ends when wrapped to cols
+ *   columns, setting width to its width (not
+ *   counting the spaces it ends with)
+ *
+ * Lines end after a newline, or at the last
+ *   break opportunity that fits; a word too
+ *   long for a line of its own is broken
+ *   between grapheme clusters.
+ */
+inline const char *vt100_wrap(const char *str, const char *end, int cols,
+                              int *width) {
+  const char *p = str, *q, *t;
+  int w = 0, seg, mandatory;
+
+  *width = 0;
+  while (p < end) {
+    q = vt100_line_next(p, end, &mandatory);
+    /* Trailing spaces may hang past the edge */
+    for (t = q; t > p && (t[-1] == ' ' || t[-1] == '\n' || t[-1] == '\r');)
+      t--;
+    seg = vt100_width(p, t - p);
+    if (w + seg > cols) {
+      if (p != str)
+        return p;
+      /* Too long for a line of its own */
+      for (q = p; p < t; p = q) {
+        q = vt100_grapheme_next(p, t);
+        seg = vt100_width(p, q - p);
+        if (w + seg > cols && p != str)
+          break;
+        w += seg;
+      }
+      *width = w;
+      return p;
+    }
+    *width = w + seg;
+    w += vt100_width(p, q - p);
+    p = q;
+    if (mandatory)
+      break;
+  }
+  return p;
+}
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * vt100static.h: Styled text built and decoded at compile time
+ *
+ * vt100_static_build formats spans of text with typed attributes into an
+ *   escape-coded literal, and vt100_static<"..."> decodes a literal into a
+ *   static array of runs, each with its text and a preformatted SGR
+ *   sequence.  Both happen during compilation, so static text costs no
+ *   decoding or allocation at runtime, and a malformed or unsupported
+ *   escape sequence in a literal is a compile error.
+ *
+ * Colors are kept as written; unlike vt100_sgr, nothing is downsampled to
+ *   global_depth.
+ */
+
+#ifndef __VT100STATIC_H
+#define __VT100STATIC_H
+
+#include "vt100utils.h"
+
+#include <array>
+#include <initializer_list>
+#include <string_view>
+
+/**
+ * STRUCTS
+ */
+
+/* A string literal usable as a template argument */
+template <size_t N> struct vt100_literal_t {
+  char str[N] = {};
+
+  consteval vt100_literal_t() = default;
+  consteval vt100_literal_t(const char (&s)[N]) {
+    for (size_t i = 0; i < N; i++)
+      str[i] = s[i];
+  }
+};
+
+/* Text with attributes, for vt100_static_build */
+struct vt100_span_t {
+  const char *str;
+  struct vt100_color_t fg = default_fg, bg = default_bg, ul = default_ul;
+  uint8_t mode = 0;
+  uint8_t ul_style = 0;
+};
+
+struct vt100_run_t {
+  uint32_t str, sgr; /* Offsets of null-terminated strings in the text */
+  int len;           /* strlen(str) + 1, as for nodes */
+  int sgr_len;       /* strlen(sgr) */
+  struct vt100_color_t fg, bg, ul;
+  uint8_t mode, ul_style;
+};
+
+template <size_t N, size_t R> struct vt100_static_text_t {
+  char text[N];
+  std::array<struct vt100_run_t, R> runs;
+
+  constexpr size_t count() const { return R; }
+  constexpr std::string_view str(size_t i) const {
+    return {&text[runs[i].str], (size_t)runs[i].len - 1};
+  }
+  constexpr std::string_view sgr(size_t i) const {
+    return {&text[runs[i].sgr], (size_t)runs[i].sgr_len};
+  }
+
+  /*
+   * nodes: Returns unlinked nodes carrying each
+   *   run's attributes, to be copied and
+   *   modified at runtime (their strings
+   *   must not be written or freed)
+   */
+  constexpr std::array<struct vt100_node_t, R> nodes() const {
+    std::array<struct vt100_node_t, R> out = {};
+    for (size_t i = 0; i < R; i++) {
+      out[i].str = const_cast<char *>(&text[runs[i].str]);
+      out[i].len = runs[i].len;
+      out[i].fg = runs[i].fg;
+      out[i].bg = runs[i].bg;
+      out[i].ul = runs[i].ul;
+      out[i].mode = runs[i].mode;
+      out[i].ul_style = runs[i].ul_style;
+    }
+    return out;
+  }
+};
+
+/**
+ * LIBRARY FUNCTIONS
+ */
+
+/* Not constexpr, so reaching it during constant evaluation fails to compile */
+inline void vt100_static_error(const char *) {}
+
+constexpr int vt100_static_int(char *out, int value) {
+  char digits[10];
+  int n = 0, len = 0;
+
+  do
+    digits[n++] = '0' + value % 10;
+  while (value /= 10);
+  while (n)
+    out[len++] = digits[--n];
+  return len;
+}
+
+/*
+ * vt100_static_color: Formats the parameters
+ *   selecting a color, like vt100_sgr_color
+ */
+constexpr int vt100_static_color(char *out, struct vt100_color_t color,
+                                 int base) {
+  int len = 0;
+
+  out[len++] = ';';
+  if (base == 50 && color.type != truecolor && color.type != default_color) {
+    len += vt100_static_int(out + len, 58);
+    out[len++] = ';';
+    out[len++] = '5';
+    out[len++] = ';';
+    return len + vt100_static_int(out + len, color.type == palette_8_bright
+                                                 ? color.value + 8
+                                                 : color.value);
+  }
+
+  switch (color.type) {
+  case palette_8:
+    return len + vt100_static_int(out + len, base + color.value);
+  case palette_8_bright:
+    return len + vt100_static_int(out + len, base + 60 + color.value);
+  case palette_256:
+    len += vt100_static_int(out + len, base + 8);
+    out[len++] = ';';
+    out[len++] = '5';
+    out[len++] = ';';
+    return len + vt100_static_int(out + len, color.value);
+  case truecolor:
+    len += vt100_static_int(out + len, base + 8);
+    out[len++] = ';';
+    out[len++] = '2';
+    for (int shift = 16; shift >= 0; shift -= 8) {
+      out[len++] = ';';
+      len += vt100_static_int(out + len, (color.value >> shift) & 0xff);
+    }
+    return len;
+  case default_color:
+    return len + vt100_static_int(out + len, base + 9);
+  }
+  return 0;
+}
+
+/*
+ * vt100_static_sgr: Formats a sequence selecting
+ *   the node's attributes from a reset, into
+ *   out (which must hold 96 bytes), returning
+ *   its length
+ */
+constexpr int vt100_static_sgr(char *out, const struct vt100_node_t &node) {
+  int len = 0;
+
+  out[len++] = '\x1b';
+  out[len++] = '[';
+  out[len++] = '0';
+
+  if (node.fg.type != default_fg.type || node.fg.value != default_fg.value)
+    len += vt100_static_color(out + len, node.fg, 30);
+  if (node.bg.type != default_bg.type || node.bg.value != default_bg.value)
+    len += vt100_static_color(out + len, node.bg, 40);
+  if (node.ul.type != default_ul.type || node.ul.value != default_ul.value)
+    len += vt100_static_color(out + len, node.ul, 50);
+
+  for (int i = 0; i < 8; i++) {
+    if (!(node.mode & (1 << i)))
+      continue;
+    out[len++] = ';';
+    out[len++] = '1' + i;
+    if (i == 3 && node.ul_style > 1) {
+      out[len++] = ':';
+      out[len++] = '0' + node.ul_style;
+    }
+  }
+
+  out[len++] = 'm';
+  return len;
+}
+
+/*
+ * vt100_static_build: Formats spans into a
+ *   literal of at most N - 1 bytes, emitting
+ *   graphics only where they change
+ */
+template <size_t N>
+consteval vt100_literal_t<N>
+vt100_static_build(std::initializer_list<struct vt100_span_t> spans) {
+  vt100_literal_t<N> out;
+  struct vt100_node_t node = {}, prev = {};
+  char sgr[96] = {};
+  size_t len = 0;
+  int sgr_len;
+
+  prev.fg = node.fg = default_fg;
+  prev.bg = node.bg = default_bg;
+  prev.ul = node.ul = default_ul;
+
+  for (const struct vt100_span_t &span : spans) {
+    node.fg = span.fg;
+    node.bg = span.bg;
+    node.ul = span.ul;
+    node.mode = span.mode;
+    node.ul_style = span.ul_style;
+
+    sgr_len = 0;
+    if (!vt100_attr_eq(vt100_pack_attr(&node), vt100_pack_attr(&prev)))
+      sgr_len = vt100_static_sgr(sgr, node);
+    for (int i = 0; i < sgr_len; i++, len++) {
+      if (len + 1 >= N)
+        vt100_static_error("vt100_static_build: capacity exceeded");
+      out.str[len] = sgr[i];
+    }
+    for (const char *p = span.str; *p; p++, len++) {
+      if (len + 1 >= N)
+        vt100_static_error("vt100_static_build: capacity exceeded");
+      out.str[len] = *p;
+    }
+    prev = node;
+  }
+
+  /* Leave the terminal as it was found */
+  node = {};
+  node.fg = default_fg;
+  node.bg = default_bg;
+  node.ul = default_ul;
+  if (!vt100_attr_eq(vt100_pack_attr(&node), vt100_pack_attr(&prev))) {
+    for (const char *p = "\x1b[0m"; *p; p++, len++) {
+      if (len + 1 >= N)
+        vt100_static_error("vt100_static_build: capacity exceeded");
+      out.str[len] = *p;
+    }
+  }
+
+  return out;
+}
+
+/*
+ * vt100_static_scan: Splits str into runs of
+ *   text with the same attributes, returning
+ *   the number of runs and, through size, the
+ *   bytes of text needed
+ *
+ * If text and runs are NULL, only counts.
+ *   Only SGR sequences are accepted.
+ */
+constexpr size_t vt100_static_scan(const char *str, size_t *size,
+                                   char *text, struct vt100_run_t *runs) {
+  const char *end = str, *esc, *seq_end;
+  struct vt100_node_t node = {};
+  size_t count = 0;
+  char sgr[96] = {};
+  int sgr_len;
+
+  while (*end)
+    end++;
+  node.fg = default_fg;
+  node.bg = default_bg;
+  node.ul = default_ul;
+  *size = 0;
+
+  while (str < end) {
+    for (esc = str; esc < end && *esc != '\x1b'; esc++)
+      ;
+
+    if (esc != str) {
+      sgr_len = vt100_static_sgr(sgr, node);
+      if (runs) {
+        runs[count] = {(uint32_t)(*size + sgr_len + 1), (uint32_t)*size,
+                       (int)(esc - str + 1), sgr_len, node.fg, node.bg,
+                       node.ul, node.mode, node.ul_style};
+        for (int i = 0; i < sgr_len; i++)
+          text[*size + i] = sgr[i];
+        text[*size + sgr_len] = '\0';
+        for (int i = 0; i < esc - str; i++)
+          text[*size + sgr_len + 1 + i] = str[i];
+        text[*size + sgr_len + 1 + (esc - str)] = '\0';
+      }
+      *size += sgr_len + 1 + (esc - str) + 1;
+      count++;
+    }
+
+    if (esc == end)
+      break;
+
+    seq_end = vt100_seq_end(esc, end);
+    if (vt100_classify(esc, seq_end) != seq_sgr)
+      vt100_static_error("vt100_static: unsupported escape sequence");
+    if (vt100_apply_sgr(&node, esc + 2, seq_end - 1) != 0)
+      vt100_static_error("vt100_static: malformed SGR sequence");
+    str = seq_end;
+  }
+
+  return count;
+}
+
+template <vt100_literal_t S> consteval auto vt100_static_decode() {
+  constexpr auto sizes = [] {
+    std::array<size_t, 2> sizes = {};
+    sizes[1] = vt100_static_scan(S.str, &sizes[0], NULL, NULL);
+    return sizes;
+  }();
+  vt100_static_text_t<sizes[0], sizes[1]> out = {};
+  size_t size = 0;
+
+  vt100_static_scan(S.str, &size, out.text, out.runs.data());
+  return out;
+}
+
+/*
+ * vt100_static: The runs of a literal, decoded
+ *   at compile time
+ */
+template <vt100_literal_t S>
+inline constexpr auto vt100_static = vt100_static_decode<S>();
+
+#endif
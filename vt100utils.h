@@ -10,11 +10,48 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef VT100UTILS_INSTRUMENT
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#endif
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define VT100UTILS_SSE2
+#endif
+
 /**
  * PREPROCESSOR
  */
 #define MAX(a, b) (a > b ? a : b)
 
+/*
+ * Instrumentation: with VT100UTILS_INSTRUMENT
+ *   defined, counters and timed scopes are
+ *   accumulated in the calling thread's
+ *   stats (see vt100_stats_snapshot);
+ *   otherwise they compile to nothing
+ */
+#ifdef VT100UTILS_INSTRUMENT
+#define VT100_COUNT(counter, n)                                                \
+  vt100_stats_add(&vt100_local_stats.stats.counter, (n))
+#define VT100_SCOPE(timer)                                                     \
+  vt100_scope_t vt100_scope_##timer(&vt100_local_stats.stats.timer)
+#else
+#define VT100_COUNT(counter, n) ((void)sizeof(n))
+#define VT100_SCOPE(timer) ((void)0)
+#endif
+
+/* Allocator, which strings returned to the caller also come from */
+#ifndef VT100_MALLOC
+#define VT100_MALLOC(size) (VT100_COUNT(allocs, 1), malloc(size))
+#define VT100_CALLOC(n, size) (VT100_COUNT(allocs, 1), calloc(n, size))
+#define VT100_REALLOC(ptr, size) (VT100_COUNT(allocs, 1), realloc(ptr, size))
+#define VT100_FREE(ptr) free(ptr)
+#endif
+
 /**
  * STRUCTS and GLOBALS
  */
@@ -23,340 +60,1644 @@ enum vt100_color_type {
   palette_8_bright,
   palette_256,
   truecolor,
+  default_color, /* The terminal's default (SGR 39/49/59) */
 };
 struct vt100_color_t {
   vt100_color_type type;
   uint32_t value;
 };
 
+/* Color capability of the terminal being encoded for */
+enum vt100_color_depth {
+  depth_mono,
+  depth_8,
+  depth_16,
+  depth_256,
+  depth_truecolor,
+};
+
+/* Kinds of escape sequence recognized by the decoder */
+enum vt100_seq_type {
+  seq_none, /* Plain text */
+  seq_sgr,
+  seq_cursor,
+  seq_erase,
+  seq_hyperlink, /* OSC 8 */
+  seq_title,     /* OSC 0, 1, 2 */
+  seq_other,
+};
+
+/* Per-document table of interned hyperlink URLs */
+struct vt100_links_t {
+  char **urls; /* urls[id - 1] */
+  int count, size;
+  int *buckets; /* Open-addressed hash of ids, 0 if empty */
+  int nbuckets;
+};
+
+/*
+ * Nodes keep their attributes even when they have a style id: the id is
+ *   only assigned if global_styles is set, and the encoder, screen and
+ *   callers read and modify the attributes directly (a changed node is
+ *   re-interned when encoded, see vt100_encode).  They take 26 of the
+ *   node's 56 bytes.
+ */
 struct vt100_node_t {
   char *str;
   int len;
   struct vt100_color_t fg;
   struct vt100_color_t bg;
+  struct vt100_color_t ul; /* Underline color */
   uint8_t mode;
+  uint8_t ul_style; /* 0 none, 1 single, 2 double, 3 curly, 4 dotted, 5 dashed */
+  uint8_t seq;      /* If not seq_none, str is a raw escape sequence */
+  int link;         /* Hyperlink id (0 for none), see vt100_link_url */
+  uint16_t style;   /* Id in global_styles, if set when decoding */
   struct vt100_node_t *next;
 };
 
-static struct vt100_color_t default_fg = {palette_8, 7},
-                            default_bg = {palette_8, 0};
-static struct vt100_color_t global_fg = {palette_8, 7},
-                            global_bg = {palette_8, 0};
-static uint8_t global_mode;
+/* The first node of a chain, which also holds the chain's hyperlinks */
+struct vt100_head_t {
+  struct vt100_node_t node;
+  struct vt100_links_t *links;
+};
+
+/* Graphics state of a cell, with colors packed as (type << 24) | value */
+struct vt100_attr_t {
+  uint32_t fg;
+  uint32_t bg;
+  uint32_t ul;
+  uint8_t mode;
+  uint8_t ul_style;
+};
+
+struct vt100_style_t {
+  struct vt100_attr_t attr;
+  char *sgr; /* Cached vt100_sgr output, or NULL */
+  enum vt100_color_depth sgr_depth;
+};
+
+/* Table of interned attributes, each identified by a small integer */
+struct vt100_styles_t {
+  struct vt100_style_t *styles; /* styles[0] is the default style */
+  int count, size;
+  uint16_t *buckets; /* Open-addressed, id + 1 or 0 if empty */
+  int nbuckets;
+};
+
+/* One cached SGR transition, for vt100_sgr_cache_t */
+struct vt100_sgr_entry_cache_t {
+  uint32_t key;  /* (prev + 1) << 16 | next */
+  uint8_t depth; /* global_depth + 1, or 0 if empty */
+  uint8_t len;
+  char bytes[122];
+};
+
+/* Cache of minimal SGR sequences between pairs of styles */
+struct vt100_sgr_cache_t {
+  struct vt100_styles_t *styles;
+  struct vt100_sgr_entry_cache_t *entries;
+  int size; /* Power of two */
+  uint64_t hits, misses, evictions;
+};
+
+struct vt100_cell_t {
+  uint32_t ch;    /* Unicode codepoint (see vt100screen.h for others) */
+  uint16_t style; /* Id in a vt100_styles_t */
+};
+
+struct vt100_timer_t {
+  uint64_t calls, ns;
+};
+
+/* Counters and timings, if built with VT100UTILS_INSTRUMENT */
+struct vt100_stats_t {
+  uint64_t nodes, allocs;
+  uint64_t decode_bytes, encode_bytes, sgr_bytes, frame_bytes;
+  uint64_t parse_aborts;
+  struct vt100_timer_t decode, parse, sgr, encode, frame;
+};
+
+/* What vt100_style_intern returns once every 16-bit id is taken */
+constexpr uint16_t vt100_style_none = UINT16_MAX;
+/* What SGR 0 and 39/49/59 select: whatever the terminal's defaults are */
+constexpr struct vt100_color_t default_fg = {default_color, 0},
+                               default_bg = {default_color, 0},
+                               default_ul = {default_color, 0};
+/* The decoder's graphics state, per thread so threads can decode at once */
+inline thread_local struct vt100_color_t global_fg = default_fg,
+                                         global_bg = default_bg,
+                                         global_ul = default_ul;
+inline thread_local uint8_t global_mode, global_ul_style;
+inline thread_local int global_link;
+inline enum vt100_color_depth global_depth = depth_truecolor;
+/* Bitmask of (1 << vt100_seq_type) kept as nodes rather than stripped */
+inline uint32_t global_preserve;
+/* If set, decoded nodes are given style ids from this table */
+inline struct vt100_styles_t *global_styles;
+/* If set, vt100_encode reuses transitions from this cache */
+inline struct vt100_sgr_cache_t *global_sgr_cache;
+
+inline char *empty_str = (char*)"";
+
+#ifdef VT100UTILS_INSTRUMENT
+/*
+ * Each thread counts into stats of its own, so counting never contends.
+ *   Only the owner writes them, but with relaxed atomic stores, so that
+ *   vt100_stats_snapshot can sum every thread's from any thread.  A
+ *   thread's counts are kept in vt100_stats_exited when it exits.
+ */
+struct vt100_thread_stats_t {
+  struct vt100_stats_t stats = {};
+
+  vt100_thread_stats_t();
+  ~vt100_thread_stats_t();
+};
+
+inline std::mutex vt100_stats_lock;
+inline std::vector<struct vt100_thread_stats_t *> vt100_stats_threads;
+/* Counts of exited threads, and the totals at the last reset */
+inline struct vt100_stats_t vt100_stats_exited, vt100_stats_base;
+
+inline thread_local struct vt100_thread_stats_t vt100_local_stats;
+
+inline void vt100_stats_add(uint64_t *counter, uint64_t n) {
+  std::atomic_ref<uint64_t> c(*counter);
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/* Adds (or with sign -1, subtracts) every counter of from to to */
+inline void vt100_stats_merge(struct vt100_stats_t *to,
+                              struct vt100_stats_t *from, int sign) {
+  static_assert(sizeof(struct vt100_stats_t) % sizeof(uint64_t) == 0);
+  uint64_t *a = (uint64_t *)to, *b = (uint64_t *)from;
 
-static char *empty_str = (char*)"";
+  for (size_t i = 0; i < sizeof(*to) / sizeof(uint64_t); i++)
+    a[i] += sign * std::atomic_ref<uint64_t>(b[i]).load(
+                       std::memory_order_relaxed);
+}
+
+inline vt100_thread_stats_t::vt100_thread_stats_t() {
+  std::lock_guard<std::mutex> lock(vt100_stats_lock);
+  vt100_stats_threads.push_back(this);
+}
+
+inline vt100_thread_stats_t::~vt100_thread_stats_t() {
+  std::lock_guard<std::mutex> lock(vt100_stats_lock);
+  vt100_stats_merge(&vt100_stats_exited, &this->stats, 1);
+  std::erase(vt100_stats_threads, this);
+}
+
+/* Adds the time until it goes out of scope to a timer */
+struct vt100_scope_t {
+  struct vt100_timer_t *timer;
+  std::chrono::steady_clock::time_point start;
+
+  vt100_scope_t(struct vt100_timer_t *t)
+      : timer(t), start(std::chrono::steady_clock::now()) {}
+  ~vt100_scope_t() {
+    vt100_stats_add(&timer->calls, 1);
+    vt100_stats_add(&timer->ns,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count());
+  }
+};
+#endif
 
 /**
  * LIBRARY FUNCTIONS
  */
 
+constexpr uint32_t vt100_pack_color(struct vt100_color_t color) {
+  return ((uint32_t)color.type << 24) | (color.value & 0xffffff);
+}
+
+inline struct vt100_color_t vt100_unpack_color(uint32_t color) {
+  return {(vt100_color_type)(color >> 24), color & 0xffffff};
+}
+
+constexpr struct vt100_attr_t
+vt100_pack_attr(const struct vt100_node_t *node) {
+  return {vt100_pack_color(node->fg), vt100_pack_color(node->bg),
+          vt100_pack_color(node->ul), node->mode, node->ul_style};
+}
+
+inline void vt100_unpack_attr(struct vt100_node_t *node,
+                              struct vt100_attr_t attr) {
+  node->fg = vt100_unpack_color(attr.fg);
+  node->bg = vt100_unpack_color(attr.bg);
+  node->ul = vt100_unpack_color(attr.ul);
+  node->mode = attr.mode;
+  node->ul_style = attr.ul_style;
+}
+
+constexpr int vt100_attr_eq(struct vt100_attr_t a, struct vt100_attr_t b) {
+  return a.fg == b.fg && a.bg == b.bg && a.ul == b.ul && a.mode == b.mode &&
+         a.ul_style == b.ul_style;
+}
+
+inline uint32_t vt100_attr_hash(struct vt100_attr_t a) {
+  uint32_t hash = a.fg * 2654435761u;
+  hash = (hash ^ a.bg) * 2654435761u;
+  hash = (hash ^ a.ul) * 2654435761u;
+  hash = (hash ^ (a.mode | (a.ul_style << 8))) * 2654435761u;
+  return hash ^ (hash >> 16);
+}
+
+/*
+ * vt100_utf8_put: Encodes a codepoint as
+ *   UTF-8, returning the number of bytes
+ */
+inline int vt100_utf8_put(char *buf, uint32_t cp) {
+  if (cp < 0x80) {
+    buf[0] = cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    buf[0] = 0xc0 | (cp >> 6);
+    buf[1] = 0x80 | (cp & 0x3f);
+    return 2;
+  }
+  if (cp < 0x10000) {
+    buf[0] = 0xe0 | (cp >> 12);
+    buf[1] = 0x80 | ((cp >> 6) & 0x3f);
+    buf[2] = 0x80 | (cp & 0x3f);
+    return 3;
+  }
+  buf[0] = 0xf0 | (cp >> 18);
+  buf[1] = 0x80 | ((cp >> 12) & 0x3f);
+  buf[2] = 0x80 | ((cp >> 6) & 0x3f);
+  buf[3] = 0x80 | (cp & 0x3f);
+  return 4;
+}
+
+/*
+ * vt100_utf8_get: Decodes the codepoint at
+ *   *str, advancing it; malformed or truncated
+ *   sequences decode as U+FFFD, one byte each
+ */
+inline uint32_t vt100_utf8_get(const char **str, const char *end) {
+  const uint8_t *p = (const uint8_t *)*str;
+  uint32_t cp = p[0];
+  int n = cp < 0x80 ? 0 : cp >= 0xf0 ? 3 : cp >= 0xe0 ? 2 : cp >= 0xc0 ? 1 : -1;
+
+  if (n < 0 || end - *str <= n) {
+    (*str)++;
+    return n == 0 ? cp : 0xfffd;
+  }
+  cp &= 0x7f >> n;
+  for (int i = 1; i <= n; i++) {
+    if ((p[i] & 0xc0) != 0x80) {
+      (*str)++;
+      return 0xfffd;
+    }
+    cp = (cp << 6) | (p[i] & 0x3f);
+  }
+  *str += n + 1;
+  return cp;
+}
+
+/* Codepoint ranges taking no columns (combining marks, joiners, variation
+ *   selectors) or two (East Asian wide and fullwidth, most emoji) */
+inline constexpr uint32_t vt100_zero_width[][2] = {
+    {0x0300, 0x036f},   {0x0483, 0x0489},   {0x0591, 0x05bd},
+    {0x05bf, 0x05bf},   {0x05c1, 0x05c2},   {0x05c4, 0x05c5},
+    {0x0610, 0x061a},   {0x064b, 0x065f},   {0x0670, 0x0670},
+    {0x06d6, 0x06dc},   {0x06df, 0x06e4},   {0x0900, 0x0902},
+    {0x093a, 0x093a},   {0x093c, 0x093c},   {0x0941, 0x0948},
+    {0x094d, 0x094d},   {0x0e31, 0x0e31},   {0x0e34, 0x0e3a},
+    {0x0e47, 0x0e4e},   {0x1160, 0x11ff},   {0x200b, 0x200f},
+    {0x202a, 0x202e},   {0x2060, 0x2064},   {0x20d0, 0x20f0},
+    {0x302a, 0x302d},   {0x3099, 0x309a},   {0xfe00, 0xfe0f},
+    {0xfe20, 0xfe2f},   {0xfeff, 0xfeff},   {0x1f3fb, 0x1f3ff},
+    {0xe0001, 0xe007f}, {0xe0100, 0xe01ef},
+};
+inline constexpr uint32_t vt100_wide[][2] = {
+    {0x1100, 0x115f},   {0x231a, 0x231b},   {0x2329, 0x232a},
+    {0x23e9, 0x23ec},   {0x23f0, 0x23f0},   {0x23f3, 0x23f3},
+    {0x25fd, 0x25fe},   {0x2614, 0x2615},   {0x2648, 0x2653},
+    {0x267f, 0x267f},   {0x2693, 0x2693},   {0x26a1, 0x26a1},
+    {0x26aa, 0x26ab},   {0x26bd, 0x26be},   {0x26c4, 0x26c5},
+    {0x26ce, 0x26ce},   {0x26d4, 0x26d4},   {0x26ea, 0x26ea},
+    {0x26f2, 0x26f3},   {0x26f5, 0x26f5},   {0x26fa, 0x26fa},
+    {0x26fd, 0x26fd},   {0x2705, 0x2705},   {0x270a, 0x270b},
+    {0x2728, 0x2728},   {0x274c, 0x274c},   {0x274e, 0x274e},
+    {0x2753, 0x2755},   {0x2757, 0x2757},   {0x2795, 0x2797},
+    {0x27b0, 0x27b0},   {0x27bf, 0x27bf},   {0x2b1b, 0x2b1c},
+    {0x2b50, 0x2b50},   {0x2b55, 0x2b55},   {0x2e80, 0x303e},
+    {0x3041, 0x3247},   {0x3250, 0x4dbf},   {0x4e00, 0xa4cf},
+    {0xa960, 0xa97f},   {0xac00, 0xd7a3},   {0xf900, 0xfaff},
+    {0xfe10, 0xfe19},   {0xfe30, 0xfe6f},   {0xff00, 0xff60},
+    {0xffe0, 0xffe6},   {0x16fe0, 0x16fe4}, {0x17000, 0x18cff},
+    {0x1b000, 0x1b2ff}, {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf},
+    {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f200, 0x1f251},
+    {0x1f300, 0x1f320}, {0x1f32d, 0x1f335}, {0x1f337, 0x1f37c},
+    {0x1f37e, 0x1f393}, {0x1f3a0, 0x1f3ca}, {0x1f3cf, 0x1f3d3},
+    {0x1f3e0, 0x1f3f0}, {0x1f3f4, 0x1f3f4}, {0x1f3f8, 0x1f43e},
+    {0x1f440, 0x1f440}, {0x1f442, 0x1f4fc}, {0x1f4ff, 0x1f53d},
+    {0x1f54b, 0x1f54e}, {0x1f550, 0x1f567}, {0x1f57a, 0x1f57a},
+    {0x1f595, 0x1f596}, {0x1f5a4, 0x1f5a4}, {0x1f5fb, 0x1f64f},
+    {0x1f680, 0x1f6c5}, {0x1f6cc, 0x1f6cc}, {0x1f6d0, 0x1f6d2},
+    {0x1f6d5, 0x1f6d7}, {0x1f6eb, 0x1f6ec}, {0x1f6f4, 0x1f6fc},
+    {0x1f7e0, 0x1f7eb}, {0x1f90c, 0x1f93a}, {0x1f93c, 0x1f945},
+    {0x1f947, 0x1f9ff}, {0x1fa70, 0x1faff}, {0x20000, 0x2fffd},
+    {0x30000, 0x3fffd},
+};
+
+template <size_t N>
+constexpr bool vt100_in_ranges(const uint32_t (&ranges)[N][2], uint32_t cp) {
+  size_t lo = 0, hi = N;
+
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (cp > ranges[mid][1])
+      lo = mid + 1;
+    else if (cp < ranges[mid][0])
+      hi = mid;
+    else
+      return true;
+  }
+  return false;
+}
+
+/*
+ * vt100_wcwidth: Returns the columns a
+ *   terminal gives a codepoint: 0 for
+ *   controls and combining marks, 2 for
+ *   wide characters, and 1 otherwise
+ */
+constexpr int vt100_wcwidth(uint32_t cp) {
+  if (cp < 0x300)
+    return cp >= 0x20 && (cp < 0x7f || cp >= 0xa0);
+  if (vt100_in_ranges(vt100_zero_width, cp))
+    return 0;
+  return vt100_in_ranges(vt100_wide, cp) ? 2 : 1;
+}
+
+/*
+ * vt100_rgb: Returns the RGB value xterm
+ *   uses by default for a 256-color index
+ */
+constexpr uint32_t vt100_rgb(int i) {
+  constexpr uint8_t system[16][3] = {
+      {0, 0, 0},       {205, 0, 0},   {0, 205, 0},     {205, 205, 0},
+      {0, 0, 238},     {205, 0, 205}, {0, 205, 205},   {229, 229, 229},
+      {127, 127, 127}, {255, 0, 0},   {0, 255, 0},     {255, 255, 0},
+      {92, 92, 255},   {255, 0, 255}, {0, 255, 255},   {255, 255, 255},
+  };
+  constexpr uint8_t cube[6] = {0, 95, 135, 175, 215, 255};
+
+  if (i < 16)
+    return (system[i][0] << 16) | (system[i][1] << 8) | system[i][2];
+  if (i < 232) {
+    i -= 16;
+    return (cube[i / 36] << 16) | (cube[(i / 6) % 6] << 8) | cube[i % 6];
+  }
+  i = 8 + (i - 232) * 10;
+  return (i << 16) | (i << 8) | i;
+}
+
+constexpr int vt100_rgb_dist(uint32_t a, uint32_t b) {
+  int dr = (int)((a >> 16) & 0xff) - (int)((b >> 16) & 0xff),
+      dg = (int)((a >> 8) & 0xff) - (int)((b >> 8) & 0xff),
+      db = (int)(a & 0xff) - (int)(b & 0xff);
+  return dr * dr + dg * dg + db * db;
+}
+
+/*
+ * vt100_nearest_256: Maps an RGB value onto
+ *   the 6x6x6 cube or the grayscale ramp
+ *   of the 256-color palette, whichever
+ *   is closer (the 16 system colors vary
+ *   between terminals, so are never chosen)
+ */
+constexpr uint8_t vt100_nearest_256(uint32_t rgb) {
+  int r = (rgb >> 16) & 0xff, g = (rgb >> 8) & 0xff, b = rgb & 0xff;
+  auto level = [](int v) { return v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40; };
+  int cube = 16 + 36 * level(r) + 6 * level(g) + level(b);
+  int avg = (r + g + b) / 3;
+  int gray = 232 + (avg > 238 ? 23 : avg < 3 ? 0 : (avg - 3) / 10);
+
+  return vt100_rgb_dist(rgb, vt100_rgb(gray)) <
+                 vt100_rgb_dist(rgb, vt100_rgb(cube))
+             ? gray
+             : cube;
+}
+
+struct vt100_palette_map_t {
+  uint8_t to_16[256];
+  uint8_t to_8[256];
+};
+
+/*
+ * vt100_palette_map: 256-color index to nearest
+ *   16- and 8-color index, built at compile time
+ */
+constexpr struct vt100_palette_map_t vt100_palette_map = [] {
+  struct vt100_palette_map_t map = {};
+  for (int i = 0; i < 256; i++) {
+    int best_16 = 0, best_8 = 0;
+    for (int j = 1; j < 16; j++) {
+      int d = vt100_rgb_dist(vt100_rgb(i), vt100_rgb(j));
+      if (d < vt100_rgb_dist(vt100_rgb(i), vt100_rgb(best_16)))
+        best_16 = j;
+      if (j < 8 && d < vt100_rgb_dist(vt100_rgb(i), vt100_rgb(best_8)))
+        best_8 = j;
+    }
+    map.to_16[i] = i < 16 ? i : best_16;
+    map.to_8[i] = i < 8 ? i : i < 16 ? i - 8 : best_8;
+  }
+  return map;
+}();
+
+/*
+ * vt100_truecolor_lut: 32x32x32 lookup table
+ *   from 15-bit RGB to 256-color index,
+ *   built once on first use
+ */
+inline const uint8_t *vt100_truecolor_lut() {
+  static const struct lut_t {
+    uint8_t v[32 * 32 * 32];
+    lut_t() {
+      for (int i = 0; i < 32 * 32 * 32; i++) {
+        v[i] = vt100_nearest_256((((i >> 10) << 3 | 4) << 16) |
+                                 ((((i >> 5) & 31) << 3 | 4) << 8) |
+                                 ((i & 31) << 3 | 4));
+      }
+    }
+  } lut;
+  return lut.v;
+}
+
+/*
+ * vt100_downsample: Converts a color to the
+ *   nearest one representable at the given
+ *   color depth
+ */
+inline struct vt100_color_t vt100_downsample(struct vt100_color_t color,
+                                             enum vt100_color_depth depth) {
+  uint32_t index;
+
+  switch (color.type) {
+  case palette_8:
+    return color;
+  case palette_8_bright:
+    if (depth > depth_8)
+      return color;
+    return {palette_8, color.value};
+  case palette_256:
+    if (depth >= depth_256)
+      return color;
+    index = color.value & 0xff;
+    break;
+  case truecolor:
+    if (depth == depth_truecolor)
+      return color;
+    index = vt100_truecolor_lut()[((color.value >> 9) & 0x7c00) |
+                                  ((color.value >> 6) & 0x3e0) |
+                                  ((color.value >> 3) & 0x1f)];
+    if (depth == depth_256)
+      return {palette_256, index};
+    break;
+  default:
+    return color;
+  }
+
+  if (depth <= depth_8)
+    return {palette_8, vt100_palette_map.to_8[index]};
+
+  index = vt100_palette_map.to_16[index];
+  if (index < 8)
+    return {palette_8, index};
+  return {palette_8_bright, index - 8};
+}
+
+/*
+ * vt100_sgr_color: Formats the parameters
+ *   selecting a color, where base is 30
+ *   for foreground, 40 for background, and
+ *   50 for underline
+ */
+inline int vt100_sgr_color(char *buf, struct vt100_color_t color, int base) {
+  switch (color.type) {
+  case palette_8:
+    if (base == 50)
+      return sprintf(buf, "58;5;%i", color.value);
+    return sprintf(buf, "%i", color.value + base);
+  case palette_8_bright:
+    if (base == 50)
+      return sprintf(buf, "58;5;%i", color.value + 8);
+    return sprintf(buf, "%i", color.value + base + 60);
+  case palette_256:
+    return sprintf(buf, "%i;5;%i", base + 8, color.value);
+  case truecolor:
+    return sprintf(buf, "%i;2;%i;%i;%i", base + 8, (color.value >> 16) & 0xff,
+                   (color.value >> 8) & 0xff, (color.value >> 0) & 0xff);
+  case default_color:
+    return sprintf(buf, "%i", base + 9);
+  }
+  return 0;
+}
+
 /*
  * vt100_sgr: Generate an escape sequence
  *   representing the given node's graphics
- *   data
+ *   data, downsampled to global_depth
+ *
+ * Only attributes differing from prev are
+ *   emitted (attributes prev had are reset
+ *   only if node clears them); if nothing
+ *   differs, the result is an empty string.
+ *   Without prev, every attribute is.
  */
 inline char *vt100_sgr(struct vt100_node_t *node, struct vt100_node_t *prev) {
-  char *buf = (char *)malloc(128);
+  VT100_SCOPE(sgr);
+  char *buf = (char *)VT100_MALLOC(128);
   int len = sprintf(buf, "\x1b[");
+  struct vt100_color_t color, prev_color;
 
-  if (!prev || prev->fg.type != node->fg.type ||
-      prev->fg.value != node->fg.value) {
-    switch (node->fg.type) {
-    case palette_8:
-      len += sprintf(buf + len, "%i;", node->fg.value + 30);
-      break;
-    case palette_8_bright:
-      len += sprintf(buf + len, "%i;", node->fg.value + 90);
-      break;
-    case palette_256:
-      len += sprintf(buf + len, "38;5;%i;", node->fg.value);
-      break;
-    case truecolor:
-      len +=
-          sprintf(buf + len, "38;2;%i;%i;%i;", (node->fg.value >> 16) & 0xff,
-                  (node->fg.value >> 8) & 0xff, (node->fg.value >> 0) & 0xff);
-      break;
-    }
-  }
-
-  if (!prev || prev->bg.type != node->bg.type ||
-      prev->bg.value != node->bg.value) {
-    switch (node->bg.type) {
-    case palette_8:
-      len += sprintf(buf + len, "%i", node->bg.value + 40);
-      break;
-    case palette_8_bright:
-      len += sprintf(buf + len, "%i", node->bg.value + 100);
-      break;
-    case palette_256:
-      len += sprintf(buf + len, "48;5;%i", node->bg.value);
-      break;
-    case truecolor:
-      len +=
-          sprintf(buf + len, "48;2;%i;%i;%i", (node->bg.value >> 16) & 0xff,
-                  (node->bg.value >> 8) & 0xff, (node->bg.value >> 0) & 0xff);
-      break;
+  if (global_depth != depth_mono) {
+    for (int i = 0; i < 3; i++) {
+      color = vt100_downsample(i == 0   ? node->fg
+                               : i == 1 ? node->bg
+                                        : node->ul,
+                               global_depth);
+      if (prev) {
+        prev_color = vt100_downsample(i == 0   ? prev->fg
+                                      : i == 1 ? prev->bg
+                                               : prev->ul,
+                                      global_depth);
+      }
+      if (prev ? prev_color.type == color.type &&
+                     prev_color.value == color.value
+               : i == 2 && color.type == default_color)
+        continue;
+      if (len > 2)
+        buf[len++] = ';';
+      len += vt100_sgr_color(buf + len, color, 30 + 10 * i);
     }
   }
 
 #ifndef VT100UTILS_SKIP_FORMATTING
-  if (!prev || prev->mode != node->mode) {
+  if (!prev || prev->mode != node->mode || prev->ul_style != node->ul_style) {
+    /*
+     * Resets come first, since 22 (intensity) and 25 (blink) each
+     *   clear two attributes (and \x1b[21m is nonstandard), so the
+     *   other one is set again after them
+     */
+    constexpr uint8_t clear[8] = {22, 22, 23, 24, 25, 25, 27, 28};
+    uint8_t off = prev ? prev->mode & ~node->mode : ~node->mode;
+    uint8_t on = prev ? node->mode & ~prev->mode : node->mode;
+    int last = 0;
+    for (int i = 0; i < 8; i++) {
+      if (!(off & (1 << i)) || clear[i] == last)
+        continue;
+      last = clear[i];
+      len += sprintf(buf + len, len > 2 ? ";%i" : "%i", last);
+      for (int j = 0; j < 8; j++) {
+        if (clear[j] == last)
+          on |= node->mode & (1 << j);
+      }
+    }
+    if (prev && prev->ul_style != node->ul_style)
+      on |= node->mode & (1 << 3);
     for (int i = 0; i < 8; i++) {
-      len += sprintf(
-          buf + len, ";%i",
-          i + 1 + (20 * ((node->mode & (1 << i)) == 0)) /* Disable format */
-              + (1 * (i == 0 &&
-                      (node->mode & 1) == 0)) /* \x1b[21m is nonstandard */
-      );
+      if (!(on & (1 << i)))
+        continue;
+      if (i == 3 && node->ul_style > 1)
+        len += sprintf(buf + len, len > 2 ? ";4:%i" : "4:%i", node->ul_style);
+      else
+        len += sprintf(buf + len, len > 2 ? ";%i" : "%i", i + 1);
     }
   }
 #endif
 
-  sprintf(buf + len, "m");
+  if (len == 2)
+    buf[0] = '\0';
+  else
+    len += sprintf(buf + len, "m");
 
+  VT100_COUNT(sgr_bytes, len == 2 ? 0 : len);
   return buf;
 }
 
+/*
+ * vt100_style_intern: Returns the id of the
+ *   given attributes, adding them to the
+ *   table if they are not already present,
+ *   or vt100_style_none if it is full
+ */
+inline uint16_t vt100_style_intern(struct vt100_styles_t *styles,
+                                   struct vt100_attr_t attr) {
+  uint32_t i;
+  uint16_t id;
+
+  if (styles->count * 2 >= styles->nbuckets) {
+    VT100_FREE(styles->buckets);
+    styles->nbuckets = styles->nbuckets ? styles->nbuckets * 2 : 64;
+    styles->buckets =
+        (uint16_t *)VT100_CALLOC(styles->nbuckets, sizeof(uint16_t));
+    for (id = 0; id < styles->count; id++) {
+      i = vt100_attr_hash(styles->styles[id].attr);
+      while (styles->buckets[i & (styles->nbuckets - 1)])
+        i++;
+      styles->buckets[i & (styles->nbuckets - 1)] = id + 1;
+    }
+  }
+
+  for (i = vt100_attr_hash(attr);; i++) {
+    id = styles->buckets[i & (styles->nbuckets - 1)];
+    if (id == 0)
+      break;
+    if (vt100_attr_eq(styles->styles[id - 1].attr, attr))
+      return id - 1;
+  }
+
+  /* Ids are 16 bits, and the last one is vt100_style_none */
+  if (styles->count == vt100_style_none)
+    return vt100_style_none;
+
+  if (styles->count == styles->size) {
+    styles->size = styles->size ? styles->size * 2 : 16;
+    styles->styles = (struct vt100_style_t *)VT100_REALLOC(
+        styles->styles, sizeof(struct vt100_style_t) * styles->size);
+  }
+  styles->styles[styles->count] = {attr, NULL, depth_truecolor};
+  styles->buckets[i & (styles->nbuckets - 1)] = styles->count + 1;
+  return styles->count++;
+}
+
+/*
+ * vt100_styles_new: Creates a style table,
+ *   in which id 0 is the default style
+ */
+inline struct vt100_styles_t *vt100_styles_new(void) {
+  struct vt100_styles_t *styles =
+      (struct vt100_styles_t *)VT100_CALLOC(1, sizeof(struct vt100_styles_t));
+  struct vt100_node_t node = {};
+
+  node.fg = default_fg;
+  node.bg = default_bg;
+  node.ul = default_ul;
+  vt100_style_intern(styles, vt100_pack_attr(&node));
+
+  return styles;
+}
+
+inline void vt100_styles_free(struct vt100_styles_t *styles) {
+  for (int i = 0; i < styles->count; i++)
+    VT100_FREE(styles->styles[i].sgr);
+  VT100_FREE(styles->styles);
+  VT100_FREE(styles->buckets);
+  VT100_FREE(styles);
+}
+
+inline struct vt100_attr_t vt100_style_attr(struct vt100_styles_t *styles,
+                                            uint16_t id) {
+  return styles->styles[id].attr;
+}
+
+/*
+ * vt100_style_sgr: Returns the SGR sequence
+ *   selecting a style from scratch, formatted
+ *   once per style (and color depth)
+ */
+inline const char *vt100_style_sgr(struct vt100_styles_t *styles,
+                                   uint16_t id) {
+  struct vt100_style_t *style = &styles->styles[id];
+  struct vt100_node_t node = {};
+
+  if (!style->sgr || style->sgr_depth != global_depth) {
+    VT100_FREE(style->sgr);
+    vt100_unpack_attr(&node, style->attr);
+    style->sgr = vt100_sgr(&node, NULL);
+    style->sgr_depth = global_depth;
+  }
+  return style->sgr;
+}
+
+/*
+ * vt100_sgr_cache_new: Creates a cache of size
+ *   (rounded up to a power of two) transitions
+ *   between styles of the given table
+ */
+inline struct vt100_sgr_cache_t *
+vt100_sgr_cache_new(struct vt100_styles_t *styles, int size) {
+  struct vt100_sgr_cache_t *cache = (struct vt100_sgr_cache_t *)VT100_CALLOC(
+      1, sizeof(struct vt100_sgr_cache_t));
+
+  cache->styles = styles;
+  for (cache->size = 1; cache->size < size;)
+    cache->size *= 2;
+  cache->entries = (struct vt100_sgr_entry_cache_t *)VT100_CALLOC(
+      cache->size, sizeof(struct vt100_sgr_entry_cache_t));
+
+  return cache;
+}
+
+inline void vt100_sgr_cache_free(struct vt100_sgr_cache_t *cache) {
+  VT100_FREE(cache->entries);
+  VT100_FREE(cache);
+}
+
+/*
+ * vt100_sgr_cached: Writes the minimal SGR
+ *   sequence from style prev (or from nothing,
+ *   if prev is -1) to style next into out,
+ *   which must hold 128 bytes, returning its
+ *   length
+ *
+ * Hot transitions are a single lookup and copy.
+ */
+inline int vt100_sgr_cached(struct vt100_sgr_cache_t *cache, int prev,
+                            uint16_t next, char *out) {
+  uint32_t key = (uint32_t)(prev + 1) << 16 | next;
+  struct vt100_sgr_entry_cache_t *entry =
+      &cache->entries[(key * 2654435761u) >> 16 & (cache->size - 1)];
+  struct vt100_node_t node = {}, prev_node = {};
+  char *buf;
+  int len;
+
+  if (entry->key == key && entry->depth == global_depth + 1) {
+    cache->hits++;
+    VT100_COUNT(sgr_bytes, entry->len);
+    memcpy(out, entry->bytes, entry->len);
+    return entry->len;
+  }
+
+  cache->misses++;
+  vt100_unpack_attr(&node, cache->styles->styles[next].attr);
+  if (prev >= 0)
+    vt100_unpack_attr(&prev_node, cache->styles->styles[prev].attr);
+  buf = vt100_sgr(&node, prev >= 0 ? &prev_node : NULL);
+  len = strlen(buf);
+  memcpy(out, buf, len);
+  VT100_FREE(buf);
+
+  if (len <= (int)sizeof(entry->bytes)) {
+    if (entry->depth != 0)
+      cache->evictions++;
+    entry->key = key;
+    entry->depth = global_depth + 1;
+    entry->len = len;
+    memcpy(entry->bytes, out, len);
+  }
+  return len;
+}
+
+/*
+ * vt100_head_links: Returns the hyperlinks of
+ *   the chain starting at head, or NULL if
+ *   it has none
+ */
+inline struct vt100_links_t *vt100_head_links(struct vt100_node_t *head) {
+  return ((struct vt100_head_t *)head)->links;
+}
+
+/*
+ * vt100_link_url: Returns the URL a node of
+ *   the chain starting at head links to, or
+ *   NULL if it is not a hyperlink
+ */
+inline const char *vt100_link_url(struct vt100_node_t *head,
+                                  struct vt100_node_t *node) {
+  return node->link ? vt100_head_links(head)->urls[node->link - 1] : NULL;
+}
+
 /*
  * vt100_encode: Encode a chain of nodes as
  *   a continuous string, for printing to
  *   the terminal
+ *
+ * Hyperlinks (from the table of node, the
+ *   chain's first node) are opened and closed
+ *   only where the link changes.  If
+ *   global_sgr_cache is set, graphics are
+ *   copied from cached style transitions
+ *   (updating each node's style id).
  */
 inline char *vt100_encode(struct vt100_node_t *node) {
   int len = 0;
   int size;
-  char *out = (char *)malloc((size = MAX(node->len, 32)));
+  char *out = (char *)VT100_MALLOC((size = MAX(node->len, 32)));
   char *buf;
+  const char *url, *cur_url = NULL;
+  struct vt100_attr_t attr;
 
   struct vt100_node_t *tmp = node, *prev = NULL;
 
+  VT100_SCOPE(encode);
   while (tmp != NULL) {
-    while (len + tmp->len + 64 > size) {
-      out = (char *)realloc(out, (size *= 2));
+    url = vt100_link_url(node, tmp);
+
+    while (len + tmp->len + 160 + (url ? (int)strlen(url) : 0) > size) {
+      out = (char *)VT100_REALLOC(out, (size *= 2));
+    }
+
+    if (tmp->seq != seq_none) {
+      /* Preserved escape sequences are emitted as they were */
+      len += sprintf(out + len, "%s", tmp->str);
+      tmp = tmp->next;
+      continue;
     }
 
-    buf = vt100_sgr(tmp, prev);
+    /* Interned URLs can be compared by address */
+    if (url != cur_url) {
+      len += sprintf(out + len, "\x1b]8;;%s\x1b\\", url ? url : "");
+      cur_url = url;
+    }
 
-    len += sprintf(out + len, "%s%s", buf, tmp->str);
+    if (global_sgr_cache) {
+      /* Nodes may have been modified since they were decoded */
+      attr = vt100_pack_attr(tmp);
+      if (tmp->style >= global_sgr_cache->styles->count ||
+          !vt100_attr_eq(global_sgr_cache->styles->styles[tmp->style].attr,
+                         attr)) {
+        tmp->style = vt100_style_intern(global_sgr_cache->styles, attr);
+      }
+    }
 
-    free(buf);
+    /* Styles the table had no room for are formatted without the cache */
+    if (global_sgr_cache && tmp->style != vt100_style_none &&
+        (!prev || prev->style != vt100_style_none)) {
+      len += vt100_sgr_cached(global_sgr_cache, prev ? prev->style : -1,
+                              tmp->style, out + len);
+      memcpy(out + len, tmp->str, tmp->len);
+      len += tmp->len - 1;
+    } else {
+      buf = vt100_sgr(tmp, prev);
+      len += sprintf(out + len, "%s%s", buf, tmp->str);
+      VT100_FREE(buf);
+    }
 
     prev = tmp;
     tmp = tmp->next;
   }
 
+  if (cur_url) {
+    out = (char *)VT100_REALLOC(out, len + 8);
+    sprintf(out + len, "\x1b]8;;\x1b\\");
+  }
+
+  VT100_COUNT(encode_bytes, len);
   return out;
 }
 
+/*
+ * SGR dispatch table: maps each code below
+ *   108 to an operation and its argument,
+ *   replacing a switch over every code
+ */
+enum vt100_sgr_op {
+  sgr_ignore,
+  sgr_reset,
+  sgr_set,       /* arg: mode bits to set */
+  sgr_clear,     /* arg: mode bits to clear */
+  sgr_underline, /* arg: underline style */
+  sgr_fg,        /* arg: palette_8 index */
+  sgr_bg,
+  sgr_fg_bright,
+  sgr_bg_bright,
+  sgr_fg_ext, /* 38;5;n or 38;2;r;g;b */
+  sgr_bg_ext,
+  sgr_ul_ext,
+  sgr_fg_default,
+  sgr_bg_default,
+  sgr_ul_default,
+};
+
+struct vt100_sgr_entry_t {
+  uint8_t op;
+  uint8_t arg;
+};
+
+constexpr struct vt100_sgr_table_t {
+  struct vt100_sgr_entry_t codes[108];
+} vt100_sgr_table = [] {
+  struct vt100_sgr_table_t t = {};
+  t.codes[0] = {sgr_reset, 0};
+  for (int i = 1; i <= 8; i++)
+    t.codes[i] = {sgr_set, (uint8_t)(1 << (i - 1))};
+  t.codes[4] = {sgr_underline, 1};
+  t.codes[21] = {sgr_underline, 2};
+  t.codes[22] = {sgr_clear, 1 | 2};
+  t.codes[23] = {sgr_clear, 1 << 2};
+  t.codes[24] = {sgr_underline, 0};
+  t.codes[25] = {sgr_clear, 1 << 4 | 1 << 5};
+  t.codes[27] = {sgr_clear, 1 << 6};
+  t.codes[28] = {sgr_clear, 1 << 7};
+  for (int i = 0; i < 8; i++) {
+    t.codes[30 + i] = {sgr_fg, (uint8_t)i};
+    t.codes[40 + i] = {sgr_bg, (uint8_t)i};
+    t.codes[90 + i] = {sgr_fg_bright, (uint8_t)i};
+    t.codes[100 + i] = {sgr_bg_bright, (uint8_t)i};
+  }
+  t.codes[38] = {sgr_fg_ext, 0};
+  t.codes[48] = {sgr_bg_ext, 0};
+  t.codes[58] = {sgr_ul_ext, 0};
+  t.codes[39] = {sgr_fg_default, 0};
+  t.codes[49] = {sgr_bg_default, 0};
+  t.codes[59] = {sgr_ul_default, 0};
+  return t;
+}();
+
+/*
+ * vt100_sgr_ext: Reads an extended color
+ *   (5;n or 2;r;g;b) from args, in either
+ *   the ';' or the ':' form, returning the
+ *   number of args consumed or -1 if it
+ *   is malformed
+ */
+constexpr int vt100_sgr_ext(struct vt100_color_t *color, const int *args,
+                            const uint8_t *sub, int n) {
+  int i = 1, group = 1;
+  const int *rgb;
+
+  while (group < n && sub[group])
+    group++;
+
+  if (group > 1) {
+    /* 38:5:n, 38:2:r:g:b, or 38:2:<colorspace>:r:g:b */
+    if (args[1] == 5 && group >= 3) {
+      if (args[2] > 255)
+        return -1;
+      color->type = palette_256;
+      color->value = args[2];
+      return group;
+    }
+    if (args[1] != 2 || group < 5)
+      return -1;
+    rgb = args + (group >= 6 ? 3 : 2);
+  } else if (i < n && args[i] == 5) {
+    if (i + 1 >= n || args[i + 1] > 255)
+      return -1;
+    color->type = palette_256;
+    color->value = args[i + 1];
+    return 3;
+  } else if (i < n && args[i] == 2) {
+    if (i + 3 >= n)
+      return -1;
+    rgb = args + 2;
+    group = 5;
+  } else {
+    return -1;
+  }
+
+  color->type = truecolor;
+  color->value = ((rgb[0] & 0xff) << 16) | ((rgb[1] & 0xff) << 8) |
+                 (rgb[2] & 0xff);
+  return group;
+}
+
+/*
+ * vt100_apply_sgr: Applies the parameters of
+ *   an SGR sequence (the bytes between "\x1b["
+ *   and "m") to a node's attributes
+ *
+ * Returns 0, or -1 if the parameters are
+ *   malformed (in which case the node may
+ *   be partially modified).
+ */
+constexpr int vt100_apply_sgr(struct vt100_node_t *node, const char *start,
+                              const char *end) {
+  int args[256];
+  uint8_t sub[256];
+  int i = 0, j, n, value = 0;
+  struct vt100_sgr_entry_t entry;
+
+  sub[0] = 0;
+  for (const char *p = start;; p++) {
+    if (p == end || *p == ';' || *p == ':') {
+      args[i++] = value;
+      value = 0;
+      if (p == end)
+        break;
+      if (i == 256)
+        return -1;
+      sub[i] = (*p == ':');
+    } else if (*p >= '0' && *p <= '9') {
+      if (value < 100000)
+        value = value * 10 + (*p - '0');
+    } else {
+      return -1;
+    }
+  }
+
+  for (j = 0; j < i; j++) {
+    entry = args[j] < 108 ? vt100_sgr_table.codes[args[j]]
+                          : vt100_sgr_entry_t{sgr_ignore, 0};
+
+    switch (entry.op) {
+    case sgr_reset:
+      node->fg = default_fg;
+      node->bg = default_bg;
+      node->ul = default_ul;
+      node->mode = 0;
+      node->ul_style = 0;
+      break;
+    case sgr_set:
+      node->mode |= entry.arg;
+      break;
+    case sgr_clear:
+      node->mode &= ~entry.arg;
+      break;
+    case sgr_underline:
+      /* 4:n selects the underline style (0 disables it) */
+      if (j + 1 < i && sub[j + 1])
+        entry.arg = args[++j] > 5 ? 1 : args[j];
+      node->ul_style = entry.arg;
+      if (entry.arg)
+        node->mode |= (1 << 3);
+      else
+        node->mode &= ~(1 << 3);
+      break;
+    case sgr_fg:
+      node->fg = {palette_8, entry.arg};
+      break;
+    case sgr_bg:
+      node->bg = {palette_8, entry.arg};
+      break;
+    case sgr_fg_bright:
+      node->fg = {palette_8_bright, entry.arg};
+      break;
+    case sgr_bg_bright:
+      node->bg = {palette_8_bright, entry.arg};
+      break;
+    case sgr_fg_ext:
+    case sgr_bg_ext:
+    case sgr_ul_ext:
+      n = vt100_sgr_ext(entry.op == sgr_fg_ext   ? &node->fg
+                        : entry.op == sgr_bg_ext ? &node->bg
+                                                 : &node->ul,
+                        args + j, sub + j, i - j);
+      if (n < 0)
+        return -1;
+      j += n - 1;
+      break;
+    case sgr_fg_default:
+      node->fg = default_fg;
+      break;
+    case sgr_bg_default:
+      node->bg = default_bg;
+      break;
+    case sgr_ul_default:
+      node->ul = default_ul;
+      break;
+    default:
+      /* Skip the subparameters of unsupported codes */
+      while (j + 1 < i && sub[j + 1])
+        j++;
+      break;
+    }
+  }
+
+  return 0;
+}
+
 /*
  * vt100_parse: Parses a string beginning with
  *   "\x1b[" as a graphics/SGR escape sequence
  */
 inline const char *vt100_parse(struct vt100_node_t *node, const char *str) {
-  auto start = str + 2;
-  auto end = start;
-  int args[256];
-  int i = 0;
-  struct vt100_color_t *to_modify;
-
-  int j, state = 0;
+  auto end = str + 2;
+  VT100_SCOPE(parse);
 
   node->fg = global_fg;
   node->bg = global_bg;
+  node->ul = global_ul;
   node->mode = global_mode;
+  node->ul_style = global_ul_style;
 
   if (str[0] != '\x1b' || str[1] != '[')
     goto abort;
 
-  for (;;) {
-    switch (*end) {
+  while ((*end >= '0' && *end <= '9') || *end == ';' || *end == ':')
+    end++;
+
+  if (*end != 'm' || vt100_apply_sgr(node, str + 2, end) != 0)
+    goto abort;
+
+  global_fg = node->fg;
+  global_bg = node->bg;
+  global_ul = node->ul;
+  global_mode = node->mode;
+  global_ul_style = node->ul_style;
+  return end + 1;
+
+abort:;
+  VT100_COUNT(parse_aborts, 1);
+  node->fg = global_fg;
+  node->bg = global_bg;
+  node->ul = global_ul;
+  node->mode = global_mode;
+  node->ul_style = global_ul_style;
+  return str + 1;
+}
+
+/*
+ * vt100_find_esc: Returns a pointer to the
+ *   first '\x1b' in [str, end), or end if
+ *   there is none
+ */
+inline const char *vt100_find_esc(const char *str, const char *end) {
+#ifdef VT100UTILS_SSE2
+  const __m128i esc = _mm_set1_epi8('\x1b');
+  while (end - str >= 16) {
+    int mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)str), esc));
+    if (mask)
+      return str + __builtin_ctz(mask);
+    str += 16;
+  }
+#endif
+  const char *found = (const char *)memchr(str, '\x1b', end - str);
+  return found ? found : end;
+}
+
+/*
+ * vt100_seq_end: Given a pointer to '\x1b',
+ *   returns a pointer just past the escape
+ *   sequence it begins (CSI, OSC, DCS/SOS/PM/APC
+ *   strings, or a plain ESC sequence)
+ *
+ * Malformed sequences end at the first byte
+ *   that cannot belong to them; unterminated
+ *   ones run to end.
+ */
+constexpr const char *vt100_seq_end(const char *str, const char *end) {
+  const char *p = str + 1;
+
+  if (p >= end)
+    return end;
+
+  switch (*p++) {
+  case '[':
+    /* CSI: parameters, intermediates, final byte */
+    while (p < end && *p >= 0x30 && *p <= 0x3f)
+      p++;
+    while (p < end && *p >= 0x20 && *p <= 0x2f)
+      p++;
+    if (p < end && *p >= 0x40 && *p <= 0x7e)
+      p++;
+    return p;
+  case ']': /* OSC: terminated by BEL or ST */
+  case 'P': /* DCS */
+  case 'X': /* SOS */
+  case '^': /* PM */
+  case '_': /* APC */
+    for (; p < end; p++) {
+      if (*p == '\a' && str[1] == ']')
+        return p + 1;
+      if (*p == '\x1b' && p + 1 < end && p[1] == '\\')
+        return p + 2;
+    }
+    return end;
+  default:
+    /* nF/Fp/Fe/Fs: intermediates, then final byte */
+    p--;
+    while (p < end && *p >= 0x20 && *p <= 0x2f)
+      p++;
+    if (p < end && *p >= 0x30 && *p <= 0x7e)
+      p++;
+    return p;
+  }
+}
+
+/*
+ * vt100_classify: Classifies the complete
+ *   escape sequence [str, end), as returned
+ *   by vt100_seq_end
+ */
+constexpr enum vt100_seq_type vt100_classify(const char *str,
+                                             const char *end) {
+  const char *p = str + 2;
+
+  if (end - str < 2)
+    return seq_other;
+
+  switch (str[1]) {
+  case '[':
+    if (end - str < 3)
+      return seq_other;
+    switch (end[-1]) {
     case 'm':
-      args[i++] = atoi(start);
-      for (j = 0; j < i; j++) {
-        switch (state) {
-        case 0:
-          switch (args[j]) {
-          /* Reset */
-          case 0:
-            node->fg = default_fg;
-            node->bg = default_bg;
-            node->mode = 0;
-            break;
-          /* Formatting (bold, dim, italic, etc.) */
-          case 1:
-          case 2:
-          case 3:
-          case 4:
-          case 5:
-          case 6:
-          case 7:
-          case 8:
-          case 9:
-            node->mode |= (1 << (args[j] - 1));
-            break;
-          /* 8-color standard palette */
-          case 30:
-          case 31:
-          case 32:
-          case 33:
-          case 34:
-          case 35:
-          case 36:
-          case 37:
-            node->fg.type = palette_8;
-            node->fg.value = args[j] - 30;
-            break;
-          case 40:
-          case 41:
-          case 42:
-          case 43:
-          case 44:
-          case 45:
-          case 46:
-          case 47:
-            node->bg.type = palette_8;
-            node->bg.value = args[j] - 40;
-            break;
-          /* 8-color bright palette */
-          case 90:
-          case 91:
-          case 92:
-          case 93:
-          case 94:
-          case 95:
-          case 96:
-          case 97:
-            node->fg.type = palette_8_bright;
-            node->fg.value = args[j] - 90;
-            break;
-          case 100:
-          case 101:
-          case 102:
-          case 103:
-          case 104:
-          case 105:
-          case 106:
-          case 107:
-            node->bg.type = palette_8_bright;
-            node->bg.value = args[j] - 100;
-            break;
-          default:
-            state = args[j];
-            break;
-          }
-          break;
-        case 38:
-        case 48:
-          if (state == 38)
-            to_modify = &(node->fg);
-          else
-            to_modify = &(node->bg);
-
-          if (args[j] == 5) {
-            /* 256-color palette */
-            if (j + 1 >= i || args[j + 1] < 0 || args[j + 1] > 255)
-              goto abort;
-
-            to_modify->type = palette_256;
-            to_modify->value = args[++j];
-          } else if (args[j] == 2) {
-            /* Truecolor */
-            if (j + 3 >= i)
-              goto abort;
-
-            to_modify->type = truecolor;
-
-            to_modify->value = args[++j];
-            to_modify->value <<= 8;
-            to_modify->value |= args[++j];
-            to_modify->value <<= 8;
-            to_modify->value |= args[++j];
-          } else {
-            goto abort;
-          }
-          state = 0;
-          break;
-        }
-      }
+      while (p < end - 1 && ((*p >= '0' && *p <= '9') || *p == ';' || *p == ':'))
+        p++;
+      return p == end - 1 ? seq_sgr : seq_other;
+    case 'A': /* CUU */
+    case 'B': /* CUD */
+    case 'C': /* CUF */
+    case 'D': /* CUB */
+    case 'E': /* CNL */
+    case 'F': /* CPL */
+    case 'G': /* CHA */
+    case 'H': /* CUP */
+    case 'f': /* HVP */
+    case 'd': /* VPA */
+    case 's': /* SCOSC */
+    case 'u': /* SCORC */
+      return *p >= '<' && *p <= '?' ? seq_other : seq_cursor;
+    case 'J': /* ED */
+    case 'K': /* EL */
+    case 'X': /* ECH */
+      return *p >= '<' && *p <= '?' ? seq_other : seq_erase;
+    }
+    return seq_other;
+  case ']':
+    if (p[0] == '8' && p + 1 < end && p[1] == ';')
+      return seq_hyperlink;
+    if (p[0] >= '0' && p[0] <= '2' && p + 1 < end && p[1] == ';')
+      return seq_title;
+    return seq_other;
+  case '7': /* DECSC */
+  case '8': /* DECRC */
+  case 'D': /* IND */
+  case 'E': /* NEL */
+  case 'M': /* RI */
+    return end - str == 2 ? seq_cursor : seq_other;
+  }
+  return seq_other;
+}
+
+/*
+ * vt100_strip: Copies only the visible text of
+ *   str into out, without building any nodes
+ *
+ * out must hold at least len bytes, and may be
+ *   str itself to strip in place.  If map is
+ *   not NULL, map[i] is set to the offset in
+ *   str of out[i].  Returns the number of bytes
+ *   written (out is not null-terminated).
+ */
+inline size_t vt100_strip(const char *str, size_t len, char *out,
+                          size_t *map) {
+  const char *p = str, *end = str + len, *esc;
+  size_t n = 0, i;
+
+  while (p < end) {
+    esc = vt100_find_esc(p, end);
 
-      global_fg = node->fg;
-      global_bg = node->bg;
-      global_mode = node->mode;
-      return end + 1;
-    case ';':
-      args[i++] = atoi(start);
-      start = ++end;
+    if (map) {
+      for (i = 0; i < (size_t)(esc - p); i++)
+        map[n + i] = (p - str) + i;
+    }
+    if (out + n != p)
+      memmove(out + n, p, esc - p);
+    n += esc - p;
+
+    if (esc == end)
       break;
-    default:
-      if (*end >= '0' && *end <= '9')
-        end++;
-      else
-        goto abort;
+    p = vt100_seq_end(esc, end);
+  }
+
+  return n;
+}
+
+/*
+ * vt100_width: Returns the columns the
+ *   visible text of str takes, skipping
+ *   escape sequences
+ */
+inline int vt100_width(const char *str, size_t len) {
+  const char *p = str, *end = str + len;
+  int w = 0;
+
+  while (p < end) {
+    if (*p == '\x1b') {
+      p = vt100_seq_end(p, end);
+    } else if ((uint8_t)*p < 0x80) {
+      w += vt100_wcwidth((uint8_t)*p++);
+    } else {
+      w += vt100_wcwidth(vt100_utf8_get(&p, end));
+    }
+  }
+  return w;
+}
+
+inline uint32_t vt100_hash(const char *str, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+  return hash;
+}
+
+/*
+ * vt100_link_intern: Returns the id of the
+ *   given URL in the table, adding it if
+ *   it is not already present
+ */
+inline int vt100_link_intern(struct vt100_links_t *links, const char *url,
+                             size_t len) {
+  uint32_t i;
+  int id;
+
+  if (links->count * 2 >= links->nbuckets) {
+    VT100_FREE(links->buckets);
+    links->nbuckets = links->nbuckets ? links->nbuckets * 2 : 16;
+    links->buckets = (int *)VT100_CALLOC(links->nbuckets, sizeof(int));
+    for (id = 1; id <= links->count; id++) {
+      i = vt100_hash(links->urls[id - 1], strlen(links->urls[id - 1]));
+      while (links->buckets[i & (links->nbuckets - 1)])
+        i++;
+      links->buckets[i & (links->nbuckets - 1)] = id;
+    }
+  }
+
+  for (i = vt100_hash(url, len);; i++) {
+    id = links->buckets[i & (links->nbuckets - 1)];
+    if (id == 0)
       break;
+    if (strncmp(links->urls[id - 1], url, len) == 0 &&
+        links->urls[id - 1][len] == '\0')
+      return id;
+  }
+
+  if (links->count == links->size) {
+    links->size = links->size ? links->size * 2 : 8;
+    links->urls =
+        (char **)VT100_REALLOC(links->urls, links->size * sizeof(char *));
+  }
+  links->urls[links->count] = (char *)VT100_MALLOC(len + 1);
+  memcpy(links->urls[links->count], url, len);
+  links->urls[links->count][len] = '\0';
+
+  id = ++links->count;
+  links->buckets[i & (links->nbuckets - 1)] = id;
+  return id;
+}
+
+inline void vt100_links_free(struct vt100_links_t *links) {
+  for (int i = 0; i < links->count; i++)
+    VT100_FREE(links->urls[i]);
+  VT100_FREE(links->urls);
+  VT100_FREE(links->buckets);
+  VT100_FREE(links);
+}
+
+/*
+ * vt100_hyperlink_uri: Locates the URI within
+ *   an OSC 8 sequence [str, end), i.e.
+ *   "\x1b]8;params;URI" followed by BEL or ST
+ */
+inline const char *vt100_hyperlink_uri(const char *str, const char *end,
+                                       size_t *len) {
+  const char *uri = (const char *)memchr(str + 4, ';', end - (str + 4));
+
+  if (!uri) {
+    *len = 0;
+    return end;
+  }
+  uri++;
+  end -= (end[-1] == '\a') ? 1 : (end[-1] == '\\') ? 2 : 0;
+  *len = end > uri ? end - uri : 0;
+  return uri;
+}
+
+/*
+ * vt100_link_at: Finds the hyperlink under
+ *   the given row and column of an encoded
+ *   string, without decoding it
+ *
+ * Columns are counted as vt100_width does,
+ *   and rows as the string is drawn in a box:
+ *   empty lines take no row.
+ *
+ * Returns 1 and sets url/url_len if there is
+ *   one, otherwise 0.
+ */
+inline int vt100_link_at(const char *str, size_t len, int row, int col,
+                         const char **url, size_t *url_len) {
+  const char *p = str, *end = str + len, *seq_end, *line = str;
+  int r = 0, c = 0, w;
+
+  *url = NULL;
+  *url_len = 0;
+
+  while (p < end) {
+    if (*p == '\x1b') {
+      seq_end = vt100_seq_end(p, end);
+      if (vt100_classify(p, seq_end) == seq_hyperlink) {
+        *url = vt100_hyperlink_uri(p, seq_end, url_len);
+        if (*url_len == 0)
+          *url = NULL;
+      }
+      p = seq_end;
+      continue;
     }
+
+    if (*p == '\n') {
+      if (p > line)
+        r++;
+      line = ++p;
+      c = 0;
+      continue;
+    }
+    w = (uint8_t)*p < 0x80 ? vt100_wcwidth((uint8_t)*p++)
+                           : vt100_wcwidth(vt100_utf8_get(&p, end));
+    if (r == row && col >= c && col < c + w)
+      return *url != NULL;
+    c += w;
   }
 
-abort:;
+  return 0;
+}
+
+/*
+ * vt100_node_new: Appends a new, empty node
+ *   carrying the current graphics state, or
+ *   with prev NULL, starts a chain (which
+ *   vt100_free can free)
+ */
+inline struct vt100_node_t *vt100_node_new(struct vt100_node_t *prev) {
+  struct vt100_node_t *node = (struct vt100_node_t *)VT100_MALLOC(
+      prev ? sizeof(struct vt100_node_t) : sizeof(struct vt100_head_t));
+
+  VT100_COUNT(nodes, 1);
+  node->str = empty_str;
+  node->len = 1;
   node->fg = global_fg;
   node->bg = global_bg;
+  node->ul = global_ul;
   node->mode = global_mode;
-  return str + 1;
+  node->ul_style = global_ul_style;
+  node->seq = seq_none;
+  node->link = global_link;
+  node->style = global_styles
+                    ? vt100_style_intern(global_styles, vt100_pack_attr(node))
+                    : 0;
+  node->next = NULL;
+
+  if (prev)
+    prev->next = node;
+  else
+    ((struct vt100_head_t *)node)->links = NULL;
+  return node;
+}
+
+/*
+ * vt100_node_append: Appends n bytes to
+ *   a node's string
+ */
+inline void vt100_node_append(struct vt100_node_t *node, const char *str,
+                              int n) {
+  node->str = (char *)VT100_REALLOC(node->str == empty_str ? NULL : node->str,
+                              node->len + n);
+  memcpy(node->str + node->len - 1, str, n);
+  node->len += n;
+  node->str[node->len - 1] = '\0';
 }
 
 /*
  * vt100_decode: Decodes an input string
  *   into a chain of nodes
+ *
+ * Each SGR or OSC 8 hyperlink sequence begins
+ *   a new node.  Other escape sequences are
+ *   stripped, unless their type is set in
+ *   global_preserve, in which case they become
+ *   nodes of their own (with seq set to their
+ *   type).
+ *
+ * Hyperlink URLs are interned in a table
+ *   shared by all nodes of the document,
+ *   held by its first node (see
+ *   vt100_link_url).
  */
 inline struct vt100_node_t *vt100_decode(const char *str) {
-  struct vt100_node_t *head = (struct vt100_node_t *)malloc(
-                          sizeof(struct vt100_node_t)),
-                      *cur = head;
-  auto start = str;
-  auto end = str;
+  struct vt100_node_t *head, *cur;
+  struct vt100_links_t *links = NULL;
+  const char *end = str + strlen(str), *esc, *seq_end, *uri;
+  enum vt100_seq_type type;
+  size_t uri_len;
+
+  VT100_SCOPE(decode);
+  VT100_COUNT(decode_bytes, end - str);
 
-  cur->str = empty_str;
-  cur->fg = global_fg;
-  cur->bg = global_bg;
+  /* Link ids are only meaningful within one document */
+  global_link = 0;
+  head = cur = vt100_node_new(NULL);
 
   for (;;) {
-    switch (*end) {
-    case '\0': /* Fall through */
-    case '\x1b':
-      if (end != start) {
-        cur->str = (char *)malloc(end - start + 1);
-        strncpy(cur->str, start, end - start);
-        cur->str[end - start] = '\0';
-        cur->len = end - start + 1;
-      }
+    esc = vt100_find_esc(str, end);
 
-      if (*end == '\0')
-        return head;
+    if (esc != str) {
+      if (cur->seq != seq_none)
+        cur = vt100_node_new(cur);
+      vt100_node_append(cur, str, esc - str);
+    }
 
-      cur->next = (vt100_node_t *)malloc(sizeof(struct vt100_node_t));
-      cur = cur->next;
-      cur->next = NULL;
-      start = vt100_parse(cur, end);
-      /* Fall through */
-    default:
-      end++;
+    if (esc == end)
       break;
+
+    seq_end = vt100_seq_end(esc, end);
+    type = vt100_classify(esc, seq_end);
+
+    if (type == seq_sgr) {
+      cur = vt100_node_new(cur);
+      vt100_parse(cur, esc);
+      if (global_styles)
+        cur->style = vt100_style_intern(global_styles, vt100_pack_attr(cur));
+    } else if (type == seq_hyperlink) {
+      uri = vt100_hyperlink_uri(esc, seq_end, &uri_len);
+      if (uri_len && !links)
+        links = (struct vt100_links_t *)VT100_CALLOC(1, sizeof(*links));
+      global_link = uri_len ? vt100_link_intern(links, uri, uri_len) : 0;
+      cur = vt100_node_new(cur);
+    } else if (global_preserve & (1 << type)) {
+      cur = vt100_node_new(cur);
+      cur->seq = type;
+      vt100_node_append(cur, esc, seq_end - esc);
     }
+
+    str = seq_end;
   }
+
+  ((struct vt100_head_t *)head)->links = links;
+  return head;
 }
 
+/*
+ * vt100_free: Frees a chain started by
+ *   vt100_node_new (as vt100_decode's are),
+ *   with its hyperlinks
+ */
 inline void vt100_free(struct vt100_node_t *head) {
-  struct vt100_node_t *tmp = head->next, *prev = head;
+  struct vt100_node_t *next;
 
-  while (tmp != NULL) {
-    if (prev->str != empty_str && prev->str != NULL)
-      free(prev->str);
-    free(prev);
-    prev = tmp;
-    tmp = tmp->next;
+  if (vt100_head_links(head))
+    vt100_links_free(vt100_head_links(head));
+
+  while (head != NULL) {
+    next = head->next;
+    if (head->str != empty_str && head->str != NULL)
+      VT100_FREE(head->str);
+    VT100_FREE(head);
+    head = next;
   }
+}
+
+/*
+ * vt100_stats_snapshot: Returns the counters
+ *   accumulated so far by every thread (all
+ *   zero unless instrumented), optionally
+ *   resetting them
+ *
+ * Safe to call while other threads count;
+ *   their counts so far are included.
+ */
+inline struct vt100_stats_t vt100_stats_snapshot(int reset) {
+  struct vt100_stats_t stats = {};
+#ifdef VT100UTILS_INSTRUMENT
+  std::lock_guard<std::mutex> lock(vt100_stats_lock);
+  struct vt100_stats_t total = {};
 
-  free(prev->str);
-  free(prev);
+  /* Threads' counters are never cleared, so a reset moves the base */
+  vt100_stats_merge(&total, &vt100_stats_exited, 1);
+  for (auto thread : vt100_stats_threads)
+    vt100_stats_merge(&total, &thread->stats, 1);
+  stats = total;
+  vt100_stats_merge(&stats, &vt100_stats_base, -1);
+  if (reset)
+    vt100_stats_base = total;
+#else
+  (void)reset;
+#endif
+  return stats;
+}
+
+/*
+ * vt100_stats_json: Formats a snapshot as a
+ *   JSON object into buf, returning the
+ *   length it needs (as snprintf does)
+ */
+inline int vt100_stats_json(const struct vt100_stats_t *stats, char *buf,
+                            size_t size) {
+  return snprintf(
+      buf, size,
+      "{\"nodes\":%llu,\"allocs\":%llu,\"decode_bytes\":%llu,"
+      "\"encode_bytes\":%llu,\"sgr_bytes\":%llu,\"frame_bytes\":%llu,"
+      "\"parse_aborts\":%llu,"
+      "\"decode\":{\"calls\":%llu,\"ns\":%llu},"
+      "\"parse\":{\"calls\":%llu,\"ns\":%llu},"
+      "\"sgr\":{\"calls\":%llu,\"ns\":%llu},"
+      "\"encode\":{\"calls\":%llu,\"ns\":%llu},"
+      "\"frame\":{\"calls\":%llu,\"ns\":%llu}}",
+      (unsigned long long)stats->nodes, (unsigned long long)stats->allocs,
+      (unsigned long long)stats->decode_bytes,
+      (unsigned long long)stats->encode_bytes,
+      (unsigned long long)stats->sgr_bytes,
+      (unsigned long long)stats->frame_bytes,
+      (unsigned long long)stats->parse_aborts,
+      (unsigned long long)stats->decode.calls,
+      (unsigned long long)stats->decode.ns,
+      (unsigned long long)stats->parse.calls,
+      (unsigned long long)stats->parse.ns,
+      (unsigned long long)stats->sgr.calls, (unsigned long long)stats->sgr.ns,
+      (unsigned long long)stats->encode.calls,
+      (unsigned long long)stats->encode.ns,
+      (unsigned long long)stats->frame.calls,
+      (unsigned long long)stats->frame.ns);
 }
 
 #endif